@@ -1,4 +1,5 @@
 #include "BackendForwarder.h"
+#include "Probes.h"
 #include <macgyver/Exception.h>
 #include <algorithm>
 
@@ -12,16 +13,51 @@ BackendForwarder::BackendForwarder(float balancingCoefficient)
 
 BackendForwarder::~BackendForwarder() = default;
 
+void BackendForwarder::setPeerConnections(
+    std::shared_ptr<const PeerConnections> thePeerConnections)
+{
+  auto lock = this->lock();
+  itsPeerConnections = std::move(thePeerConnections);
+}
+
+void BackendForwarder::setInstrumentation(std::shared_ptr<Instrumentation> theInstrumentation,
+                                          std::size_t theType)
+{
+  SmartMet::Spine::WriteLock lock(itsMutex);
+  itsInstrumentation = std::move(theInstrumentation);
+  itsType = std::min(theType, Instrumentation::kForwarderTypes - 1);
+}
+
+void BackendForwarder::distribute(ReactorAccess& theReactor)
+{
+  SPUTNIK_PROBE2(redistribute_entry, itsType, itsBackendInfos.size());
+
+  if (!itsInstrumentation || !itsInstrumentation->enabled())
+    redistribute(theReactor);
+  else
+  {
+    const auto start = Instrumentation::Clock::now();
+    redistribute(theReactor);
+    itsInstrumentation->redistribute(itsType).add(Instrumentation::Clock::now() - start);
+  }
+
+  SPUTNIK_PROBE2(redistribute_return, itsType, itsBackendInfos.size());
+}
+
 void BackendForwarder::setBackends(const std::vector<BackendInfo>& backends,
-                                   Spine::Reactor& theReactor)
+                                   ReactorAccess& theReactor)
 {
   try
   {
-    SmartMet::Spine::WriteLock lock(itsMutex);
+    auto lock = this->lock();
 
     itsBackendInfos = backends;
 
-    this->redistribute(theReactor);
+    itsWeighted = std::any_of(itsBackendInfos.begin(),
+                              itsBackendInfos.end(),
+                              [](const BackendInfo& info) { return info.weight < 1.0F; });
+
+    distribute(theReactor);
   }
   catch (...)
   {
@@ -29,12 +65,12 @@ void BackendForwarder::setBackends(const std::vector<BackendInfo>& backends,
   }
 }
 
-std::size_t BackendForwarder::getBackend(Spine::Reactor& theReactor,
+std::size_t BackendForwarder::getBackend(ReactorAccess& theReactor,
                                          const Spine::HTTP::Request& /* theRequest */)
 {
   try
   {
-    SmartMet::Spine::WriteLock lock(itsMutex);
+    auto lock = this->lock();
     rebalance(theReactor);
     return boost::numeric_cast<std::size_t>(itsDistribution(itsGenerator));
   }
@@ -44,10 +80,111 @@ std::size_t BackendForwarder::getBackend(Spine::Reactor& theReactor,
   }
 }
 
+BackendForwarder::Explanation BackendForwarder::explain(ReactorAccess& theReactor,
+                                                       const Spine::HTTP::Request& theRequest)
+{
+  try
+  {
+    auto connections = connectionCounts(theReactor);
+
+    auto lock = this->lock();
+
+    Explanation ret;
+    ret.candidates.reserve(itsBackendInfos.size());
+    for (const auto& info : itsBackendInfos)
+    {
+      Explanation::Candidate candidate;
+      candidate.hostName = info.hostName;
+      candidate.port = info.port;
+      candidate.connections = connections[info.hostName][info.port];  // zero if not found
+      candidate.load = info.load;
+      candidate.weight = info.weight;
+      ret.candidates.push_back(std::move(candidate));
+    }
+
+    if (!ret.candidates.empty())
+      explainChoice(connections, theRequest, ret);
+
+    return ret;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+std::vector<float> BackendForwarder::probabilities(Connections& /* theConnections */) const
+{
+  std::vector<float> probVec;
+  probVec.reserve(itsBackendInfos.size());
+  for (const auto& info : itsBackendInfos)
+    probVec.push_back(info.weight);
+  return probVec;
+}
+
+void BackendForwarder::explainChoice(Connections& theConnections,
+                                     const Spine::HTTP::Request& /* theRequest */,
+                                     Explanation& theExplanation) const
+{
+  try
+  {
+    const auto probVec = probabilities(theConnections);
+    boost::random::discrete_distribution<> distribution(probVec);
+
+    const auto probs = distribution.probabilities();
+    for (std::size_t i = 0; i < probs.size() && i < theExplanation.candidates.size(); i++)
+      theExplanation.candidates[i].probability = probs[i];
+
+    auto generator = itsGenerator;
+    theExplanation.chosen = boost::numeric_cast<std::size_t>(distribution(generator));
+    theExplanation.method = "random choice by probability";
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void BackendForwarder::describe(std::vector<BackendInfo>& theBackends,
+                                std::vector<double>& theProbabilities)
+{
+  try
+  {
+    auto lock = this->lock();
+    theBackends = itsBackendInfos;
+    theProbabilities = itsDistribution.probabilities();
+    if (theProbabilities.size() != theBackends.size())
+      theProbabilities.clear();
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+std::size_t BackendForwarder::memoryUsage()
+{
+  try
+  {
+    auto lock = this->lock();
+
+    // The alias table of the distribution has a probability, an alias and a weight per backend
+    std::size_t bytes = sizeof(*this) + itsBackendInfos.capacity() * sizeof(BackendInfo) +
+                        itsBackendInfos.size() * (2 * sizeof(double) + sizeof(int));
+    for (const auto& info : itsBackendInfos)
+      bytes += info.hostName.capacity();
+    return bytes;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
 void BackendForwarder::addBackend(const std::string& hostName,
                                   int port,
                                   float load,
-                                  Spine::Reactor& theReactor)
+                                  ReactorAccess& theReactor)
 {
   try
   {
@@ -56,11 +193,11 @@ void BackendForwarder::addBackend(const std::string& hostName,
               << load << std::endl;
 #endif
 
-    SmartMet::Spine::WriteLock lock(itsMutex);
+    auto lock = this->lock();
 
     itsBackendInfos.emplace_back(hostName, port, load);
 
-    this->redistribute(theReactor);
+    distribute(theReactor);
   }
   catch (...)
   {
@@ -70,11 +207,11 @@ void BackendForwarder::addBackend(const std::string& hostName,
 
 void BackendForwarder::removeBackend(const std::string& hostName,
                                      int port,
-                                     Spine::Reactor& theReactor)
+                                     ReactorAccess& theReactor)
 {
   try
   {
-    SmartMet::Spine::WriteLock lock(itsMutex);
+    auto lock = this->lock();
 
     // Seems to me this code works incorrectly. It should remove the host from the previous
     // cycle only. If the host was not present then, the code will remove the host from
@@ -90,7 +227,111 @@ void BackendForwarder::removeBackend(const std::string& hostName,
       }
     }
 
-    this->redistribute(theReactor);
+    itsWeighted = std::any_of(itsBackendInfos.begin(),
+                              itsBackendInfos.end(),
+                              [](const BackendInfo& info) { return info.weight < 1.0F; });
+
+    distribute(theReactor);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+bool BackendForwarder::setWeight(const std::string& hostName,
+                                 int port,
+                                 float weight,
+                                 ReactorAccess& theReactor)
+{
+  try
+  {
+    auto lock = this->lock();
+
+    bool found = false;
+    bool changed = false;
+    for (auto& info : itsBackendInfos)
+    {
+      if (info.hostName == hostName && info.port == port)
+      {
+        found = true;
+        if (info.weight != weight)
+        {
+          info.weight = weight;
+          changed = true;
+        }
+      }
+    }
+
+    if (changed)
+    {
+      itsWeighted = std::any_of(itsBackendInfos.begin(),
+                                itsBackendInfos.end(),
+                                [](const BackendInfo& info) { return info.weight < 1.0F; });
+      distribute(theReactor);
+    }
+
+    return found;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+bool BackendForwarder::updateLoad(const std::string& hostName,
+                                  int port,
+                                  float load,
+                                  ReactorAccess& theReactor)
+{
+  try
+  {
+    auto lock = this->lock();
+
+    bool found = false;
+    for (auto& info : itsBackendInfos)
+    {
+      if (info.hostName == hostName && info.port == port)
+      {
+        info.load = load;
+        found = true;
+      }
+    }
+
+    if (found)
+      distribute(theReactor);
+
+    return found;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+bool BackendForwarder::updateLoads(const BackendLoads& theLoads, ReactorAccess& theReactor)
+{
+  try
+  {
+    auto lock = this->lock();
+
+    bool found = false;
+    for (auto& info : itsBackendInfos)
+    {
+      const auto host = theLoads.find(info.hostName);
+      if (host == theLoads.end())
+        continue;
+      const auto port = host->second.find(info.port);
+      if (port == host->second.end())
+        continue;
+      info.load = port->second;
+      found = true;
+    }
+
+    if (found)
+      distribute(theReactor);
+
+    return found;
   }
   catch (...)
   {
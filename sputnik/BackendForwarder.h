@@ -8,15 +8,19 @@
  */
 
 #include "BackendInfo.h"
+#include "Instrumentation.h"
+#include "PeerConnections.h"
+#include "ReactorAccess.h"
 #include <boost/random/discrete_distribution.hpp>
 #include <boost/random/mersenne_twister.hpp>
 #include <boost/random/taus88.hpp>
 #include <boost/thread.hpp>
 #include <spine/HTTP.h>
-#include <spine/Reactor.h>
 #include <spine/Thread.h>
+#include <map>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace SmartMet
@@ -30,6 +34,36 @@ namespace SmartMet
 class BackendForwarder
 {
  public:
+  // Loads by backend host name and port
+  using BackendLoads = std::map<std::string, std::map<int, float>>;
+
+  // Active connections by backend host name and port
+  using Connections = ReactorAccess::Connections;
+
+  /*! \brief How a request would be routed
+   *
+   * The candidates are in the order of the Broadcast service list.
+   */
+
+  struct Explanation
+  {
+    struct Candidate
+    {
+      std::string hostName;
+      int port = 0;
+      int connections = 0;
+      float load = 0;
+      float weight = 1;
+      double probability = -1;  // Negative if the choice is not random
+      std::string score;        // Forwarder specific score, if any
+      std::string note;         // Exclusion reason or other remarks
+    };
+
+    std::string method;  // How the choice is made
+    std::vector<Candidate> candidates;
+    std::size_t chosen = 0;  // The choice of the next request if nothing changes before it
+  };
+
   BackendForwarder() = delete;
   BackendForwarder(const BackendForwarder& other) = delete;
   BackendForwarder& operator=(const BackendForwarder& other) = delete;
@@ -51,15 +85,24 @@ class BackendForwarder
    * using the underlying balancing algorithm.
    */
 
-  virtual std::size_t getBackend(Spine::Reactor& theReactor,
-                                 const Spine::HTTP::Request& theRequest);
+  virtual std::size_t getBackend(ReactorAccess& theReactor, const Spine::HTTP::Request& theRequest);
+
+  /*! \brief Explain how the request would be routed
+   *
+   * Random choices are drawn with a copy of the generator, so the result is
+   * the choice of the next request if nothing changes in between. The state
+   * of the forwarder is not changed.
+   */
+
+  Explanation explain(ReactorAccess& theReactor, const Spine::HTTP::Request& theRequest);
 
   /*! \brief Set the internal backend list explicitly
    *
-   * Currently unused.
+   * Used when the routing table is rebuilt at the end of a discovery cycle,
+   * the probabilities are redistributed only once.
    */
 
-  void setBackends(const std::vector<BackendInfo>& backends, Spine::Reactor& theReactor);
+  void setBackends(const std::vector<BackendInfo>& backends, ReactorAccess& theReactor);
 
   /*! \brief Add backend to the underlying backend list
    *
@@ -67,7 +110,7 @@ class BackendForwarder
    * of a new backend.
    */
 
-  void addBackend(const std::string& hostName, int port, float load, Spine::Reactor& theReactor);
+  void addBackend(const std::string& hostName, int port, float load, ReactorAccess& theReactor);
 
   /*! \brief Remove backend from the underlying backend list
    *
@@ -75,7 +118,58 @@ class BackendForwarder
    * backend list.
    */
 
-  void removeBackend(const std::string& hostName, int port, Spine::Reactor& theReactor);
+  void removeBackend(const std::string& hostName, int port, ReactorAccess& theReactor);
+
+  /*! \brief Update the load of a backend
+   *
+   * This is called when Broadcast receives a load beacon
+   * from the backend. Returns false if the backend is unknown.
+   */
+
+  bool updateLoad(const std::string& hostName, int port, float load, ReactorAccess& theReactor);
+
+  /*! \brief Update the loads of several backends
+   *
+   * The probabilities are redistributed once if any of the backends is known.
+   */
+
+  bool updateLoads(const BackendLoads& theLoads, ReactorAccess& theReactor);
+
+  /*! \brief Set the weight of a backend
+   *
+   * Suspected backends get a weight below one and are chosen less often.
+   * Returns false if the backend is unknown.
+   */
+
+  bool setWeight(const std::string& hostName, int port, float weight, ReactorAccess& theReactor);
+
+  /*! \brief Set the connection counts reported by other frontends
+   *
+   * The connection based forwarders add these to the local counts.
+   */
+
+  void setPeerConnections(std::shared_ptr<const PeerConnections> thePeerConnections);
+
+  /*! \brief Set the latency statistics collector
+   *
+   * The type is the forwarding mode, the redistribution times are collected
+   * separately for each forwarder type.
+   */
+
+  void setInstrumentation(std::shared_ptr<Instrumentation> theInstrumentation,
+                          std::size_t theType);
+
+  /*! \brief Copy the backends and their current selection probabilities
+   *
+   * Used for tracing routing decisions, the state of the forwarder is not changed.
+   */
+
+  void describe(std::vector<BackendInfo>& theBackends, std::vector<double>& theProbabilities);
+
+  /*! \brief Approximate memory used by the forwarder in bytes
+   */
+
+  std::size_t memoryUsage();
 
   /*! \brief Destructor
    *
@@ -89,7 +183,7 @@ class BackendForwarder
    * This is called whenever the interal backend list changes.
    */
 
-  virtual void redistribute(Spine::Reactor& theReactor) {}
+  virtual void redistribute(ReactorAccess& theReactor) {}
 
   /*! \brief Redistributes the internal forwarding probabilities
    *
@@ -98,7 +192,51 @@ class BackendForwarder
    * some load balancers update their state every time.
    */
 
-  virtual void rebalance(Spine::Reactor& theReactor) {}
+  virtual void rebalance(ReactorAccess& theReactor) {}
+
+  /*! \brief Forwarding probabilities for the given connection counts
+   *
+   * The probabilities are proportional to the backend weights by default.
+   */
+
+  virtual std::vector<float> probabilities(Connections& theConnections) const;
+
+  /*! \brief Fill in the scores and the choice of an explanation
+   *
+   * The candidates and the connection counts have been filled in and the
+   * lock is held. By default the choice is drawn from probabilities().
+   */
+
+  virtual void explainChoice(Connections& theConnections,
+                             const Spine::HTTP::Request& theRequest,
+                             Explanation& theExplanation) const;
+
+  /*! \brief Calls redistribute and records its duration if enabled
+   */
+
+  void distribute(ReactorAccess& theReactor);
+
+  /*! \brief Lock the forwarder, recording the wait and hold times if enabled
+   */
+
+  TimedLock<Spine::WriteLock> lock()
+  {
+    return {itsMutex, itsInstrumentation.get(), Instrumentation::ForwarderWait,
+            Instrumentation::ForwarderHold};
+  }
+
+  /*! \brief Active connections by backend host and port
+   *
+   * Includes the connections reported by other frontends, if any.
+   */
+
+  auto connectionCounts(ReactorAccess& theReactor) const
+  {
+    auto connections = theReactor.getBackendRequestStatus();
+    if (itsPeerConnections)
+      itsPeerConnections->addTo(connections);
+    return connections;
+  }
 
   boost::taus88 itsGenerator;  /// The randomizer object for RNG.
 
@@ -109,6 +247,14 @@ class BackendForwarder
   SmartMet::Spine::MutexType itsMutex;  /// The mutex to ensure RNG thread safety.
 
   float itsBalancingCoefficient;  /// The balancing coefficient for distribution generation.
+
+  std::shared_ptr<const PeerConnections> itsPeerConnections;  /// Counts from other frontends.
+
+  bool itsWeighted = false;  /// True if some backend has a weight below one.
+
+  std::shared_ptr<Instrumentation> itsInstrumentation;  /// Latency statistics, if any.
+
+  std::size_t itsType = 0;  /// Forwarder type for the statistics.
 };
 
 using BackendForwarderPtr = std::shared_ptr<BackendForwarder>;
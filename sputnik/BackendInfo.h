@@ -23,6 +23,7 @@ struct BackendInfo
   std::string hostName;
   int port;
   float load;
+  float weight = 1.0F;  // Reduced from 1 when the failure detector suspects the backend
   mutable unsigned int throttle_counter = 0;
 };
 
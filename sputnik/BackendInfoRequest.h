@@ -1,6 +1,7 @@
 #pragma once
 
 #include "BackendServer.h"
+#include <atomic>
 #include <memory>
 #include <string>
 
@@ -16,8 +17,8 @@ class BackendInfoRequest
  private:
   std::shared_ptr<BackendServer> itsBackend;
   std::string itsName;          // Name of the info request (/info?what=<name>)
-  int itsLastUpdate;            // Unix timestamp for the last data update
-  int itsSequenceNumber;        // Sequence number from the broadcast message
+  std::atomic<int> itsLastUpdate;      // Unix timestamp for the last data update
+  std::atomic<int> itsSequenceNumber;  // Sequence number from the broadcast message
 
  public:
   // Accessors
@@ -26,6 +27,10 @@ class BackendInfoRequest
   int LastUpdate() const { return itsLastUpdate; }
   int SequenceNumber() const { return itsSequenceNumber; }
 
+  // Updated in place when the backend repeats an unchanged catalog
+  void setLastUpdate(int theLastUpdate) { itsLastUpdate = theLastUpdate; }
+  void setSequenceNumber(int theSequenceNumber) { itsSequenceNumber = theSequenceNumber; }
+
   ~BackendInfoRequest() = default;
 
   BackendInfoRequest(std::shared_ptr<BackendServer> theBackend,
@@ -0,0 +1,151 @@
+#include "BackendMetrics.h"
+#include <macgyver/Exception.h>
+#include <cmath>
+#include <vector>
+
+namespace SmartMet
+{
+// ----------------------------------------------------------------------
+/*!
+ * \brief The counters of a backend, created on first use
+ */
+// ----------------------------------------------------------------------
+
+BackendMetrics::Counters& BackendMetrics::counters(const std::string& theBackend)
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+  auto& ptr = itsBackends[theBackend];
+  if (!ptr)
+    ptr = std::make_unique<Counters>();
+  return *ptr;
+}
+
+void BackendMetrics::eject(const std::string& theBackend)
+{
+  try
+  {
+    counters(theBackend).ejections.fetch_add(1, std::memory_order_relaxed);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void BackendMetrics::roundTrip(const std::string& theBackend, double theMilliseconds)
+{
+  try
+  {
+    auto& c = counters(theBackend);
+    c.roundTrips.fetch_add(1, std::memory_order_relaxed);
+    c.roundTripSum.fetch_add(static_cast<std::uint64_t>(std::llround(1000 * theMilliseconds)),
+                             std::memory_order_relaxed);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void BackendMetrics::churn(std::size_t theAdded, std::size_t theRemoved, bool theCycleEnd)
+{
+  itsAdded.fetch_add(theAdded, std::memory_order_relaxed);
+  itsRemoved.fetch_add(theRemoved, std::memory_order_relaxed);
+  if (theCycleEnd)
+    itsCycles.fetch_add(1, std::memory_order_relaxed);
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Escape backslashes, quotes and newlines in a label value
+ */
+// ----------------------------------------------------------------------
+
+std::string BackendMetrics::label(const std::string& theValue)
+{
+  std::string ret;
+  ret.reserve(theValue.size());
+  for (char c : theValue)
+  {
+    if (c == '\\')
+      ret += "\\\\";
+    else if (c == '"')
+      ret += "\\\"";
+    else if (c == '\n')
+      ret += "\\n";
+    else
+      ret += c;
+  }
+  return ret;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Write the ejection, round trip and churn counters
+ */
+// ----------------------------------------------------------------------
+
+void BackendMetrics::write(std::ostream& theOutput) const
+{
+  try
+  {
+    struct Snapshot
+    {
+      std::string backend;
+      std::uint64_t ejections;
+      std::uint64_t roundTrips;
+      std::uint64_t roundTripSum;
+    };
+
+    std::vector<Snapshot> backends;
+    {
+      std::lock_guard<std::mutex> lock(itsMutex);
+      backends.reserve(itsBackends.size());
+      for (const auto& item : itsBackends)
+        backends.push_back({label(item.first),
+                            item.second->ejections.load(std::memory_order_relaxed),
+                            item.second->roundTrips.load(std::memory_order_relaxed),
+                            item.second->roundTripSum.load(std::memory_order_relaxed)});
+    }
+
+    theOutput << "# TYPE sputnik_backend_ejections counter\n"
+                 "# HELP sputnik_backend_ejections Removals of the backend from routing\n";
+    for (const auto& b : backends)
+      theOutput << "sputnik_backend_ejections_total{backend=\"" << b.backend << "\"} "
+                << b.ejections << '\n';
+
+    theOutput << "# TYPE sputnik_discovery_rtt_seconds summary\n"
+                 "# UNIT sputnik_discovery_rtt_seconds seconds\n"
+                 "# HELP sputnik_discovery_rtt_seconds Discovery request round trip time\n";
+    for (const auto& b : backends)
+    {
+      theOutput << "sputnik_discovery_rtt_seconds_sum{backend=\"" << b.backend << "\"} "
+                << static_cast<double>(b.roundTripSum) / 1e6 << '\n';
+      theOutput << "sputnik_discovery_rtt_seconds_count{backend=\"" << b.backend << "\"} "
+                << b.roundTrips << '\n';
+    }
+
+    theOutput << "# TYPE sputnik_discovery_cycles counter\n"
+                 "# HELP sputnik_discovery_cycles Completed discovery cycles\n"
+                 "sputnik_discovery_cycles_total "
+              << itsCycles.load(std::memory_order_relaxed) << '\n';
+
+    theOutput << "# TYPE sputnik_discovery_services_added counter\n"
+                 "# HELP sputnik_discovery_services_added Service entries added to the routing "
+                 "table\n"
+                 "sputnik_discovery_services_added_total "
+              << itsAdded.load(std::memory_order_relaxed) << '\n';
+
+    theOutput << "# TYPE sputnik_discovery_services_removed counter\n"
+                 "# HELP sputnik_discovery_services_removed Service entries removed from the "
+                 "routing table\n"
+                 "sputnik_discovery_services_removed_total "
+              << itsRemoved.load(std::memory_order_relaxed) << '\n';
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+}  // namespace SmartMet
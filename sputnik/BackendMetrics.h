@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+namespace SmartMet
+{
+/*! \brief Backend and discovery counters for the metrics export
+ *
+ * The counters are atomic, the map of backends is guarded by a mutex of its
+ * own which is taken only when a backend is seen for the first time and when
+ * the metrics are rendered. The routing table locks are never needed.
+ */
+
+class BackendMetrics
+{
+ public:
+  BackendMetrics() = default;
+  ~BackendMetrics() = default;
+
+  BackendMetrics(const BackendMetrics& other) = delete;
+  BackendMetrics& operator=(const BackendMetrics& other) = delete;
+  BackendMetrics(BackendMetrics&& other) = delete;
+  BackendMetrics& operator=(BackendMetrics&& other) = delete;
+
+  /*! \brief Count a removal of a backend from the routing table */
+  void eject(const std::string& theBackend);
+
+  /*! \brief Record a discovery round trip time in milliseconds */
+  void roundTrip(const std::string& theBackend, double theMilliseconds);
+
+  /*! \brief Count the service entries added and removed by a commit */
+  void churn(std::size_t theAdded, std::size_t theRemoved, bool theCycleEnd);
+
+  /*! \brief Total service entries added and removed so far */
+  std::uint64_t added() const { return itsAdded.load(std::memory_order_relaxed); }
+  std::uint64_t removed() const { return itsRemoved.load(std::memory_order_relaxed); }
+
+  /*! \brief Write the counters in OpenMetrics text format, without the EOF marker */
+  void write(std::ostream& theOutput) const;
+
+  /*! \brief Escape a label value for OpenMetrics */
+  static std::string label(const std::string& theValue);
+
+ private:
+  struct Counters
+  {
+    std::atomic<std::uint64_t> ejections{0};
+    std::atomic<std::uint64_t> roundTrips{0};
+    std::atomic<std::uint64_t> roundTripSum{0};  // Microseconds
+  };
+
+  Counters& counters(const std::string& theBackend);
+
+  mutable std::mutex itsMutex;  // This guards the map, not the counters
+  std::map<std::string, std::unique_ptr<Counters>> itsBackends;
+
+  std::atomic<std::uint64_t> itsCycles{0};
+  std::atomic<std::uint64_t> itsAdded{0};
+  std::atomic<std::uint64_t> itsRemoved{0};
+};
+
+}  // namespace SmartMet
@@ -53,6 +53,19 @@ unsigned int BackendSentinel::getCurrentThrottle()
   }
 }
 
+void BackendSentinel::setThrottle(unsigned int theThrottle)
+{
+  try
+  {
+    SmartMet::Spine::WriteLock lock(itsMutex);
+    itsThrottle = theThrottle;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
 void BackendSentinel::signalSentConnection()
 {
   try
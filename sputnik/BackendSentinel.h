@@ -31,6 +31,11 @@ class BackendSentinel
 
   unsigned int getCurrentThrottle();
 
+  /*! \brief Change the throttle limit without resetting the unanswered count
+   */
+
+  void setThrottle(unsigned int theThrottle);
+
   void signalSentConnection();
 
  private:
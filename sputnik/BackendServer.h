@@ -6,6 +6,7 @@
 #include <boost/tuple/tuple.hpp>
 #include <spine/Reactor.h>
 #include <spine/Thread.h>
+#include <atomic>
 #include <iostream>
 #include <map>
 #include <stdexcept>
@@ -21,8 +22,9 @@ class BackendServer
   std::string itsIP;
   int itsPort;
   std::string itsComment;
-  float itsLoad;
-  unsigned int itsThrottle;
+  std::string itsId;  // name:port, the key of the backend in the frontend maps
+  std::atomic<float> itsLoad;
+  std::atomic<unsigned int> itsThrottle;
 
  public:
   // Methods to read Service entry parameters
@@ -30,9 +32,17 @@ class BackendServer
   std::string& IP() { return itsIP; }
   std::string& Comment() { return itsComment; }
   int Port() const { return itsPort; }
+  const std::string& Id() const { return itsId; }
   float Load() const { return itsLoad; }
   unsigned int Throttle() const { return itsThrottle; }
 
+  // The backend is kept across discovery cycles, only the reported state changes
+  void update(float theLoad, unsigned int theThrottle)
+  {
+    itsLoad = theLoad;
+    itsThrottle = theThrottle;
+  }
+
   ~BackendServer() = default;
 
   BackendServer(std::string theName,
@@ -45,6 +55,7 @@ class BackendServer
         itsIP(std::move(theIP)),
         itsPort(thePort),
         itsComment(std::move(theComment)),
+        itsId(itsName + ":" + std::to_string(thePort)),
         itsLoad(theLoad),
         itsThrottle(theThrottle)
 
@@ -5,6 +5,8 @@
 #include <boost/tuple/tuple.hpp>
 #include <spine/Reactor.h>
 #include <spine/Thread.h>
+#include <atomic>
+#include <cstdint>
 #include <iostream>
 #include <map>
 #include <memory>
@@ -19,22 +21,27 @@ class BackendService
   // Private data members
   const std::shared_ptr<BackendServer> itsBackendServer;
   std::string itsURI;
-  int itsLastUpdate;
-  bool itsAllowCache;
-  int itsSequenceNumber;
+  std::atomic<int> itsLastUpdate;
+  std::atomic<bool> itsAllowCache;
+  std::atomic<int> itsSequenceNumber;
+  std::atomic<std::uint64_t> itsSelections{0};
   bool definesPrefix;
 
  public:
   // Methods to read Service entry parameters
-  std::shared_ptr<BackendServer> Backend() { return itsBackendServer; }
+  const std::shared_ptr<BackendServer>& Backend() const { return itsBackendServer; }
   const std::string& URI() const { return itsURI; }
   int LastUpdate() const { return itsLastUpdate; }
   bool AllowCache() const { return itsAllowCache; }
   int SequenceNumber() const { return itsSequenceNumber; }
   bool DefinesPrefix() const { return definesPrefix; }
+  std::uint64_t Selections() const { return itsSelections.load(std::memory_order_relaxed); }
   // Method to set some Service entry parameters
   void setLastUpdate(int theLastUpdate) { itsLastUpdate = theLastUpdate; }
   void setAllowCache(bool theAllowCache) { itsAllowCache = theAllowCache; }
+  void setSequenceNumber(int theSequenceNumber) { itsSequenceNumber = theSequenceNumber; }
+  // Count a request forwarded to this entry
+  void select() { itsSelections.fetch_add(1, std::memory_order_relaxed); }
 
   // Constructors
   BackendService(std::shared_ptr<BackendServer> theBackendServer,
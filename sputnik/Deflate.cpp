@@ -0,0 +1,73 @@
+#include "Deflate.h"
+#include <macgyver/Exception.h>
+#include <array>
+#include <zlib.h>
+
+namespace SmartMet
+{
+std::string deflateString(const std::string& theInput)
+{
+  try
+  {
+    uLongf size = compressBound(theInput.size());
+    std::string output(size, '\0');
+
+    int ret = compress2(reinterpret_cast<Bytef*>(output.data()),
+                        &size,
+                        reinterpret_cast<const Bytef*>(theInput.data()),
+                        theInput.size(),
+                        Z_BEST_SPEED);
+    if (ret != Z_OK)
+      throw Fmi::Exception(BCP, "Failed to deflate " + std::to_string(theInput.size()) + " bytes");
+
+    output.resize(size);
+    return output;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+std::string inflateString(const std::string& theInput, std::size_t theMaxSize)
+{
+  try
+  {
+    z_stream stream{};
+    if (inflateInit(&stream) != Z_OK)
+      throw Fmi::Exception(BCP, "Failed to initialize zlib inflate");
+
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(theInput.data()));
+    stream.avail_in = static_cast<uInt>(theInput.size());
+
+    std::string output;
+    std::array<char, 16384> buffer;
+    int ret = Z_OK;
+    while (ret == Z_OK)
+    {
+      stream.next_out = reinterpret_cast<Bytef*>(buffer.data());
+      stream.avail_out = static_cast<uInt>(buffer.size());
+      ret = inflate(&stream, Z_NO_FLUSH);
+      if (ret != Z_OK && ret != Z_STREAM_END)
+        break;
+      output.append(buffer.data(), buffer.size() - stream.avail_out);
+      if (output.size() > theMaxSize)
+        break;
+    }
+    inflateEnd(&stream);
+
+    if (ret != Z_STREAM_END)
+      throw Fmi::Exception(BCP, "Failed to inflate " + std::to_string(theInput.size()) + " bytes");
+    if (output.size() > theMaxSize)
+      throw Fmi::Exception(BCP,
+                           "Inflated message exceeds " + std::to_string(theMaxSize) + " bytes");
+
+    return output;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+}  // namespace SmartMet
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+
+namespace SmartMet
+{
+/*! \brief Compress a string using zlib deflate
+ *
+ * Used for discovery replies which do not fit into a single datagram.
+ */
+
+std::string deflateString(const std::string& theInput);
+
+/*! \brief Decompress a string compressed with deflateString
+ *
+ * Throws if the input is corrupt or inflates beyond the given size limit.
+ */
+
+std::string inflateString(const std::string& theInput, std::size_t theMaxSize);
+
+}  // namespace SmartMet
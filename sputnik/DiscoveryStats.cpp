@@ -0,0 +1,323 @@
+#include "DiscoveryStats.h"
+#include <macgyver/Exception.h>
+#include <smartmet/macgyver/StringConversion.h>
+#include <smartmet/spine/Table.h>
+#include <algorithm>
+#include <ctime>
+#include <iomanip>
+#include <sstream>
+
+namespace SmartMet
+{
+namespace
+{
+// Listeners are listed one by one up to this count, then summarized
+const std::size_t kMaxListedListeners = 8;
+
+std::string formatTime(std::chrono::system_clock::time_point theTime)
+{
+  const auto seconds = std::chrono::system_clock::to_time_t(theTime);
+  std::tm tm{};
+  gmtime_r(&seconds, &tm);
+
+  std::ostringstream out;
+  out << std::put_time(&tm, "%Y-%m-%dT%H:%M:%SZ");
+  return out.str();
+}
+
+std::string formatMilliseconds(double theValue)
+{
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(3) << theValue;
+  return out.str();
+}
+
+std::string formatListeners(const std::map<std::string, std::size_t>& theListeners)
+{
+  std::ostringstream out;
+  if (theListeners.size() <= kMaxListedListeners)
+  {
+    for (const auto& item : theListeners)
+    {
+      if (out.tellp() > 0)
+        out << ' ';
+      out << item.first << '=' << item.second;
+    }
+  }
+  else
+  {
+    const auto minmax = std::minmax_element(theListeners.begin(),
+                                            theListeners.end(),
+                                            [](const auto& a, const auto& b)
+                                            { return a.second < b.second; });
+    out << theListeners.size() << " listeners, min " << minmax.first->second << ", max "
+        << minmax.second->second;
+  }
+  return out.str();
+}
+
+}  // namespace
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Set the number of cycles kept
+ */
+// ----------------------------------------------------------------------
+
+void DiscoveryStats::configure(std::size_t theHistory)
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+  itsHistory = theHistory;
+  while (itsCycles.size() > itsHistory)
+    itsCycles.pop_front();
+}
+
+DiscoveryStats::Totals DiscoveryStats::totals(Services& theServices)
+{
+  const auto& metrics = theServices.getMetrics();
+  return {metrics.added(), metrics.removed(), theServices.writeLockTime()};
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Record sent probes
+ *
+ * The startup probes repeat the same sequence number and are added to the
+ * same cycle. A new sequence closes the churn accounting of the previous
+ * cycle, including the commits of late replies.
+ */
+// ----------------------------------------------------------------------
+
+void DiscoveryStats::begin(unsigned int theSequence,
+                           std::size_t theProbes,
+                           std::size_t theSendErrors,
+                           std::size_t theCatalogsCut,
+                           Services& theServices)
+{
+  try
+  {
+    if (!enabled())
+      return;
+
+    const auto now = totals(theServices);
+
+    std::lock_guard<std::mutex> lock(itsMutex);
+    if (itsCycles.empty() || itsCycles.back().sequence != theSequence)
+    {
+      if (!itsCycles.empty())
+        itsCycles.back().last = now;
+
+      Cycle cycle;
+      cycle.sequence = theSequence;
+      cycle.start = std::chrono::system_clock::now();
+      cycle.first = now;
+      cycle.last = now;
+      itsCycles.push_back(std::move(cycle));
+
+      while (itsCycles.size() > itsHistory)
+        itsCycles.pop_front();
+    }
+
+    auto& cycle = itsCycles.back();
+    cycle.probes += theProbes;
+    cycle.sendErrors += theSendErrors;
+    cycle.catalogsCut = std::max(cycle.catalogsCut, theCatalogsCut);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void DiscoveryStats::datagram(std::size_t theBytes, bool theTruncated, bool theParsed)
+{
+  if (!enabled())
+    return;
+
+  std::lock_guard<std::mutex> lock(itsMutex);
+  if (itsCycles.empty())
+    return;
+
+  auto& cycle = itsCycles.back();
+  ++cycle.datagrams;
+  cycle.bytes += theBytes;
+  cycle.maxBytes = std::max(cycle.maxBytes, theBytes);
+  if (theTruncated)
+    ++cycle.truncated;
+  else if (!theParsed)
+    ++cycle.parseFailures;
+}
+
+void DiscoveryStats::parseFailure()
+{
+  if (!enabled())
+    return;
+
+  std::lock_guard<std::mutex> lock(itsMutex);
+  if (!itsCycles.empty())
+    ++itsCycles.back().parseFailures;
+}
+
+void DiscoveryStats::reply(const std::string& theListener, bool theLate)
+{
+  try
+  {
+    if (!enabled())
+      return;
+
+    std::lock_guard<std::mutex> lock(itsMutex);
+    if (itsCycles.empty())
+      return;
+
+    auto& cycle = itsCycles.back();
+    ++cycle.replies;
+    if (theLate)
+      ++cycle.late;
+    ++cycle.listeners[theListener];
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void DiscoveryStats::roundTrip(const std::string& theBackend, double theMilliseconds)
+{
+  try
+  {
+    if (!enabled())
+      return;
+
+    std::lock_guard<std::mutex> lock(itsMutex);
+    if (itsCycles.empty())
+      return;
+
+    auto& cycle = itsCycles.back();
+    if (cycle.roundTrips.empty() || theMilliseconds > cycle.slowestRoundTrip)
+    {
+      cycle.slowest = theBackend;
+      cycle.slowestRoundTrip = theMilliseconds;
+    }
+    cycle.roundTrips.push_back(theMilliseconds);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Record the churn so far and the routing table memory
+ */
+// ----------------------------------------------------------------------
+
+void DiscoveryStats::finish(Services& theServices)
+{
+  try
+  {
+    if (!enabled())
+      return;
+
+    const auto now = totals(theServices);
+    const auto memory = theServices.memoryUsage();
+
+    std::lock_guard<std::mutex> lock(itsMutex);
+    if (itsCycles.empty())
+      return;
+
+    auto& cycle = itsCycles.back();
+    cycle.last = now;
+    cycle.memory = memory;
+    cycle.finished = true;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief The recorded cycles, newest first
+ *
+ * The memory columns are empty until the reply window of the cycle closes.
+ */
+// ----------------------------------------------------------------------
+
+std::unique_ptr<Spine::Table> DiscoveryStats::table() const
+{
+  try
+  {
+    std::deque<Cycle> cycles;
+    {
+      std::lock_guard<std::mutex> lock(itsMutex);
+      cycles = itsCycles;
+    }
+
+    auto ret = std::make_unique<Spine::Table>();
+    ret->setTitle(enabled() ? "Discovery cycles" : "Discovery cycles (statistics disabled)");
+    ret->setNames({"Sequence",  "Start",    "Probes",     "Send errors",   "Catalogs cut",
+                   "Datagrams", "Bytes",    "Max bytes",  "Truncated",     "Parse errors",
+                   "Replies",   "Late",     "Listeners",  "RTT p50 ms",    "RTT max ms",
+                   "Slowest",   "Added",    "Removed",    "Write lock ms", "URIs",
+                   "Entries",   "Backends", "Forwarders", "Table bytes"});
+
+    std::size_t row = 0;
+    for (auto it = cycles.rbegin(); it != cycles.rend(); ++it, ++row)
+    {
+      auto& cycle = *it;
+      std::size_t col = 0;
+      ret->set(col++, row, Fmi::to_string(static_cast<std::size_t>(cycle.sequence)));
+      ret->set(col++, row, formatTime(cycle.start));
+      ret->set(col++, row, Fmi::to_string(cycle.probes));
+      ret->set(col++, row, Fmi::to_string(cycle.sendErrors));
+      ret->set(col++, row, Fmi::to_string(cycle.catalogsCut));
+      ret->set(col++, row, Fmi::to_string(cycle.datagrams));
+      ret->set(col++, row, Fmi::to_string(cycle.bytes));
+      ret->set(col++, row, Fmi::to_string(cycle.maxBytes));
+      ret->set(col++, row, Fmi::to_string(cycle.truncated));
+      ret->set(col++, row, Fmi::to_string(cycle.parseFailures));
+      ret->set(col++, row, Fmi::to_string(cycle.replies));
+      ret->set(col++, row, Fmi::to_string(cycle.late));
+      ret->set(col++, row, formatListeners(cycle.listeners));
+
+      auto& rtts = cycle.roundTrips;
+      if (!rtts.empty())
+      {
+        const auto median = rtts.begin() + static_cast<std::ptrdiff_t>(rtts.size() / 2);
+        std::nth_element(rtts.begin(), median, rtts.end());
+        ret->set(col++, row, formatMilliseconds(*median));
+        ret->set(col++, row, formatMilliseconds(cycle.slowestRoundTrip));
+      }
+      else
+        col += 2;
+      ret->set(col++, row, cycle.slowest);
+
+      ret->set(col++, row, Fmi::to_string(cycle.last.added - cycle.first.added));
+      ret->set(col++, row, Fmi::to_string(cycle.last.removed - cycle.first.removed));
+      ret->set(col++,
+               row,
+               formatMilliseconds(
+                   static_cast<double>(cycle.last.writeLockTime - cycle.first.writeLockTime) /
+                   1e6));
+
+      if (cycle.finished)
+      {
+        ret->set(col++, row, Fmi::to_string(cycle.memory.uris));
+        ret->set(col++, row, Fmi::to_string(cycle.memory.entries));
+        ret->set(col++, row, Fmi::to_string(cycle.memory.backends));
+        ret->set(col++, row, Fmi::to_string(cycle.memory.forwarders));
+        ret->set(col++, row, Fmi::to_string(cycle.memory.bytes));
+      }
+    }
+
+    return ret;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+}  // namespace SmartMet
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "Services.h"
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace SmartMet
+{
+namespace Spine
+{
+class Table;
+}
+
+/*! \brief Statistics of the most recent discovery cycles
+ *
+ * The IO thread records the probes, the received datagrams and the replies
+ * of the current cycle. Routing table churn and write lock time are taken
+ * as differences of the cumulative counters of Services, so replies which
+ * are committed after the deadline are still charged to their own cycle.
+ * The routing table memory is sampled when the reply window closes.
+ */
+
+class DiscoveryStats
+{
+ public:
+  DiscoveryStats() = default;
+  ~DiscoveryStats() = default;
+
+  DiscoveryStats(const DiscoveryStats& other) = delete;
+  DiscoveryStats& operator=(const DiscoveryStats& other) = delete;
+  DiscoveryStats(DiscoveryStats&& other) = delete;
+  DiscoveryStats& operator=(DiscoveryStats&& other) = delete;
+
+  /*! \brief Set the number of cycles kept, zero disables the statistics */
+  void configure(std::size_t theHistory);
+
+  bool enabled() const { return itsHistory > 0; }
+
+  /*! \brief Record sent probes, a new sequence number starts a new cycle
+   *
+   * theCatalogsCut is the number of known catalogs left out of the probe.
+   */
+  void begin(unsigned int theSequence,
+             std::size_t theProbes,
+             std::size_t theSendErrors,
+             std::size_t theCatalogsCut,
+             Services& theServices);
+
+  /*! \brief Record a received datagram */
+  void datagram(std::size_t theBytes, bool theTruncated, bool theParsed);
+
+  /*! \brief Record a reassembled reply which could not be parsed */
+  void parseFailure();
+
+  /*! \brief Record a discovery reply received via the listener */
+  void reply(const std::string& theListener, bool theLate);
+
+  /*! \brief Record the round trip time of a backend in milliseconds */
+  void roundTrip(const std::string& theBackend, double theMilliseconds);
+
+  /*! \brief Record the routing table state at the end of the reply window */
+  void finish(Services& theServices);
+
+  /*! \brief The recorded cycles, newest first */
+  std::unique_ptr<Spine::Table> table() const;
+
+ private:
+  struct Totals
+  {
+    std::uint64_t added = 0;
+    std::uint64_t removed = 0;
+    std::uint64_t writeLockTime = 0;  // Nanoseconds
+  };
+
+  struct Cycle
+  {
+    unsigned int sequence = 0;
+    std::chrono::system_clock::time_point start;
+    std::size_t probes = 0;
+    std::size_t sendErrors = 0;
+    std::size_t catalogsCut = 0;  // Known catalogs which did not fit in the probe
+    std::size_t datagrams = 0;
+    std::size_t bytes = 0;
+    std::size_t maxBytes = 0;
+    std::size_t truncated = 0;
+    std::size_t parseFailures = 0;
+    std::size_t replies = 0;
+    std::size_t late = 0;
+    std::map<std::string, std::size_t> listeners;  // Replies by listener address
+    std::vector<double> roundTrips;
+    std::string slowest;          // Backend with the longest round trip
+    double slowestRoundTrip = 0;  // Its round trip time in milliseconds
+    Totals first;                 // Counters at the start of the cycle
+    Totals last;                  // Counters at the latest update
+    Services::MemoryUsage memory;
+    bool finished = false;
+  };
+
+  static Totals totals(Services& theServices);
+
+  mutable std::mutex itsMutex;
+  std::size_t itsHistory = 0;
+  std::deque<Cycle> itsCycles;  // Oldest first, the back is the current cycle
+};
+
+}  // namespace SmartMet
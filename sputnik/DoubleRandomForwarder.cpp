@@ -7,13 +7,13 @@ DoubleRandomForwarder::~DoubleRandomForwarder() = default;
 
 DoubleRandomForwarder::DoubleRandomForwarder() : BackendForwarder(0.0) {}
 
-std::size_t DoubleRandomForwarder::getBackend(Spine::Reactor& theReactor,
+std::size_t DoubleRandomForwarder::getBackend(ReactorAccess& theReactor,
                                               const Spine::HTTP::Request& /* theRequest */)
 {
   try
   {
-    auto connections = theReactor.getBackendRequestStatus();
-    SmartMet::Spine::WriteLock lock(itsMutex);
+    auto connections = connectionCounts(theReactor);
+    auto lock = this->lock();
     if (itsBackendInfos.empty())
       throw Fmi::Exception(BCP, "No backends available!");
 
@@ -30,7 +30,53 @@ std::size_t DoubleRandomForwarder::getBackend(Spine::Reactor& theReactor,
     auto count1 = connections[info1.hostName][info1.port];
     auto count2 = connections[info2.hostName][info2.port];
 
-    return (count1 <= count2 ? num1 : num2);
+    if (!itsWeighted)
+      return (count1 <= count2 ? num1 : num2);
+
+    // Suspected backends look busier than they are
+    return ((count1 + 1) / info1.weight <= (count2 + 1) / info2.weight ? num1 : num2);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void DoubleRandomForwarder::explainChoice(Connections& theConnections,
+                                          const Spine::HTTP::Request& /* theRequest */,
+                                          Explanation& theExplanation) const
+{
+  try
+  {
+    auto generator = itsGenerator;
+    auto maxnum = static_cast<int>(itsBackendInfos.size() - 1);
+    boost::random::uniform_int_distribution<> dist{0, maxnum};
+    auto num1 = boost::numeric_cast<std::size_t>(dist(generator));
+    auto num2 = boost::numeric_cast<std::size_t>(dist(generator));
+
+    // The score is the connection count compared by getBackend
+    for (auto num : {num1, num2})
+    {
+      const auto& info = itsBackendInfos[num];
+      const auto count = theConnections[info.hostName][info.port];
+      auto& candidate = theExplanation.candidates[num];
+      candidate.note = "sampled";
+      candidate.score =
+          (itsWeighted ? std::to_string((count + 1) / info.weight) : std::to_string(count));
+    }
+
+    const auto& info1 = itsBackendInfos[num1];
+    const auto& info2 = itsBackendInfos[num2];
+    auto count1 = theConnections[info1.hostName][info1.port];
+    auto count2 = theConnections[info2.hostName][info2.port];
+
+    if (!itsWeighted)
+      theExplanation.chosen = (count1 <= count2 ? num1 : num2);
+    else
+      theExplanation.chosen =
+          ((count1 + 1) / info1.weight <= (count2 + 1) / info2.weight ? num1 : num2);
+
+    theExplanation.method = "fewer connections of two random backends";
   }
   catch (...)
   {
@@ -25,8 +25,13 @@ class DoubleRandomForwarder : public BackendForwarder
   DoubleRandomForwarder(DoubleRandomForwarder&& other) = delete;
   DoubleRandomForwarder& operator=(DoubleRandomForwarder&& other) = delete;
 
-  std::size_t getBackend(Spine::Reactor& theReactor,
+  std::size_t getBackend(ReactorAccess& theReactor,
                          const Spine::HTTP::Request& theRequest) override;
+
+ private:
+  void explainChoice(Connections& theConnections,
+                     const Spine::HTTP::Request& theRequest,
+                     Explanation& theExplanation) const override;
 };
 
 using BackendForwarderPtr = std::shared_ptr<BackendForwarder>;
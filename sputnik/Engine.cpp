@@ -1,15 +1,25 @@
 #include "Engine.h"
 #include "BroadcastMessage.pb.h"
+#include "Probes.h"
 #include "Services.h"
 #include <boost/filesystem/operations.hpp>
 #include <boost/thread.hpp>
+#include <google/protobuf/arena.h>
 #include <macgyver/DateTime.h>
 #include <macgyver/Exception.h>
 #include <macgyver/ThreadName.h>
 #include <spine/Convenience.h>
 #include <spine/Reactor.h>
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
 #include <iostream>
 #include <memory>
+#include <random>
+#include <sstream>
+#include <net/if.h>
+#include <sys/socket.h>
 
 namespace SmartMet
 {
@@ -17,11 +27,58 @@ namespace Engine
 {
 namespace Sputnik
 {
+namespace
+{
+// Parse an endpoint in ipv4Address:udpPort or [ipv6Address]:udpPort format
+std::optional<boost::asio::ip::udp::endpoint> parseEndpoint(const std::string& theEndpoint)
+{
+  auto idx = theEndpoint.rfind(':');
+  if (idx == std::string::npos || idx == 0)
+    return {};
+
+  std::string address = theEndpoint.substr(0, idx);
+  if (address.front() == '[' && address.back() == ']')
+    address = address.substr(1, address.size() - 2);
+
+  boost::system::error_code err;
+  boost::asio::ip::udp::endpoint endpoint;
+  endpoint.address(boost::asio::ip::make_address(address, err));
+  if (err)
+    return {};
+  endpoint.port(Fmi::stoi(theEndpoint.substr(idx + 1)));
+  return endpoint;
+}
+
+// Number of datagrams received with a single recvmmsg call
+constexpr std::size_t kReceiveBatch = 64;
+
+// Maximum number of recvmmsg calls per wakeup, so that timers are not starved
+constexpr std::size_t kMaxReceiveBatches = 16;
+
+// Size of the preallocated arena block, enough for a full batch of typical replies
+constexpr std::size_t kArenaBlockSize = 512 * 1024;
+
+// Convert an IPv4 endpoint to a v4-mapped one for sending from a dual-stack IPv6 socket
+boost::asio::ip::udp::endpoint mapEndpoint(const boost::asio::ip::udp::endpoint& theEndpoint,
+                                           const boost::asio::ip::udp::socket& theSocket)
+{
+  if (theEndpoint.address().is_v6() || theSocket.local_endpoint().address().is_v4())
+    return theEndpoint;
+  return {boost::asio::ip::make_address_v6(boost::asio::ip::v4_mapped,
+                                           theEndpoint.address().to_v4()),
+          theEndpoint.port()};
+}
+}  // namespace
+
 Engine::Engine(const char* theConfig)
     : itsMode(Unknown),
-      itsSocket(itsIoService, boost::asio::ip::udp::v4()),
+      itsSocket(itsIoService),
       itsReceiveBuffer(),
-      itsResponseDeadlineTimer(itsIoService)
+      itsResponseDeadlineTimer(itsIoService),
+      itsHeartBeatTimer(itsIoService),
+      itsBeaconTimer(itsIoService),
+      itsGossipTimer(itsIoService),
+      itsSuspicionTimer(itsIoService)
 {
   try
   {
@@ -38,6 +95,16 @@ Engine::Engine(const char* theConfig)
 
     conf.get_config_array("backendUdpListeners", itsBackendUdpListeners);
 
+    conf.get_config_array("gossip.peers", itsGossipPeers);
+    const int gossipInterval = conf.get_optional_config_param<int>("gossip.interval", 150);
+    const int gossipExpiry = conf.get_optional_config_param<int>("gossip.expiry", 1000);
+    if (gossipInterval <= 0)
+      throw Fmi::Exception(BCP, "gossip.interval must be positive");
+    if (gossipExpiry <= 0)
+      throw Fmi::Exception(BCP, "gossip.expiry must be positive");
+    itsGossipInterval = gossipInterval;
+    itsGossipExpiry = gossipExpiry;
+
     itsFrontendUdpAddress = conf.get_optional_config_param<std::string>("frontendUdpAddress", "0.0.0.0");
     itsFrontendUdpPort = conf.get_optional_config_param<int>("frontendUdpPort", 0);
 
@@ -46,10 +113,109 @@ Engine::Engine(const char* theConfig)
     itsStickyCookie =
         conf.get_optional_config_param<std::string>("sticky_cookie", "smartmet-session-id");
 
-    itsHeartBeatInterval = conf.get_optional_config_param<int>("heartbeat.interval", 5);
-    itsHeartBeatTimeout = conf.get_optional_config_param<int>("heartbeat.timeout", 2);
+    // The millisecond settings override the older settings in seconds
+    const int interval = conf.get_optional_config_param<int>("heartbeat.interval", 5);
+    const int timeout = conf.get_optional_config_param<int>("heartbeat.timeout", 2);
+    const int intervalMs =
+        conf.get_optional_config_param<int>("heartbeat.interval_ms", 1000 * interval);
+    const int timeoutMs =
+        conf.get_optional_config_param<int>("heartbeat.timeout_ms", 1000 * timeout);
+    if (intervalMs <= 0)
+      throw Fmi::Exception(BCP, "heartbeat.interval must be positive");
+    if (timeoutMs <= 0)
+      throw Fmi::Exception(BCP, "heartbeat.timeout must be positive");
+    itsHeartBeatInterval = intervalMs;
+    itsHeartBeatTimeout = timeoutMs;
+
+    itsAdaptiveHeartBeat = conf.get_optional_config_param<bool>("heartbeat.adaptive", false);
+    const int minIntervalMs = conf.get_optional_config_param<int>(
+        "heartbeat.min_interval_ms", std::min(500, intervalMs));
+    const int maxIntervalMs =
+        conf.get_optional_config_param<int>("heartbeat.max_interval_ms", 3 * intervalMs);
+    const int minTimeoutMs = conf.get_optional_config_param<int>(
+        "heartbeat.min_timeout_ms", std::min(100, timeoutMs));
+    const int marginMs = conf.get_optional_config_param<int>("heartbeat.timeout_margin_ms", 50);
+
+    if (minIntervalMs <= 0)
+      throw Fmi::Exception(BCP, "heartbeat.min_interval_ms must be positive");
+    if (maxIntervalMs <= 0)
+      throw Fmi::Exception(BCP, "heartbeat.max_interval_ms must be positive");
+    if (minIntervalMs > maxIntervalMs)
+      throw Fmi::Exception(BCP, "heartbeat.min_interval_ms exceeds heartbeat.max_interval_ms");
+    if (minTimeoutMs <= 0 || minTimeoutMs > timeoutMs)
+      throw Fmi::Exception(BCP, "heartbeat.min_timeout_ms must be in the range 1...timeout");
+    if (marginMs < 0)
+      throw Fmi::Exception(BCP, "heartbeat.timeout_margin_ms must be nonnegative");
+
+    itsMinHeartBeatInterval = minIntervalMs;
+    itsMaxHeartBeatInterval = maxIntervalMs;
+    itsMinHeartBeatTimeout = minTimeoutMs;
+    itsHeartBeatMargin = marginMs;
+
+    const int startupProbes = conf.get_optional_config_param<int>("startup.probes", 5);
+    const int probeIntervalMs =
+        conf.get_optional_config_param<int>("startup.probe_interval_ms", 100);
+    if (startupProbes < 0)
+      throw Fmi::Exception(BCP, "startup.probes must be nonnegative");
+    if (probeIntervalMs <= 0)
+      throw Fmi::Exception(BCP, "startup.probe_interval_ms must be positive");
+    itsStartupProbes = startupProbes;
+    itsStartupProbeInterval = probeIntervalMs;
+
+    itsSnapshotFile = conf.get_optional_config_param<std::string>("snapshot.file", "");
+    const int snapshotInterval = conf.get_optional_config_param<int>("snapshot.interval", 60);
+    if (snapshotInterval < 0)
+      throw Fmi::Exception(BCP, "snapshot.interval must be nonnegative");
+    itsSnapshotInterval = snapshotInterval;
+
+    itsCurrentInterval = itsHeartBeatInterval;
+    itsCurrentTimeout = itsHeartBeatTimeout;
     itsMaxSkippedCycles = conf.get_optional_config_param<int>("heartbeat.max_skipped_cycles", 2);
 
+    itsPhiThreshold = conf.get_optional_config_param<double>("heartbeat.phi_threshold", 0.0);
+    itsPhiSuspect = conf.get_optional_config_param<double>("heartbeat.phi_suspect", 1.0);
+    const int phiMinStdDev = conf.get_optional_config_param<int>("heartbeat.phi_min_stddev", 500);
+    const int phiAcceptablePause =
+        conf.get_optional_config_param<int>("heartbeat.phi_acceptable_pause", 1000);
+    const int phiCheckInterval =
+        conf.get_optional_config_param<int>("heartbeat.phi_check_interval", 500);
+
+    if (itsPhiThreshold < 0 || itsPhiSuspect < 0)
+      throw Fmi::Exception(BCP, "heartbeat.phi_threshold and heartbeat.phi_suspect must be >= 0");
+    if (phiMinStdDev <= 0)
+      throw Fmi::Exception(BCP, "heartbeat.phi_min_stddev must be positive");
+    if (phiAcceptablePause < 0)
+      throw Fmi::Exception(BCP, "heartbeat.phi_acceptable_pause must be nonnegative");
+    if (phiCheckInterval <= 0)
+      throw Fmi::Exception(BCP, "heartbeat.phi_check_interval must be positive");
+
+    itsPhiMinStdDev = phiMinStdDev;
+    itsPhiAcceptablePause = phiAcceptablePause;
+    itsPhiCheckInterval = phiCheckInterval;
+
+    const auto cycle = std::chrono::milliseconds(itsHeartBeatInterval + itsHeartBeatTimeout);
+    itsServices.setFailureDetection(itsPhiThreshold,
+                                    itsPhiSuspect,
+                                    cycle,
+                                    std::chrono::milliseconds(itsPhiMinStdDev),
+                                    std::chrono::milliseconds(itsPhiAcceptablePause));
+
+    itsServices.getInstrumentation().setEnabled(
+        conf.get_optional_config_param<bool>("instrumentation.latency", false));
+
+    const int traceSize = conf.get_optional_config_param<int>("instrumentation.trace_size", 256);
+    if (traceSize <= 0)
+      throw Fmi::Exception(BCP, "instrumentation.trace_size must be positive");
+    itsServices.getRoutingTrace().configure(
+        conf.get_optional_config_param<double>("instrumentation.trace_sample_rate", 0.0),
+        boost::numeric_cast<std::size_t>(traceSize));
+
+    const int cycleHistory =
+        conf.get_optional_config_param<int>("instrumentation.cycle_history", 60);
+    if (cycleHistory < 0)
+      throw Fmi::Exception(BCP, "instrumentation.cycle_history must be nonnegative");
+    itsCycleStats.configure(boost::numeric_cast<std::size_t>(cycleHistory));
+
     // Backend parameters
 
     itsPaused = conf.get_optional_config_param<bool>("pause", false);
@@ -66,24 +232,94 @@ Engine::Engine(const char* theConfig)
         "comment", "No comments associated with this server");
 
     itsThrottleLimit = conf.get_optional_config_param<int>("throttle", 0);
+    itsMaxDatagramSize = conf.get_optional_config_param<int>("maxDatagramSize", 1400);
+    itsCompression = conf.get_optional_config_param<bool>("compression", true);
+    const int beaconInterval = conf.get_optional_config_param<int>("beacon.interval", 0);
+    const int beaconExpiry = conf.get_optional_config_param<int>("beacon.expiry", 30);
+    if (beaconInterval < 0)
+      throw Fmi::Exception(BCP, "beacon.interval must be nonnegative");
+    if (beaconExpiry <= 0)
+      throw Fmi::Exception(BCP, "beacon.expiry must be positive");
+    itsBeaconInterval = beaconInterval;
+    itsBeaconExpiry = beaconExpiry;
+
+    // Multicast discovery, common to both modes
+
+    itsMulticastGroup = conf.get_optional_config_param<std::string>("multicast.group", "");
+    itsMulticastTtl = conf.get_optional_config_param<int>("multicast.ttl", 1);
+    itsMulticastInterface = conf.get_optional_config_param<std::string>("multicast.interface", "");
+    itsMulticastLoopback = conf.get_optional_config_param<bool>("multicast.loopback", true);
+
+    if (!itsMulticastGroup.empty())
+    {
+      auto group = parseEndpoint(itsMulticastGroup);
+      if (!group || !group->address().is_multicast())
+        throw Fmi::Exception(BCP,
+                             "Invalid multicast.group '" + itsMulticastGroup +
+                                 "', expecting a multicast address:port");
+      itsMulticastEndpoint = *group;
+    }
 
     // Setup the correct values for broadcast
 
-    itsBackendSocket.address(boost::asio::ip::make_address_v4(itsUdpListenerAddress));
+    itsBackendSocket.address(boost::asio::ip::make_address(itsUdpListenerAddress));
     itsBackendSocket.port(itsUdpListenerPort);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Constructor failed!");
+  }
+}
+
+// No-op, since construction is trivial
+void Engine::init() {}
+
+// Open the socket for the address family of the given address
+void Engine::openSocket(const boost::asio::ip::address& theAddress)
+{
+  try
+  {
+    itsSocket.open(theAddress.is_v6() ? boost::asio::ip::udp::v6() : boost::asio::ip::udp::v4());
 
     // Reuse address for easier restart
     boost::asio::ip::udp::socket::reuse_address reuse(true);
     itsSocket.set_option(reuse);
+
+    // An IPv6 socket bound to the unspecified address serves IPv4 peers too
+    if (theAddress.is_v6())
+      itsSocket.set_option(boost::asio::ip::v6_only(false));
   }
   catch (...)
   {
-    throw Fmi::Exception::Trace(BCP, "Constructor failed!");
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
   }
 }
 
-// No-op, since construction is trivial
-void Engine::init() {}
+// Outgoing interface for multicast: an IPv4 address or an IPv6 interface name or index
+void Engine::setMulticastInterface()
+{
+  try
+  {
+    if (itsMulticastInterface.empty())
+      return;
+
+    if (itsMulticastEndpoint.address().is_v4())
+    {
+      itsSocket.set_option(boost::asio::ip::multicast::outbound_interface(
+          boost::asio::ip::make_address_v4(itsMulticastInterface)));
+      return;
+    }
+
+    unsigned int index = ::if_nametoindex(itsMulticastInterface.c_str());
+    if (index == 0)
+      index = Fmi::stoi(itsMulticastInterface);
+    itsSocket.set_option(boost::asio::ip::multicast::outbound_interface(index));
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Invalid multicast.interface '" + itsMulticastInterface + "'");
+  }
+}
 // ----------------------------------------------------------------------
 /*!
  * \brief Shutdown the engine
@@ -114,9 +350,23 @@ void Engine::backendMode()
 {
   try
   {
+    setReady();
+
+    // A multicast backend listens to the group port on all addresses, unicast
+    // requests to the same port are still received
+    auto endpoint = itsBackendSocket;
+    if (!itsMulticastGroup.empty())
+    {
+      if (itsMulticastEndpoint.address().is_v4())
+        endpoint = {boost::asio::ip::udp::v4(), itsMulticastEndpoint.port()};
+      else
+        endpoint = {boost::asio::ip::udp::v6(), itsMulticastEndpoint.port()};
+    }
+
     try
     {
-      itsSocket.bind(itsBackendSocket);
+      openSocket(endpoint.address());
+      itsSocket.bind(endpoint);
     }
     catch (const boost::system::system_error& err)
     {
@@ -124,8 +374,30 @@ void Engine::backendMode()
           BCP, "Error: Broadcast Backend can't bind datagram socket: " + std::string(err.what()));
     }
 
+    if (!itsMulticastGroup.empty())
+    {
+      const auto group = itsMulticastEndpoint.address();
+      if (group.is_v4() && !itsMulticastInterface.empty())
+        itsSocket.set_option(boost::asio::ip::multicast::join_group(
+            group.to_v4(), boost::asio::ip::make_address_v4(itsMulticastInterface)));
+      else if (group.is_v6() && !itsMulticastInterface.empty())
+      {
+        unsigned int index = ::if_nametoindex(itsMulticastInterface.c_str());
+        if (index == 0)
+          index = Fmi::stoi(itsMulticastInterface);
+        itsSocket.set_option(boost::asio::ip::multicast::join_group(group.to_v6(), index));
+      }
+      else
+        itsSocket.set_option(boost::asio::ip::multicast::join_group(group));
+
+      std::cout << "Backend joined multicast group " << itsMulticastGroup << '\n';
+    }
+
     // Start the async loop for incoming UDP/IP requests
     startListening();
+
+    if (itsBeaconInterval > 0)
+      startBeacons();
   }
   catch (...)
   {
@@ -147,20 +419,24 @@ void Engine::frontendMode()
 
     boost::system::error_code e;
 
+    const auto frontend_address = boost::asio::ip::make_address(itsFrontendUdpAddress);
+    openSocket(frontend_address);
+
     // Set is as broadcast
-    itsSocket.set_option(boost::asio::socket_base::broadcast(true), e);
-    if (e.value() != boost::system::errc::success)
+    if (frontend_address.is_v4())
     {
-      // Log error and exit
-      throw Fmi::Exception(
-          BCP,
-          "Error: Broadcast Frontend was unable to set UDP/IP broadcast option: " + e.message());
+      itsSocket.set_option(boost::asio::socket_base::broadcast(true), e);
+      if (e.value() != boost::system::errc::success)
+      {
+        // Log error and exit
+        throw Fmi::Exception(
+            BCP,
+            "Error: Broadcast Frontend was unable to set UDP/IP broadcast option: " + e.message());
+      }
     }
 
     // Bind the socket to configured frontend address and port
-    boost::asio::ip::udp::endpoint frontend_endpoint(
-        boost::asio::ip::make_address_v4(itsFrontendUdpAddress),
-        itsFrontendUdpPort);
+    boost::asio::ip::udp::endpoint frontend_endpoint(frontend_address, itsFrontendUdpPort);
     itsSocket.bind(frontend_endpoint, e);
     if (e.value() != boost::system::errc::success)
     {
@@ -171,6 +447,68 @@ void Engine::frontendMode()
     std::cout << "Frontend bound to UDP address: " << itsFrontendUdpAddress << ":" 
               << (itsFrontendUdpPort == 0 ? itsSocket.local_endpoint().port() : itsFrontendUdpPort) << '\n';
 
+    // A single multicast datagram reaches all backends in the group
+    if (!itsMulticastGroup.empty())
+    {
+      const auto ttl = boost::numeric_cast<int>(itsMulticastTtl);
+      itsSocket.set_option(boost::asio::ip::multicast::hops(ttl));
+      itsSocket.set_option(boost::asio::ip::multicast::enable_loopback(itsMulticastLoopback));
+      setMulticastInterface();
+      itsDiscoveryEndpoints.push_back(mapEndpoint(itsMulticastEndpoint, itsSocket));
+      std::cout << "Frontend probes multicast group " << itsMulticastGroup << " with ttl "
+                << itsMulticastTtl << '\n';
+    }
+
+    for (const auto& listener : itsBackendUdpListeners)
+    {
+      auto endpoint = parseEndpoint(listener);
+      if (!endpoint)
+        throw Fmi::Exception(BCP,
+                             "Invalid backend UDP listener '" + listener +
+                                 "', expecting address:port");
+      itsDiscoveryEndpoints.push_back(mapEndpoint(*endpoint, itsSocket));
+    }
+
+    // Buffers for draining bursts of replies without allocations
+    itsReceiveRing.resize(kReceiveBatch);
+    itsArenaBlock.resize(kArenaBlockSize);
+    google::protobuf::ArenaOptions options;
+    options.initial_block = itsArenaBlock.data();
+    options.initial_block_size = itsArenaBlock.size();
+    itsArena = std::make_unique<google::protobuf::Arena>(options);
+
+    // The socket listens continuously, replies are not bound to the reply window
+    startFrontendListening();
+
+    // Share connection counts with the other frontends
+    for (const auto& peer : itsGossipPeers)
+    {
+      auto endpoint = parseEndpoint(peer);
+      if (!endpoint)
+        throw Fmi::Exception(BCP, "Invalid gossip peer '" + peer + "', expecting address:port");
+      itsGossipEndpoints.push_back(mapEndpoint(*endpoint, itsSocket));
+    }
+
+    if (!itsGossipEndpoints.empty())
+    {
+      std::random_device device;
+      itsFrontendId = (static_cast<std::uint64_t>(device()) << 32) ^ device();
+      std::cout << "Gossiping connection counts with " << itsGossipEndpoints.size()
+                << " frontends\n";
+      startGossip();
+    }
+
+    // Silent backends are judged by the failure detector instead of a single missed cycle
+    if (itsPhiThreshold > 0)
+      startSuspicionCheck();
+
+    // Route with the previous routing table until the backends have replied
+    if (!itsSnapshotFile.empty())
+      loadSnapshot();
+
+    // Probe quickly until the responses settle, lost replies are covered by the repeats
+    itsProbesLeft = itsStartupProbes;
+
     startServiceDiscovery();
   }
   catch (...)
@@ -189,13 +527,14 @@ void Engine::handleDeadlineTimer(const boost::system::error_code& err)
       return;
     }
 
-    // Cancel all and any pending async operations
-    itsSocket.cancel();
+    itsReplyWindowOpen = false;
 
-    // Clean the service list of old entires only if we have received at least one response
+    // Apply the replies of the cycle to the routing table. Clean the service list of
+    // old entires only if we have received at least one response
+    const auto sequence = boost::numeric_cast<int>(itsFrontendSequence);
     if (itsReceivedResponses > 0)
     {
-      itsServices.latestSequence(boost::numeric_cast<int>(itsFrontendSequence));
+      itsServices.commit(sequence, true);
       // Reset the skipped cycle counter, skipped cycles must be sequential
       itsSkippedCycles = 0;
     }
@@ -208,23 +547,90 @@ void Engine::handleDeadlineTimer(const boost::system::error_code& err)
       if (itsSkippedCycles > itsMaxSkippedCycles)
       {
         // Maximum skipped cycles exceeded, clean the service map
-        itsServices.latestSequence(boost::numeric_cast<int>(itsFrontendSequence));
+        itsServices.commit(sequence, true);
 
         // Reset the skipped cycle counter
         itsSkippedCycles = 0;
       }
+      else
+        itsServices.commit(sequence, false);
     }
 
-    // Reset the response counter
-    itsReceivedResponses = 0;
+    itsCycleStats.finish(itsServices);
 
-    // Sleep until the next heart beat
-    boost::this_thread::sleep_for(boost::chrono::seconds(itsHeartBeatInterval));
+    // The first reply window has ended, the routing table is as complete as it gets
+    if (!itsReady)
+    {
+      std::cout << Spine::log_time_str() << " Sputnik frontend ready, " << itsRespondents.size()
+                << " backends responded\n";
+      setReady();
+    }
 
     if (Spine::Reactor::isShuttingDown())
       return;
 
-    startServiceDiscovery();
+    if (itsAdaptiveHeartBeat)
+      adaptHeartBeat();
+
+    if (!itsSnapshotFile.empty())
+      writeSnapshot();
+
+    // Wait until the next heart beat without blocking the IO thread. Late replies
+    // to the current sequence are still accepted meanwhile.
+    itsHeartBeatTimer.expires_after(std::chrono::milliseconds(itsCurrentInterval));
+    itsHeartBeatTimer.async_wait(
+        [this](const boost::system::error_code& e)
+        {
+          if (e != boost::asio::error::operation_aborted && !Spine::Reactor::isShuttingDown())
+            this->startServiceDiscovery();
+        });
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void Engine::adaptHeartBeat()
+{
+  try
+  {
+    // Too few samples would make the p99 estimate meaningless
+    constexpr std::size_t min_samples = 20;
+
+    // A cluster which stays silent has not changed, an isolated frontend must back off
+    // instead of probing at the fastest rate
+    const bool changed = (itsRespondents != itsPreviousRespondents);
+    itsPreviousRespondents = itsRespondents;
+
+    const bool suspect = (itsPhiThreshold > 0 && itsServices.maxSuspicion() > itsPhiSuspect);
+
+    if (changed || suspect)
+      itsCurrentInterval = itsMinHeartBeatInterval;
+    else
+      itsCurrentInterval = std::min(itsCurrentInterval + itsCurrentInterval / 2 + 1,
+                                    itsMaxHeartBeatInterval);
+
+    // The failure detectors expect replies once per cycle: the window which just
+    // ended plus the interval until the next request
+    itsServices.setHeartbeatInterval(
+        std::chrono::milliseconds(itsCurrentTimeout + itsCurrentInterval));
+
+    // Forget backends which have been silent for several cycles
+    const auto silence = 10 * (itsMaxHeartBeatInterval + itsHeartBeatTimeout);
+    itsRoundTrips.expire(std::chrono::steady_clock::now() - std::chrono::milliseconds(silence));
+
+    if (itsRoundTrips.size() >= min_samples)
+    {
+      const auto window =
+          static_cast<unsigned int>(std::ceil(itsRoundTrips.percentile(0.99))) + itsHeartBeatMargin;
+      itsCurrentTimeout = std::clamp(window, itsMinHeartBeatTimeout, itsHeartBeatTimeout);
+    }
+
+#ifdef MYDEBUG
+    std::cout << Spine::log_time_str() << " Discovery interval " << itsCurrentInterval
+              << " ms, reply window " << itsCurrentTimeout << " ms\n";
+#endif
   }
   catch (...)
   {
@@ -232,38 +638,191 @@ void Engine::handleDeadlineTimer(const boost::system::error_code& err)
   }
 }
 
-void Engine::handleFrontendRead(const boost::system::error_code& e, std::size_t bytes_transferred)
+void Engine::handleFrontendRead(const boost::system::error_code& e)
 {
   try
   {
     if (e == boost::asio::error::operation_aborted)
     {
-      // The operation was aborted by the deadline timer;
+      // The socket was closed during shutdown
       return;
     }
 
     if (!e)
     {
+      std::array<mmsghdr, kReceiveBatch> headers;
+      std::array<iovec, kReceiveBatch> vectors;
+      std::array<sockaddr_storage, kReceiveBatch> senders;
+
+      for (std::size_t batch = 0; batch < kMaxReceiveBatches; ++batch)
+      {
+        for (std::size_t i = 0; i < kReceiveBatch; i++)
+        {
+          vectors[i].iov_base = itsReceiveRing[i].data();
+          vectors[i].iov_len = itsReceiveRing[i].size();
+          std::memset(&headers[i], 0, sizeof(mmsghdr));
+          headers[i].msg_hdr.msg_name = &senders[i];
+          headers[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+          headers[i].msg_hdr.msg_iov = &vectors[i];
+          headers[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        const int count = ::recvmmsg(
+            itsSocket.native_handle(), headers.data(), kReceiveBatch, MSG_DONTWAIT, nullptr);
+        if (count <= 0)
+          break;  // drained, or an error which the next wakeup will report again
+
+        for (int i = 0; i < count; i++)
+        {
+          // The handlers identify the sender via the remote endpoint
+          std::memcpy(itsRemoteEnd.data(), &senders[i], headers[i].msg_hdr.msg_namelen);
+          itsRemoteEnd.resize(headers[i].msg_hdr.msg_namelen);
+
 #ifdef MYDEBUG
-      std::cout << "Broadcast received data from " << itsRemoteEnd.address().to_string() << ":"
-                << itsRemoteEnd.port() << '\n';
+          std::cout << "Broadcast received data from " << itsRemoteEnd.address().to_string()
+                    << ":" << itsRemoteEnd.port() << '\n';
 #endif
 
-      // Construct a std::string from the buffer contents
-      std::string receiveBuffer(itsReceiveBuffer.begin(), bytes_transferred);
-      SmartMet::BroadcastMessage message;
-      message.ParseFromString(receiveBuffer);
+          SPUTNIK_PROBE2(reply_received, headers[i].msg_len, itsRemoteEnd.port());
+
+          // Truncated datagrams cannot be parsed
+          if ((headers[i].msg_hdr.msg_flags & MSG_TRUNC) != 0)
+          {
+            itsCycleStats.datagram(headers[i].msg_len, true, false);
+            continue;
+          }
+
+          using SmartMet::BroadcastMessage;
+          auto* message = google::protobuf::Arena::Create<BroadcastMessage>(itsArena.get());
+          const auto size = static_cast<int>(headers[i].msg_len);
+          const bool parsed = message->ParseFromArray(itsReceiveRing[i].data(), size);
+          itsCycleStats.datagram(headers[i].msg_len, false, parsed);
+          if (parsed)
+            dispatchFrontendMessage(*message);
+        }
 
-      // Call the Reply processing function
-      processReply(message);
+        // The handlers copy whatever they keep, the decoded batch can be released
+        itsArena->Reset();
+
+        if (static_cast<std::size_t>(count) < kReceiveBatch)
+          break;
+      }
     }
 
     // Start a new receive event
-    itsSocket.async_receive_from(
-        boost::asio::buffer(itsReceiveBuffer),
-        itsRemoteEnd,
-        [this](const boost::system::error_code& err, std::size_t bytes_transferred)
-        { this->handleFrontendRead(err, bytes_transferred); });
+    startFrontendListening();
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void Engine::dispatchFrontendMessage(SmartMet::BroadcastMessage& theMessage)
+{
+  try
+  {
+    if (theMessage.has_fragment())
+      processFragment(theMessage);
+    else if (theMessage.messagetype() == SmartMet::BroadcastMessage::SERVICE_DISCOVERY_BEACON)
+      processBeacon(theMessage);
+    else if (theMessage.messagetype() == SmartMet::BroadcastMessage::FRONTEND_GOSSIP)
+      processGossip(theMessage);
+    else
+      processReply(theMessage);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void Engine::startGossip()
+{
+  try
+  {
+    itsGossipTimer.expires_after(std::chrono::milliseconds(itsGossipInterval));
+    itsGossipTimer.async_wait([this](const boost::system::error_code& err)
+                              { this->handleGossipTimer(err); });
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void Engine::handleGossipTimer(const boost::system::error_code& err)
+{
+  try
+  {
+    if (err == boost::asio::error::operation_aborted || Spine::Reactor::isShuttingDown())
+      return;
+
+    // Peers which have gone quiet must not distort the balancing
+    itsServices.getPeerConnections().expire(std::chrono::milliseconds(itsGossipExpiry));
+
+    std::string gossip;
+    sendConnectionGossip(gossip);
+
+    for (const auto& peer : itsGossipEndpoints)
+    {
+      boost::system::error_code e;
+      itsSocket.send_to(boost::asio::buffer(gossip), peer, 0, e);
+#ifdef MYDEBUG
+      if (e)
+        std::cerr << "Error: Broadcast failed to send gossip: " << e.message() << '\n';
+#endif
+    }
+
+    startGossip();
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void Engine::startSuspicionCheck()
+{
+  try
+  {
+    itsSuspicionTimer.expires_after(std::chrono::milliseconds(itsPhiCheckInterval));
+    itsSuspicionTimer.async_wait([this](const boost::system::error_code& err)
+                                 { this->handleSuspicionTimer(err); });
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void Engine::handleSuspicionTimer(const boost::system::error_code& err)
+{
+  try
+  {
+    if (err == boost::asio::error::operation_aborted || Spine::Reactor::isShuttingDown())
+      return;
+
+    itsServices.updateSuspicion();
+
+    startSuspicionCheck();
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void Engine::startFrontendListening()
+{
+  try
+  {
+    if (Spine::Reactor::isShuttingDown())
+      return;
+
+    itsSocket.async_wait(boost::asio::ip::udp::socket::wait_read,
+                         [this](const boost::system::error_code& err)
+                         { this->handleFrontendRead(err); });
   }
   catch (...)
   {
@@ -277,44 +836,118 @@ void Engine::startServiceDiscovery()
   {
     itsFrontendSequence = (itsFrontendSequence + 1) % 65535;
 
-    std::string theRequestBuffer;
-    sendDiscoveryRequest(theRequestBuffer, boost::numeric_cast<int>(itsFrontendSequence));
+    // Reset the response counter
+    itsReceivedResponses = 0;
+    itsRespondents.clear();
+    itsSequenceStart = std::chrono::steady_clock::now();
+    itsReplyWindowOpen = true;
 
-    // Send the discovery requests
-    try
+    sendDiscoveryRequests();
+
+    if (itsProbesLeft > 1)
     {
-      for (const auto& st : itsBackendUdpListeners)
-      {
-        auto idx = st.find(':');
-        if (idx != std::string::npos)
-        {
-          std::string addr = st.substr(0, idx);
-          std::string port = st.substr(idx + 1);
+      --itsProbesLeft;
+      itsPreviousRespondentCount = 0;
+      itsResponseDeadlineTimer.expires_after(std::chrono::milliseconds(itsStartupProbeInterval));
+      itsResponseDeadlineTimer.async_wait([this](const boost::system::error_code& err)
+                                          { this->handleStartupTimer(err); });
+      return;
+    }
+    itsProbesLeft = 0;
+
+    // Reset the response deadline timer
+    itsResponseDeadlineTimer.expires_after(std::chrono::milliseconds(itsCurrentTimeout));
+    itsResponseDeadlineTimer.async_wait([this](const boost::system::error_code& err)
+                                        { this->handleDeadlineTimer(err); });
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
 
-          // std::cout << addr << ":" << port << "\n";
+void Engine::handleStartupTimer(const boost::system::error_code& err)
+{
+  try
+  {
+    if (err == boost::asio::error::operation_aborted || Spine::Reactor::isShuttingDown())
+      return;
 
-          boost::asio::ip::udp::endpoint dest;
-          dest.address(boost::asio::ip::make_address_v4(addr));
-          dest.port(Fmi::stoi(port));
-          itsSocket.send_to(boost::asio::buffer(theRequestBuffer), dest);
-        }
-      }
+    // The set of respondents only grows during a sequence, an unchanged size means
+    // an unchanged set
+    const bool settled =
+        (!itsRespondents.empty() && itsRespondents.size() == itsPreviousRespondentCount);
+    itsPreviousRespondentCount = itsRespondents.size();
+
+    if (settled || itsProbesLeft == 0)
+    {
+      itsProbesLeft = 0;
+      handleDeadlineTimer(err);
+      return;
     }
-    catch (const boost::system::system_error& err)
+
+    // Route with the replies received so far while the burst continues
+    itsServices.commit(boost::numeric_cast<int>(itsFrontendSequence), false);
+
+    // Repeat the request of the same sequence. Backends which have already replied
+    // are ignored as duplicates.
+    --itsProbesLeft;
+    sendDiscoveryRequests();
+
+    itsResponseDeadlineTimer.expires_after(std::chrono::milliseconds(itsStartupProbeInterval));
+    itsResponseDeadlineTimer.async_wait([this](const boost::system::error_code& e)
+                                        { this->handleStartupTimer(e); });
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void Engine::sendDiscoveryRequests()
+{
+  try
+  {
+    std::string theRequestBuffer;
+    const auto catalogsCut =
+        sendDiscoveryRequest(theRequestBuffer, boost::numeric_cast<int>(itsFrontendSequence));
+    SPUTNIK_PROBE3(discovery_send,
+                   itsFrontendSequence,
+                   itsDiscoveryEndpoints.size(),
+                   theRequestBuffer.size());
+
+    // Send the discovery requests with a single system call
+    iovec vector{const_cast<char*>(theRequestBuffer.data()), theRequestBuffer.size()};
+    std::vector<mmsghdr> headers(itsDiscoveryEndpoints.size());
+    for (std::size_t i = 0; i < headers.size(); i++)
     {
-      std::cerr << "Error: Broadcast failed to send discovery request: " << err.what() << '\n';
+      auto& header = headers[i].msg_hdr;
+      header.msg_name = itsDiscoveryEndpoints[i].data();
+      header.msg_namelen = static_cast<socklen_t>(itsDiscoveryEndpoints[i].size());
+      header.msg_iov = &vector;
+      header.msg_iovlen = 1;
     }
 
-    itsSocket.async_receive_from(
-        boost::asio::buffer(itsReceiveBuffer),
-        itsRemoteEnd,
-        [this](const boost::system::error_code& err, std::size_t bytes_transferred)
-        { this->handleFrontendRead(err, bytes_transferred); });
+    // sendmmsg stops at the first failure. An unreachable listener must not stop the others.
+    std::size_t sent = 0;
+    std::size_t errors = 0;
+    while (sent < headers.size())
+    {
+      const int count = ::sendmmsg(
+          itsSocket.native_handle(), headers.data() + sent, headers.size() - sent, 0);
+      if (count > 0)
+        sent += static_cast<std::size_t>(count);
+      else if (errno != EINTR)
+      {
+        std::cerr << "Error: Broadcast failed to send discovery request to "
+                  << itsDiscoveryEndpoints[sent] << ": " << std::strerror(errno) << '\n';
+        ++sent;
+        ++errors;
+      }
+    }
 
-    // Reset the response deadline timer
-    itsResponseDeadlineTimer.expires_after(std::chrono::seconds(itsHeartBeatTimeout));
-    itsResponseDeadlineTimer.async_wait([this](const boost::system::error_code& err)
-                                        { this->handleDeadlineTimer(err); });
+    itsCycleStats.begin(
+        itsFrontendSequence, headers.size() - errors, errors, catalogsCut, itsServices);
   }
   catch (...)
   {
@@ -338,6 +971,61 @@ void Engine::startListening()
   }
 }
 
+void Engine::startBeacons()
+{
+  try
+  {
+    itsBeaconTimer.expires_after(std::chrono::milliseconds(itsBeaconInterval));
+    itsBeaconTimer.async_wait([this](const boost::system::error_code& err)
+                              { this->handleBeaconTimer(err); });
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void Engine::handleBeaconTimer(const boost::system::error_code& err)
+{
+  try
+  {
+    if (err == boost::asio::error::operation_aborted || Spine::Reactor::isShuttingDown())
+      return;
+
+    // Forget frontends which have not probed us for a while
+
+    const auto now = std::chrono::steady_clock::now();
+    for (auto it = itsBeaconTargets.begin(); it != itsBeaconTargets.end();)
+    {
+      if (now - it->second > std::chrono::seconds(itsBeaconExpiry))
+        it = itsBeaconTargets.erase(it);
+      else
+        ++it;
+    }
+
+    // Paused and overloaded backends stay quiet just like with discovery requests
+    if (!itsBeaconTargets.empty() && !isPaused() && !itsReactor->isLoadHigh())
+    {
+      std::string beacon;
+      sendDiscoveryBeacon(beacon);
+
+      for (const auto& target : itsBeaconTargets)
+      {
+        boost::system::error_code e;
+        itsSocket.send_to(boost::asio::buffer(beacon), target.first, 0, e);
+        if (e)
+          std::cerr << "Error: Broadcast failed to send beacon: " << e.message() << '\n';
+      }
+    }
+
+    startBeacons();
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
 void Engine::handleBackendRead(const boost::system::error_code& e, std::size_t bytes_transferred)
 {
   try
@@ -366,30 +1054,25 @@ void Engine::handleBackendRead(const boost::system::error_code& e, std::size_t b
                 << itsRemoteEnd.port() << '\n';
 #endif
 
-      // Construct a std::string from the buffer contents
-      std::string receiveBuffer(itsReceiveBuffer.begin(), bytes_transferred);
-      std::string responseBuffer;
+      std::vector<std::string> responses;
       SmartMet::BroadcastMessage message;
-      message.ParseFromString(receiveBuffer);
+      message.ParseFromArray(itsReceiveBuffer.data(), static_cast<int>(bytes_transferred));
 
       if (Spine::Reactor::isShuttingDown())
         return;
 
       // Call the Reply processing function
-      processRequest(message, responseBuffer);
+      processRequest(message, responses);
 
-      // Send response back to sender if responseBuffer is not empty
-      if (!responseBuffer.empty())
+      // Send response back to sender
+      try
       {
-        // Send response back to sender
-        try
-        {
-          itsSocket.send_to(boost::asio::buffer(responseBuffer), itsRemoteEnd);
-        }
-        catch (const boost::system::system_error& err)
-        {
-          std::cerr << "Error: Broadcast failed to send response: " << err.what() << '\n';
-        }
+        for (const auto& response : responses)
+          itsSocket.send_to(boost::asio::buffer(response), itsRemoteEnd);
+      }
+      catch (const boost::system::system_error& err)
+      {
+        std::cerr << "Error: Broadcast failed to send response: " << err.what() << '\n';
       }
     }
 
@@ -409,9 +1092,9 @@ void Engine::launch(BroadcastMode theMode, SmartMet::Spine::Reactor* theReactor)
   try
   {
     // Save reactor instance permanently for callbacks
-    itsReactor = theReactor;
+    itsReactor = std::make_unique<SpineReactorAccess>(*theReactor);
 
-    itsServices.setReactor(*theReactor);
+    itsServices.setReactor(*itsReactor);
 
     // Save working mode and callback function permanently
     itsMode = theMode;
@@ -426,7 +1109,7 @@ void Engine::launch(BroadcastMode theMode, SmartMet::Spine::Reactor* theReactor)
       case Frontend:
         frontendMode();
         // Add hook for response based backend hearbeat
-        if (!theReactor->addBackendConnectionFinishedHook(
+        if (!itsReactor->addBackendConnectionFinishedHook(
                 "sputnik_backend_hearbeat_hook",
                 [this](const std::string& theHostName,
                        int thePort,
@@ -575,6 +1258,100 @@ std::unique_ptr<SmartMet::Spine::Table> Engine::backends(const std::string& serv
   }
 }
 
+// ----------------------------------------------------------------------
+/*!
+ * \brief Latency statistics of the routing hot paths
+ */
+// ----------------------------------------------------------------------
+
+std::unique_ptr<SmartMet::Spine::Table> Engine::latencies() const
+{
+  try
+  {
+    return itsServices.latencies();
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Explain how a request would be routed
+ */
+// ----------------------------------------------------------------------
+
+std::unique_ptr<SmartMet::Spine::Table> Engine::explain(
+    const Spine::HTTP::Request& theRequest) const
+{
+  try
+  {
+    return itsServices.explain(theRequest);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Routing counters in OpenMetrics text format
+ */
+// ----------------------------------------------------------------------
+
+std::string Engine::metrics() const
+{
+  try
+  {
+    std::ostringstream out;
+    itsServices.metrics(out);
+    out << "# EOF\n";
+    return out.str();
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief The most recent sampled routing decisions
+ */
+// ----------------------------------------------------------------------
+
+std::unique_ptr<SmartMet::Spine::Table> Engine::routingTrace(std::size_t count) const
+{
+  try
+  {
+    return itsServices.routingTrace(count);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Statistics of the recent discovery cycles
+ */
+// ----------------------------------------------------------------------
+
+std::unique_ptr<SmartMet::Spine::Table> Engine::discoveryStats() const
+{
+  try
+  {
+    return itsCycleStats.table();
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
 // ----------------------------------------------------------------------
 /*!
  * \brief Return backend list for given service or services
@@ -674,6 +1451,32 @@ void Engine::setContinue()
   itsPauseDeadLine = std::nullopt;
 }
 
+// ----------------------------------------------------------------------
+/*!
+ * \brief Mark the initial routing table complete and wake up the waiters
+ */
+// ----------------------------------------------------------------------
+
+void Engine::setReady()
+{
+  {
+    std::lock_guard<std::mutex> lock(itsReadyMutex);
+    itsReady = true;
+  }
+  itsReadyCondition.notify_all();
+}
+
+bool Engine::isReady() const
+{
+  return itsReady;
+}
+
+bool Engine::waitUntilReady(std::chrono::milliseconds theTimeout) const
+{
+  std::unique_lock<std::mutex> lock(itsReadyMutex);
+  return itsReadyCondition.wait_for(lock, theTimeout, [this] { return itsReady.load(); });
+}
+
 // ----------------------------------------------------------------------
 /*!
  * \brief Return true if Sputnik is paused
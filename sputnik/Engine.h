@@ -6,20 +6,42 @@
 
 #pragma once
 
+#include "DiscoveryStats.h"
+#include "FragmentAssembler.h"
+#include "ReactorAccess.h"
+#include "RoundTripTimes.h"
 #include "Services.h"
 #include <boost/asio.hpp>
 #include <boost/function.hpp>
 #include <spine/Reactor.h>
 #include <spine/SmartMetEngine.h>
 #include <spine/Thread.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <string>
+#include <vector>
 
 namespace SmartMet
 {
 class BroadcastMessage;
+}  // namespace SmartMet
+
+namespace google
+{
+namespace protobuf
+{
+class Arena;
+}  // namespace protobuf
+}  // namespace google
+
+namespace SmartMet
+{
 namespace Spine
 {
 class Table;
@@ -64,13 +86,85 @@ class Engine : public SmartMet::Spine::SmartMetEngine
    */
   void frontendMode();
 
-  /** \brief Method to stop listening for backend responses when in service discovery loop.
+  /** \brief Method to end the reply window of the service discovery loop.
    *
-   * This deadline timer implements the frontend listening for backend responses. It is started
-   * when discovery starts and calling this function marks the end of the listening phase.
+   * This deadline timer marks the end of the reply window started when discovery starts.
+   * Stale services are pruned and the next heartbeat is scheduled. The socket keeps
+   * listening, late replies to the current sequence are still accepted.
    */
   void handleDeadlineTimer(const boost::system::error_code& err);
 
+  /** \brief Sends the discovery request of the current sequence to all listeners
+   *
+   */
+  void sendDiscoveryRequests();
+
+  /** \brief Repeats the first discovery request until the responses settle
+   *
+   * Marks the frontend ready and ends the first reply window when the set of
+   * responding backends did not change between two probes, or when the
+   * startup probes have been used up.
+   */
+  void handleStartupTimer(const boost::system::error_code& err);
+
+  /** \brief Marks the engine ready
+   *
+   */
+  void setReady();
+
+  /** \brief Adapts the discovery interval and reply window (frontend behaviour)
+   *
+   * The interval drops to the minimum while the set of responding backends changes
+   * or a backend is suspected, and grows gradually while the cluster is stable.
+   * The reply window follows the p99 round trip time of the replies.
+   */
+  void adaptHeartBeat();
+
+  /** \brief Schedules the next connection count gossip (frontend behaviour)
+   *
+   */
+  void startGossip();
+
+  /** \brief Sends the active connection counts to the other frontends
+   *
+   */
+  void handleGossipTimer(const boost::system::error_code& err);
+
+  /** \brief Schedules the next failure detector check (frontend behaviour)
+   *
+   */
+  void startSuspicionCheck();
+
+  /** \brief Down-weights suspected backends and removes failed ones
+   *
+   */
+  void handleSuspicionTimer(const boost::system::error_code& err);
+
+  /** \brief Opens the socket for the address family (IPv4 or dual-stack IPv6)
+   *
+   */
+  void openSocket(const boost::asio::ip::address& theAddress);
+
+  /** \brief Selects the outgoing multicast interface
+   *
+   */
+  void setMulticastInterface();
+
+  /** \brief Method to start listening for backend responses (frontend behaviour)
+   *
+   */
+  void startFrontendListening();
+
+  /** \brief Schedules the next beacon (backend behaviour)
+   *
+   */
+  void startBeacons();
+
+  /** \brief Sends a beacon to the frontends which have recently probed this backend
+   *
+   */
+  void handleBeaconTimer(const boost::system::error_code& err);
+
   BroadcastMode itsMode;  ///< Mode of this Broadcast engine
 
   unsigned int itsFrontendSequence = 0;  ///< The current frontend sequence.
@@ -79,9 +173,56 @@ class Engine : public SmartMet::Spine::SmartMetEngine
 
   unsigned int itsSkippedCycles = 0;  ///< Number of hearbeat cycles that have gone unanswered
 
+  bool itsReplyWindowOpen = false;  ///< Replies are staged until the response deadline
+
+  /** \brief Latest full discovery reply of a backend
+   *
+   * Backends whose catalog version matches the one echoed by the frontend send
+   * abbreviated replies, the services are then taken from this copy.
+   */
+  struct CatalogCache
+  {
+    std::shared_ptr<BroadcastMessage> reply;          ///< Latest full reply
+    std::chrono::steady_clock::time_point updated;  ///< Time of the latest matching reply
+  };
+
+  std::map<std::string, CatalogCache> itsCatalogs;  ///< Known catalogs by backend ip:port
+  std::size_t itsKnownCatalogOffset = 0;  ///< First catalog echoed when not all of them fit
+
+  /** \brief Routing objects made from the catalog of a backend
+   *
+   * The objects are reused for as long as the backend repeats the same catalog,
+   * only the load, throttle, update times and sequence number change in place.
+   */
+  struct BackendRecord
+  {
+    BackendServerPtr server;
+    std::vector<BackendServicePtr> services;
+    std::vector<BackendInfoRequestPtr> infoRequests;
+    std::chrono::steady_clock::time_point updated;  ///< Time of the latest reply
+
+    bool matches(const BroadcastMessage& theMessage, const BroadcastMessage& theCatalog) const;
+  };
+
+  std::map<std::string, BackendRecord> itsBackendRecords;  ///< Records by backend name:port
+
   std::vector<std::string> itsBackendUdpListeners;  ///< List of backend UDP listeners
                                                     ///(ipAddress1:udpPort1, ipAddress2:udpPort2)
 
+  std::vector<boost::asio::ip::udp::endpoint> itsDiscoveryEndpoints;  ///< Parsed listeners
+
+  std::string itsMulticastGroup;    ///< Multicast group (address:port) for discovery
+  unsigned int itsMulticastTtl = 1;  ///< Multicast hop limit
+  std::string itsMulticastInterface;  ///< IPv4 interface address or IPv6 interface name
+  bool itsMulticastLoopback = true;   ///< Deliver multicast to the local host too
+  boost::asio::ip::udp::endpoint itsMulticastEndpoint;  ///< Parsed multicast group
+
+  std::vector<std::string> itsGossipPeers;  ///< Other frontends (ipAddress:udpPort) for gossip
+  std::vector<boost::asio::ip::udp::endpoint> itsGossipEndpoints;  ///< Parsed gossip peers
+  unsigned int itsGossipInterval = 150;   ///< Gossip interval in milliseconds
+  unsigned int itsGossipExpiry = 1000;    ///< Milliseconds after which peer counts are ignored
+  std::uint64_t itsFrontendId = 0;        ///< Random identifier of this frontend in gossip
+
   std::string itsFrontendUdpAddress = "0.0.0.0";     ///< Frontend UDP bind address
   unsigned short itsFrontendUdpPort = 0;              ///< Frontend UDP bind port (0 = any port)
 
@@ -92,16 +233,59 @@ class Engine : public SmartMet::Spine::SmartMetEngine
   unsigned short itsUdpListenerPort = COMM_UDP_PORT;  ///< Backend UDP listener port
   std::string itsComment;                             ///< Backend comment
   unsigned int itsThrottleLimit = 0;  ///< Max number of unanswered connections allowed
+  unsigned int itsMaxDatagramSize = 1400;  ///< Max reply datagram size, larger ones are split
+  bool itsCompression = true;              ///< Compress replies which do not fit a datagram
+  unsigned int itsFragmentId = 0;          ///< Identifier of the latest fragmented reply
 
-  unsigned int itsHeartBeatInterval = 5;
-  unsigned int itsHeartBeatTimeout = 2;
+  unsigned int itsBeaconInterval = 0;  ///< Beacon interval in milliseconds (0 = disabled)
+  unsigned int itsBeaconExpiry = 30;   ///< Seconds a frontend gets beacons after its last probe
+
+  /// Frontends which have recently probed this backend, with the time of the latest probe
+  std::map<boost::asio::ip::udp::endpoint, std::chrono::steady_clock::time_point>
+      itsBeaconTargets;
+
+  unsigned int itsHeartBeatInterval = 5000;  ///< Discovery interval in milliseconds
+  unsigned int itsHeartBeatTimeout = 2000;   ///< Reply window in milliseconds
   unsigned int itsMaxSkippedCycles = 2;
 
+  bool itsAdaptiveHeartBeat = false;           ///< Adapt the interval and the reply window
+  unsigned int itsMinHeartBeatInterval = 500;  ///< Adaptive interval while the cluster changes
+  unsigned int itsMaxHeartBeatInterval = 15000;  ///< Adaptive interval while the cluster is stable
+  unsigned int itsMinHeartBeatTimeout = 100;     ///< Lower limit for the adaptive reply window
+  unsigned int itsHeartBeatMargin = 50;          ///< Margin added to the p99 round trip time
+  unsigned int itsCurrentInterval = 5000;        ///< Current discovery interval in milliseconds
+  unsigned int itsCurrentTimeout = 2000;         ///< Current reply window in milliseconds
+
+  std::chrono::steady_clock::time_point itsSequenceStart;  ///< Send time of the current sequence
+  std::set<std::string> itsRespondents;          ///< Backends which replied to the current sequence
+  std::set<std::string> itsPreviousRespondents;  ///< Backends which replied to the previous one
+  RoundTripTimes itsRoundTrips;                  ///< Recent discovery round trip times
+  DiscoveryStats itsCycleStats;                  ///< Statistics of the recent discovery cycles
+
+  unsigned int itsStartupProbes = 5;         ///< Number of quick probes during startup
+  unsigned int itsStartupProbeInterval = 100;  ///< Spacing of the startup probes in milliseconds
+  unsigned int itsProbesLeft = 0;            ///< Remaining startup probes
+  std::size_t itsPreviousRespondentCount = 0;  ///< Respondents at the previous startup probe
+
+  std::atomic<bool> itsReady{false};              ///< Initial routing table is complete
+  mutable std::mutex itsReadyMutex;               ///< Guards waiting for readiness
+  mutable std::condition_variable itsReadyCondition;  ///< Signalled when ready
+
+  std::string itsSnapshotFile;            ///< Routing snapshot file ("" = disabled)
+  unsigned int itsSnapshotInterval = 60;  ///< Snapshot interval in seconds
+  std::chrono::steady_clock::time_point itsSnapshotTime;  ///< Time of the latest snapshot
+
+  double itsPhiThreshold = 0;             ///< Phi at which a backend is removed (0 = disabled)
+  double itsPhiSuspect = 1;               ///< Phi at which a backend starts losing weight
+  unsigned int itsPhiMinStdDev = 500;     ///< Minimum heartbeat deviation in milliseconds
+  unsigned int itsPhiAcceptablePause = 1000;  ///< Tolerated extra pause in milliseconds
+  unsigned int itsPhiCheckInterval = 500;     ///< Failure detector check interval in milliseconds
+
   std::string itsForwardingMode = "random";  //< Forwarding mode
   float itsBalanceFactor = 2.0F;             // Balancing factor
   std::string itsStickyCookie;               // Affinity cookie name for sticky forwarding
 
-  Spine::Reactor* itsReactor = nullptr;  ///< The reactor pointer for URI map retrieval
+  std::unique_ptr<ReactorAccess> itsReactor;  ///< The reactor services, set by launch
 
   Services itsServices;  /// Services object includes the list known services.
 
@@ -117,12 +301,30 @@ class Engine : public SmartMet::Spine::SmartMetEngine
 
   std::array<char, 8192> itsReceiveBuffer;  ///< Buffer for incoming UDP messages
 
+  std::vector<std::array<char, 8192>> itsReceiveRing;  ///< Frontend buffers for recvmmsg
+  std::vector<char> itsArenaBlock;  ///< Preallocated first block of the decoding arena
+  std::unique_ptr<google::protobuf::Arena> itsArena;  ///< Arena for decoding received messages
+
+  FragmentAssembler itsFragments;  ///< Reassembly of fragmented replies
+
   std::shared_ptr<boost::thread> itsAsyncThread;  ///< Async thread for the IO Service.
 
   boost::asio::basic_waitable_timer<std::chrono::steady_clock>
       itsResponseDeadlineTimer;  ///< Timer to handle the deadline of
                                  /// backend responses
 
+  boost::asio::basic_waitable_timer<std::chrono::steady_clock>
+      itsHeartBeatTimer;  ///< Timer to start the next heartbeat
+
+  boost::asio::basic_waitable_timer<std::chrono::steady_clock>
+      itsBeaconTimer;  ///< Timer for sending beacons to frontends
+
+  boost::asio::basic_waitable_timer<std::chrono::steady_clock>
+      itsGossipTimer;  ///< Timer for gossiping connection counts to other frontends
+
+  boost::asio::basic_waitable_timer<std::chrono::steady_clock>
+      itsSuspicionTimer;  ///< Timer for checking the failure detectors
+
   // Sputnik may be paused for a while via an external request
 
   mutable Spine::MutexType itsPauseMutex;
@@ -180,29 +382,83 @@ class Engine : public SmartMet::Spine::SmartMetEngine
 
   /** \brief Method to handle received backend responses
    *
-   * This method is called when frontend receives a UDP message.
+   * This method is called when the frontend socket becomes readable. Bursts of
+   * datagrams are drained with recvmmsg and decoded into an arena.
    */
-  void handleFrontendRead(const boost::system::error_code& e, std::size_t bytes_transferred);
+  void handleFrontendRead(const boost::system::error_code& e);
+
+  /** \brief Passes a received message to the handler of its type (frontend behaviour)
+   *
+   */
+  void dispatchFrontendMessage(BroadcastMessage& theMessage);
 
   /** \brief Makes and serializes a discovery request message (frontend behaviour)
    *
    * @param theMessageBuffer Buffer into which the message is serialized.
    * @param theSequenceNumber The current sequence number of the frontend.
+   * @return Number of known catalogs which did not fit in the request.
    */
-  void sendDiscoveryRequest(std::string& theMessageBuffer, int theSequenceNumber);
+  std::size_t sendDiscoveryRequest(std::string& theMessageBuffer, int theSequenceNumber);
+
+  /** \brief Makes and serializes a connection count gossip message (frontend behaviour)
+   *
+   * @param theMessageBuffer Buffer into which the message is serialized.
+   */
+  void sendConnectionGossip(std::string& theMessageBuffer);
 
   /** \brief Makes and serializes a discovery response message (backend behaviour)
+   *
+   * The services are omitted if the frontend already knows the current catalog version.
    *
    * @param theMessageBuffer Buffer into which the message is serialized.
-   * @param theSequenceNumber The current sequence number received from the frontend.
+   * @param theRequest The discovery request received from the frontend.
    */
-  void sendDiscoveryReply(std::string& theMessageBuffer, int theSequenceNumber);
+  void sendDiscoveryReply(std::string& theMessageBuffer, const BroadcastMessage& theRequest);
+
+  /** \brief Makes and serializes a beacon message (backend behaviour)
+   *
+   * Beacons carry the current load and catalog version of the backend.
+   *
+   * @param theMessageBuffer Buffer into which the message is serialized.
+   * @return The current catalog version.
+   */
+  std::uint64_t sendDiscoveryBeacon(std::string& theMessageBuffer);
+
+  /** \brief Splits a serialized reply into datagrams (backend behaviour)
+   *
+   * Replies larger than the datagram size accepted by the frontend are compressed
+   * and/or split into fragments, if the frontend supports them.
+   *
+   * @param theReply The serialized reply.
+   * @param theRequest The discovery request received from the frontend.
+   * @param theDatagrams The datagrams to be sent.
+   */
+  void packReply(const std::string& theReply,
+                 const BroadcastMessage& theRequest,
+                 std::vector<std::string>& theDatagrams);
 
   /** \brief Processes received discovery request (backend behaviour)
    *
-   * Ensures received message is of correct type and sends response.
+   * Ensures received message is of correct type and prepares the response datagrams.
+   */
+  void processRequest(BroadcastMessage& theMessage, std::vector<std::string>& theResponses);
+
+  /** \brief Processes a received beacon (frontend behaviour)
+   *
+   * Updates the backend load in place without waiting for the next discovery cycle.
    */
-  void processRequest(BroadcastMessage& theMessage, std::string& theResponseBuffer);
+  void processBeacon(const BroadcastMessage& theMessage);
+
+  /** \brief Processes connection counts gossiped by another frontend
+   *
+   */
+  void processGossip(const BroadcastMessage& theMessage);
+
+  /** \brief Processes a received reply fragment (frontend behaviour)
+   *
+   * Once all fragments have been received the reply is processed normally.
+   */
+  void processFragment(const BroadcastMessage& theMessage);
 
   /** \brief Processes received discovery response (frontend behaviour)
    *
@@ -210,6 +466,25 @@ class Engine : public SmartMet::Spine::SmartMetEngine
    */
   void processReply(BroadcastMessage& theMessage);
 
+  /** \brief Stages the services and info requests of a complete reply (frontend behaviour)
+   *
+   * The catalog is the reply itself, or the cached full reply if the backend only
+   * confirmed its catalog version.
+   */
+  void addReply(const BroadcastMessage& theMessage, const BroadcastMessage& theCatalog);
+
+  /** \brief Loads the routing snapshot written by an earlier process (frontend behaviour)
+   *
+   * The loaded backends are provisional: they are removed like any other backend
+   * if they do not reply during the first discovery cycles.
+   */
+  void loadSnapshot();
+
+  /** \brief Writes the routing snapshot if it is due (frontend behaviour)
+   *
+   */
+  void writeSnapshot();
+
   /** \brief Set a backend alive (reset the throttle counter)
    *
    * If this is not called before throttle counter reaches the maximum
@@ -238,6 +513,61 @@ class Engine : public SmartMet::Spine::SmartMetEngine
   std::unique_ptr<SmartMet::Spine::Table> backends(const std::string& service = "",
                                                    bool full = true) const;
 
+  /**
+   * @brief Latency statistics of the routing hot paths
+   *
+   * Percentiles of getService, its phases, lock wait and hold times and the
+   * forwarder redistribution times in microseconds. Collected only if
+   * instrumentation.latency is enabled.
+   * @return Table with one row per measured operation
+   */
+  std::unique_ptr<SmartMet::Spine::Table> latencies() const;
+
+  /**
+   * @brief Explain how a request would be routed
+   *
+   * Shows the resolved URI prefix, every candidate backend with its
+   * connection count, load, weight and probability, or its HRW score and
+   * exclusion reason with sticky forwarding, and marks the backend the next
+   * request would go to. Forwarder state and random generators are not changed.
+   * @param theRequest The request to explain
+   * @return Table with one row per candidate backend
+   */
+  std::unique_ptr<SmartMet::Spine::Table> explain(const Spine::HTTP::Request& theRequest) const;
+
+  /**
+   * @brief Routing counters in OpenMetrics text format
+   *
+   * Per backend selections by URI, reported load, requests in flight,
+   * throttle state, ejections and discovery round trip times, and the
+   * discovery cycle churn. The routing write lock is not taken.
+   * @return Metrics text ending with the EOF marker
+   */
+  std::string metrics() const;
+
+  /**
+   * @brief The most recent sampled routing decisions
+   *
+   * Each row lists the URI, the resolved prefix, the forwarding mode, the
+   * candidate backends with their selection probabilities, loads and weights,
+   * and the chosen backend. Empty unless instrumentation.trace_sample_rate is set.
+   * @param count Maximum number of decisions to list
+   * @return Table with one row per decision, newest first
+   */
+  std::unique_ptr<SmartMet::Spine::Table> routingTrace(std::size_t count = 100) const;
+
+  /**
+   * @brief Statistics of the recent discovery cycles
+   *
+   * Probes sent, known catalogs left out of the probes, datagrams and bytes
+   * received, truncated and unparseable datagrams, replies per listener,
+   * round trip times, routing table churn, write lock hold time and the
+   * routing table size at the end of the reply window. The number of cycles
+   * is set by instrumentation.cycle_history.
+   * @return Table with one row per cycle, newest first
+   */
+  std::unique_ptr<SmartMet::Spine::Table> discoveryStats() const;
+
   Services::BackendList getBackendList(const std::string& service = "") const;
 
   Services::BackendList getInfoRequestBackendList(const std::string& infoRequestName) const;
@@ -253,6 +583,19 @@ class Engine : public SmartMet::Spine::SmartMetEngine
   void setPause();
   void setPauseUntil(const Fmi::DateTime& theDeadLine);
   void setContinue();
+
+  /** \brief Whether the initial routing table is complete
+   *
+   * A frontend becomes ready once the set of responding backends has settled
+   * during the startup probes. A backend is always ready.
+   */
+  bool isReady() const;
+
+  /** \brief Waits until the engine is ready or the timeout expires
+   *
+   * @return True if the engine is ready
+   */
+  bool waitUntilReady(std::chrono::milliseconds theTimeout) const;
 };
 
 }  // namespace Sputnik
@@ -12,20 +12,18 @@ ExponentialConnectionsForwarder::ExponentialConnectionsForwarder(float balancing
 {
 }
 
-void ExponentialConnectionsForwarder::redistribute(Spine::Reactor& theReactor)
+std::vector<float> ExponentialConnectionsForwarder::probabilities(Connections& theConnections) const
 {
   try
   {
-    auto connections = theReactor.getBackendRequestStatus();
-
     std::vector<float> probVec;
     probVec.reserve(itsBackendInfos.size());
 
     for (const auto& info : itsBackendInfos)
     {
-      int count = connections[info.hostName][info.port];  // zero if not found
+      int count = theConnections[info.hostName][info.port];  // zero if not found
 
-      probVec.push_back(std::exp(-itsBalancingCoefficient * count));
+      probVec.push_back(info.weight * std::exp(-itsBalancingCoefficient * count));
 #ifdef MYDEBUG
       std::cout << "Inverse prob: " << probVec.back() << " from conns " << count << std::endl;
 #endif
@@ -36,7 +34,20 @@ void ExponentialConnectionsForwarder::redistribute(Spine::Reactor& theReactor)
     for (auto& prob : probVec)
       prob /= sum;
 
-    boost::random::discrete_distribution<> theDistribution(probVec);
+    return probVec;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void ExponentialConnectionsForwarder::redistribute(ReactorAccess& theReactor)
+{
+  try
+  {
+    auto connections = connectionCounts(theReactor);
+    boost::random::discrete_distribution<> theDistribution(probabilities(connections));
     itsDistribution = theDistribution;
   }
   catch (...)
@@ -45,9 +56,9 @@ void ExponentialConnectionsForwarder::redistribute(Spine::Reactor& theReactor)
   }
 }
 
-void ExponentialConnectionsForwarder::rebalance(Spine::Reactor& theReactor)
+void ExponentialConnectionsForwarder::rebalance(ReactorAccess& theReactor)
 {
-  redistribute(theReactor);
+  distribute(theReactor);
 }
 
 }  // namespace SmartMet
@@ -28,8 +28,9 @@ class ExponentialConnectionsForwarder : public BackendForwarder
   ExponentialConnectionsForwarder& operator=(ExponentialConnectionsForwarder&& other) = delete;
 
  private:
-  void redistribute(Spine::Reactor& theReactor) override;
-  void rebalance(Spine::Reactor& theReactor) override;
+  void redistribute(ReactorAccess& theReactor) override;
+  std::vector<float> probabilities(Connections& theConnections) const override;
+  void rebalance(ReactorAccess& theReactor) override;
 };
 
 }  // namespace SmartMet
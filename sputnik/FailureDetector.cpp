@@ -0,0 +1,94 @@
+#include "FailureDetector.h"
+#include <algorithm>
+#include <cmath>
+
+namespace SmartMet
+{
+namespace
+{
+// Number of inter-arrival samples kept
+constexpr std::size_t kWindowSize = 100;
+}  // namespace
+
+FailureDetector::FailureDetector(std::chrono::milliseconds theFirstEstimate,
+                                 std::chrono::milliseconds theMinStdDev,
+                                 std::chrono::milliseconds theAcceptablePause)
+    : itsExpected(static_cast<double>(theFirstEstimate.count())),
+      itsMinStdDev(static_cast<double>(theMinStdDev.count())),
+      itsAcceptablePause(static_cast<double>(theAcceptablePause.count()))
+{
+  // Bootstrap the statistics with the expected interval and a generous deviation
+  // so that the first missed heartbeat is not immediately fatal.
+  const auto deviation = itsExpected / 4;
+  for (double interval : {-deviation, deviation})
+  {
+    itsIntervals.push_back(interval);
+    itsSum += interval;
+    itsSumSquares += interval * interval;
+  }
+}
+
+void FailureDetector::heartbeat(Clock::time_point theTime)
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+
+  if (itsStarted)
+  {
+    const double interval =
+        std::chrono::duration<double, std::milli>(theTime - itsLastHeartbeat).count() -
+        itsExpected;
+
+    itsIntervals.push_back(interval);
+    itsSum += interval;
+    itsSumSquares += interval * interval;
+
+    if (itsIntervals.size() > kWindowSize)
+    {
+      const double oldest = itsIntervals.front();
+      itsIntervals.pop_front();
+      itsSum -= oldest;
+      itsSumSquares -= oldest * oldest;
+    }
+  }
+
+  itsStarted = true;
+  itsLastHeartbeat = theTime;
+  itsLastSeen = std::max(itsLastSeen, theTime);
+}
+
+void FailureDetector::expect(std::chrono::milliseconds theInterval)
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+  itsExpected = static_cast<double>(theInterval.count());
+}
+
+void FailureDetector::alive(Clock::time_point theTime)
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+  if (itsStarted)
+    itsLastSeen = std::max(itsLastSeen, theTime);
+}
+
+double FailureDetector::phi(Clock::time_point theTime) const
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+
+  if (!itsStarted)
+    return 0;
+
+  const double elapsed = std::chrono::duration<double, std::milli>(theTime - itsLastSeen).count();
+
+  const auto n = static_cast<double>(itsIntervals.size());
+  const double mean = itsExpected + itsSum / n + itsAcceptablePause;
+  const double variance = std::max(0.0, itsSumSquares / n - (itsSum / n) * (itsSum / n));
+  const double stddev = std::max(itsMinStdDev, std::sqrt(variance));
+
+  // Logistic approximation of the normal CDF (as in the Akka implementation)
+  const double y = (elapsed - mean) / stddev;
+  const double e = std::exp(-y * (1.5976 + 0.070566 * y * y));
+  if (elapsed > mean)
+    return -std::log10(e / (1.0 + e));
+  return -std::log10(1.0 - 1.0 / (1.0 + e));
+}
+
+}  // namespace SmartMet
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <mutex>
+
+namespace SmartMet
+{
+/*! \brief Phi accrual failure detector for a single backend
+ *
+ * Instead of a binary alive/dead decision the detector produces a continuous
+ * suspicion level phi = -log10(P(no heartbeat for this long)), where the
+ * probability is estimated from a normal distribution fitted to the recent
+ * heartbeat inter-arrival times. A phi of 1 means a 10% chance of the backend
+ * still being alive, phi 2 means 1%, and so on.
+ *
+ * Periodic heartbeats (discovery replies) are used as samples. Other signs of
+ * life (beacons, completed HTTP requests) only reset the elapsed time, since
+ * their arrival times depend on the load rather than on the discovery cycle.
+ *
+ * The samples are stored relative to the expected heartbeat interval, so the
+ * learned jitter remains valid when the discovery interval is adapted.
+ */
+
+class FailureDetector
+{
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  /*! \brief Constructor
+   *
+   * @param theFirstEstimate Expected heartbeat interval before any samples are available
+   * @param theMinStdDev Lower limit for the standard deviation of the intervals
+   * @param theAcceptablePause Additional pause tolerated before suspicion rises
+   */
+
+  FailureDetector(std::chrono::milliseconds theFirstEstimate,
+                  std::chrono::milliseconds theMinStdDev,
+                  std::chrono::milliseconds theAcceptablePause);
+
+  ~FailureDetector() = default;
+
+  FailureDetector() = delete;
+  FailureDetector(const FailureDetector& other) = delete;
+  FailureDetector& operator=(const FailureDetector& other) = delete;
+  FailureDetector(FailureDetector&& other) = delete;
+  FailureDetector& operator=(FailureDetector&& other) = delete;
+
+  /*! \brief Record a periodic heartbeat */
+  void heartbeat(Clock::time_point theTime = Clock::now());
+
+  /*! \brief Set the expected heartbeat interval */
+  void expect(std::chrono::milliseconds theInterval);
+
+  /*! \brief Record a sign of life which is not periodic */
+  void alive(Clock::time_point theTime = Clock::now());
+
+  /*! \brief Current suspicion level */
+  double phi(Clock::time_point theTime = Clock::now()) const;
+
+ private:
+  mutable std::mutex itsMutex;
+
+  std::deque<double> itsIntervals;  // Recent deviations from the expected interval in ms
+  double itsSum = 0;
+  double itsSumSquares = 0;
+
+  double itsExpected;
+  double itsMinStdDev;
+  double itsAcceptablePause;
+
+  bool itsStarted = false;
+  Clock::time_point itsLastHeartbeat;
+  Clock::time_point itsLastSeen;
+};
+
+}  // namespace SmartMet
@@ -0,0 +1,77 @@
+#include "FragmentAssembler.h"
+#include <macgyver/Exception.h>
+
+namespace SmartMet
+{
+namespace
+{
+// Incomplete replies older than this are discarded
+constexpr std::chrono::seconds kFragmentTimeout{10};
+}  // namespace
+
+std::optional<std::string> FragmentAssembler::add(const std::string& theSender,
+                                                  unsigned int theId,
+                                                  unsigned int theIndex,
+                                                  unsigned int theCount,
+                                                  const std::string& thePayload)
+{
+  try
+  {
+    const auto now = std::chrono::steady_clock::now();
+    expire(now);
+
+    if (theCount == 0 || theCount > MaxFragments || theIndex >= theCount)
+      return {};
+
+    // Single fragment replies are complete as such (compressed replies)
+    if (theCount == 1)
+      return thePayload;
+
+    auto& pending = itsPending[std::make_tuple(theSender, theId)];
+    if (pending.parts.empty())
+    {
+      pending.started = now;
+      pending.parts.resize(theCount);
+    }
+    else if (pending.parts.size() != theCount)
+    {
+      // Inconsistent fragment count, the sender must have restarted
+      itsPending.erase(std::make_tuple(theSender, theId));
+      return {};
+    }
+
+    auto& part = pending.parts[theIndex];
+    if (!part)
+    {
+      part = thePayload;
+      ++pending.received;
+    }
+
+    if (pending.received < theCount)
+      return {};
+
+    std::string result;
+    for (const auto& p : pending.parts)
+      result += *p;
+
+    itsPending.erase(std::make_tuple(theSender, theId));
+    return result;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void FragmentAssembler::expire(std::chrono::steady_clock::time_point theNow)
+{
+  for (auto it = itsPending.begin(); it != itsPending.end();)
+  {
+    if (theNow - it->second.started > kFragmentTimeout)
+      it = itsPending.erase(it);
+    else
+      ++it;
+  }
+}
+
+}  // namespace SmartMet
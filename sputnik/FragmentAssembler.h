@@ -0,0 +1,63 @@
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace SmartMet
+{
+/*! \brief Reassembles discovery replies split into several datagrams
+ *
+ * Fragments are collected per sender and reply identifier. Incomplete replies
+ * are dropped once they get too old, for example when a datagram was lost.
+ *
+ * The assembler is used only from the IO thread and is hence not thread safe.
+ */
+
+class FragmentAssembler
+{
+ public:
+  FragmentAssembler() = default;
+  ~FragmentAssembler() = default;
+
+  FragmentAssembler(const FragmentAssembler& other) = delete;
+  FragmentAssembler& operator=(const FragmentAssembler& other) = delete;
+  FragmentAssembler(FragmentAssembler&& other) = delete;
+  FragmentAssembler& operator=(FragmentAssembler&& other) = delete;
+
+  /*! \brief Add a fragment
+   *
+   * @param theSender Identity of the sender (for example ip:port)
+   * @param theId The reply identifier chosen by the sender
+   * @param theIndex Index of the fragment
+   * @param theCount Total number of fragments in the reply
+   * @param thePayload Fragment contents
+   * @return The complete payload once all fragments have been received
+   */
+
+  std::optional<std::string> add(const std::string& theSender,
+                                  unsigned int theId,
+                                  unsigned int theIndex,
+                                  unsigned int theCount,
+                                  const std::string& thePayload);
+
+  /*! \brief Maximum number of fragments accepted for a single reply */
+  static constexpr unsigned int MaxFragments = 256;
+
+ private:
+  struct Pending
+  {
+    std::chrono::steady_clock::time_point started;
+    std::vector<std::optional<std::string>> parts;
+    unsigned int received = 0;
+  };
+
+  void expire(std::chrono::steady_clock::time_point theNow);
+
+  std::map<std::tuple<std::string, unsigned int>, Pending> itsPending;
+};
+
+}  // namespace SmartMet
@@ -0,0 +1,211 @@
+#include "Instrumentation.h"
+#include <macgyver/Exception.h>
+#include <smartmet/macgyver/StringConversion.h>
+#include <smartmet/spine/Table.h>
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+namespace SmartMet
+{
+namespace
+{
+const char* const MetricNames[] = {"getService",
+                                   "prefix lookup",
+                                   "map lookup",
+                                   "forwarder pick",
+                                   "routing read lock wait",
+                                   "routing read lock hold",
+                                   "routing write lock wait",
+                                   "routing write lock hold",
+                                   "sentinel lock wait",
+                                   "sentinel lock hold",
+                                   "forwarder lock wait",
+                                   "forwarder lock hold"};
+
+const char* const ForwarderNames[] = {"redistribute random",
+                                      "redistribute inverseload",
+                                      "redistribute inverseconnections",
+                                      "redistribute leastconnections",
+                                      "redistribute doublerandom",
+                                      "redistribute exponentialconnections",
+                                      "redistribute sticky"};
+
+static_assert(sizeof(MetricNames) / sizeof(*MetricNames) == Instrumentation::NumMetrics);
+static_assert(sizeof(ForwarderNames) / sizeof(*ForwarderNames) ==
+              Instrumentation::kForwarderTypes);
+
+std::string microseconds(double theValue)
+{
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(1) << theValue;
+  return out.str();
+}
+
+}  // namespace
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Bucket index of a duration in nanoseconds
+ *
+ * Values below 16 have exact buckets, larger ones are split into 16 buckets
+ * per power of two. Values beyond the last bucket are counted in it.
+ */
+// ----------------------------------------------------------------------
+
+std::size_t LatencyHistogram::bucket(std::uint64_t theValue) noexcept
+{
+  if (theValue < kSubBuckets)
+    return theValue;
+
+  unsigned magnitude = 0;
+  for (auto v = theValue; v > 1; v >>= 1)
+    ++magnitude;
+
+  const unsigned shift = magnitude - kSubBits;
+  const std::size_t index = (shift + 1) * kSubBuckets + ((theValue >> shift) - kSubBuckets);
+  return std::min(index, kBuckets - 1);
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Representative value of a bucket in nanoseconds
+ */
+// ----------------------------------------------------------------------
+
+std::uint64_t LatencyHistogram::bucketValue(std::size_t theBucket) noexcept
+{
+  if (theBucket < kSubBuckets)
+    return theBucket;
+
+  const std::size_t shift = theBucket / kSubBuckets - 1;
+  const std::uint64_t low = (theBucket % kSubBuckets + kSubBuckets) << shift;
+  return low + ((std::uint64_t{1} << shift) >> 1);
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Count a duration
+ */
+// ----------------------------------------------------------------------
+
+void LatencyHistogram::add(Duration theDuration) noexcept
+{
+  static std::atomic<std::size_t> next{0};
+  thread_local const std::size_t shardIndex = next++ % kShards;
+
+  const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(theDuration).count();
+  const auto value = static_cast<std::uint64_t>(std::max<decltype(ns)>(ns, 0));
+
+  auto& shard = itsShards[shardIndex];
+  shard.counts[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+  shard.sum.fetch_add(value, std::memory_order_relaxed);
+
+  auto old = shard.max.load(std::memory_order_relaxed);
+  while (value > old && !shard.max.compare_exchange_weak(old, value, std::memory_order_relaxed))
+  {
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Merge the shards and calculate the percentiles
+ */
+// ----------------------------------------------------------------------
+
+LatencyHistogram::Summary LatencyHistogram::summary() const
+{
+  try
+  {
+    std::array<std::uint64_t, kBuckets> counts{};
+    std::uint64_t sum = 0;
+    std::uint64_t max = 0;
+
+    for (const auto& shard : itsShards)
+    {
+      for (std::size_t i = 0; i < kBuckets; i++)
+        counts[i] += shard.counts[i].load(std::memory_order_relaxed);
+      sum += shard.sum.load(std::memory_order_relaxed);
+      max = std::max(max, shard.max.load(std::memory_order_relaxed));
+    }
+
+    Summary ret;
+    for (auto count : counts)
+      ret.count += count;
+
+    if (ret.count == 0)
+      return ret;
+
+    const auto percentile = [&](double q)
+    {
+      const auto rank = static_cast<std::uint64_t>(std::ceil(q * static_cast<double>(ret.count)));
+      std::uint64_t seen = 0;
+      for (std::size_t i = 0; i < kBuckets; i++)
+      {
+        seen += counts[i];
+        if (seen >= rank)
+          return std::min(bucketValue(i), max) / 1000.0;
+      }
+      return max / 1000.0;
+    };
+
+    ret.mean = static_cast<double>(sum) / static_cast<double>(ret.count) / 1000.0;
+    ret.p50 = percentile(0.5);
+    ret.p90 = percentile(0.9);
+    ret.p99 = percentile(0.99);
+    ret.p999 = percentile(0.999);
+    ret.max = max / 1000.0;
+    return ret;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Latency statistics in microseconds, one row per metric
+ */
+// ----------------------------------------------------------------------
+
+std::unique_ptr<Spine::Table> Instrumentation::table() const
+{
+  try
+  {
+    auto ret = std::make_unique<Spine::Table>();
+    ret->setTitle(enabled() ? "Latencies (us)" : "Latencies (us, disabled)");
+    ret->setNames({"Metric", "Count", "Mean", "P50", "P90", "P99", "P99.9", "Max"});
+
+    std::size_t row = 0;
+    const auto add = [&](const char* theName, const LatencyHistogram& theHistogram)
+    {
+      const auto s = theHistogram.summary();
+      ret->set(0, row, theName);
+      ret->set(1, row, Fmi::to_string(s.count));
+      ret->set(2, row, microseconds(s.mean));
+      ret->set(3, row, microseconds(s.p50));
+      ret->set(4, row, microseconds(s.p90));
+      ret->set(5, row, microseconds(s.p99));
+      ret->set(6, row, microseconds(s.p999));
+      ret->set(7, row, microseconds(s.max));
+      ++row;
+    };
+
+    for (std::size_t i = 0; i < NumMetrics; i++)
+      add(MetricNames[i], itsHistograms[i]);
+
+    for (std::size_t i = 0; i < kForwarderTypes; i++)
+      add(ForwarderNames[i], itsRedistribute[i]);
+
+    return ret;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+}  // namespace SmartMet
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+namespace SmartMet
+{
+namespace Spine
+{
+class Table;
+}
+
+/*! \brief HDR style latency histogram
+ *
+ * Durations are counted in logarithmic buckets with 16 linear sub-buckets each,
+ * giving about 6% relative precision from nanoseconds to hours. Each thread
+ * updates its own shard with relaxed atomic increments, and the shards are
+ * merged only when the histogram is read.
+ */
+
+class LatencyHistogram
+{
+ public:
+  using Duration = std::chrono::steady_clock::duration;
+
+  struct Summary
+  {
+    std::uint64_t count = 0;
+    double mean = 0;  // Microseconds
+    double p50 = 0;
+    double p90 = 0;
+    double p99 = 0;
+    double p999 = 0;
+    double max = 0;
+  };
+
+  void add(Duration theDuration) noexcept;
+
+  Summary summary() const;
+
+ private:
+  static constexpr unsigned kSubBits = 4;
+  static constexpr std::size_t kSubBuckets = 1U << kSubBits;
+  static constexpr std::size_t kMagnitudes = 44;
+  static constexpr std::size_t kBuckets = (kMagnitudes - kSubBits + 1) * kSubBuckets;
+  static constexpr std::size_t kShards = 8;
+
+  static std::size_t bucket(std::uint64_t theValue) noexcept;
+  static std::uint64_t bucketValue(std::size_t theBucket) noexcept;
+
+  struct alignas(64) Shard
+  {
+    std::array<std::atomic<std::uint64_t>, kBuckets> counts{};
+    std::atomic<std::uint64_t> sum{0};
+    std::atomic<std::uint64_t> max{0};
+  };
+
+  std::array<Shard, kShards> itsShards;
+};
+
+/*! \brief Latency statistics of the routing hot paths
+ *
+ * The statistics are collected only when enabled, otherwise the cost is a
+ * single branch per measured operation.
+ */
+
+class Instrumentation
+{
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  enum Metric : std::uint8_t
+  {
+    GetService,         // Services::getService in total
+    PrefixLookup,       // URI prefix translation
+    MapLookup,          // Service list lookup
+    ForwarderPick,      // Backend selection by the forwarder
+    RoutingReadWait,    // Waiting for the routing table read lock
+    RoutingReadHold,    // Holding the routing table read lock
+    RoutingWriteWait,   // Waiting for the routing table write lock
+    RoutingWriteHold,   // Holding the routing table write lock
+    SentinelWait,       // Waiting for the sentinel map lock
+    SentinelHold,       // Holding the sentinel map lock
+    ForwarderWait,      // Waiting for a forwarder lock
+    ForwarderHold,      // Holding a forwarder lock
+    NumMetrics
+  };
+
+  // Forwarder types in the order of Services::ForwardingMode
+  static constexpr std::size_t kForwarderTypes = 7;
+
+  bool enabled() const { return itsEnabled.load(std::memory_order_relaxed); }
+  void setEnabled(bool theFlag) { itsEnabled = theFlag; }
+
+  LatencyHistogram& histogram(Metric theMetric) { return itsHistograms[theMetric]; }
+  LatencyHistogram& redistribute(std::size_t theType) { return itsRedistribute[theType]; }
+
+  std::unique_ptr<Spine::Table> table() const;
+
+  /*! \brief Measures the total duration of an operation and its phases
+   *
+   * Nothing is measured if instrumentation is disabled.
+   */
+
+  class Timer
+  {
+   public:
+    Timer(Instrumentation& theInstrumentation, Metric theTotal)
+        : itsInstrumentation(theInstrumentation.enabled() ? &theInstrumentation : nullptr),
+          itsTotal(theTotal)
+    {
+      if (itsInstrumentation != nullptr)
+        itsStart = itsSplit = Clock::now();
+    }
+
+    ~Timer()
+    {
+      if (itsInstrumentation != nullptr)
+        itsInstrumentation->histogram(itsTotal).add(Clock::now() - itsStart);
+    }
+
+    // Start the next phase without recording the time spent since the previous split
+    void mark()
+    {
+      if (itsInstrumentation != nullptr)
+        itsSplit = Clock::now();
+    }
+
+    // Record the time since the previous split as the given phase
+    void split(Metric thePhase)
+    {
+      if (itsInstrumentation == nullptr)
+        return;
+      const auto now = Clock::now();
+      itsInstrumentation->histogram(thePhase).add(now - itsSplit);
+      itsSplit = now;
+    }
+
+    Timer() = delete;
+    Timer(const Timer& other) = delete;
+    Timer& operator=(const Timer& other) = delete;
+    Timer(Timer&& other) = delete;
+    Timer& operator=(Timer&& other) = delete;
+
+   private:
+    Instrumentation* itsInstrumentation;
+    Metric itsTotal;
+    Clock::time_point itsStart;
+    Clock::time_point itsSplit;
+  };
+
+ private:
+  std::atomic<bool> itsEnabled{false};
+  std::array<LatencyHistogram, NumMetrics> itsHistograms;
+  std::array<LatencyHistogram, kForwarderTypes> itsRedistribute;
+};
+
+/*! \brief A lock which records its wait and hold times
+ *
+ * Lock is one of the Spine lock types, for example Spine::ReadLock, and the
+ * source is whatever it is constructed from: the mutex, or an upgrade lock
+ * for Spine::UpgradeWriteLock. If a total is given, the hold time in
+ * nanoseconds is always added to it.
+ */
+
+template <typename Lock>
+class TimedLock
+{
+ public:
+  template <typename Source>
+  TimedLock(Source& theSource,
+            Instrumentation* theInstrumentation,
+            Instrumentation::Metric theWait,
+            Instrumentation::Metric theHold,
+            std::atomic<std::uint64_t>* theTotal = nullptr)
+      : itsInstrumentation(theInstrumentation != nullptr && theInstrumentation->enabled()
+                               ? theInstrumentation
+                               : nullptr),
+        itsHold(theHold),
+        itsTotal(theTotal),
+        itsAcquired(itsInstrumentation != nullptr ? Instrumentation::Clock::now()
+                                                  : Instrumentation::Clock::time_point()),
+        itsLock(theSource)
+  {
+    if (itsInstrumentation != nullptr || itsTotal != nullptr)
+    {
+      const auto now = Instrumentation::Clock::now();
+      if (itsInstrumentation != nullptr)
+        itsInstrumentation->histogram(theWait).add(now - itsAcquired);
+      itsAcquired = now;
+    }
+  }
+
+  ~TimedLock()
+  {
+    if (itsInstrumentation == nullptr && itsTotal == nullptr)
+      return;
+
+    const auto held = Instrumentation::Clock::now() - itsAcquired;
+    if (itsInstrumentation != nullptr)
+      itsInstrumentation->histogram(itsHold).add(held);
+    if (itsTotal != nullptr)
+      itsTotal->fetch_add(
+          static_cast<std::uint64_t>(
+              std::chrono::duration_cast<std::chrono::nanoseconds>(held).count()),
+          std::memory_order_relaxed);
+  }
+
+  TimedLock() = delete;
+  TimedLock(const TimedLock& other) = delete;
+  TimedLock& operator=(const TimedLock& other) = delete;
+  TimedLock(TimedLock&& other) = delete;
+  TimedLock& operator=(TimedLock&& other) = delete;
+
+ private:
+  Instrumentation* itsInstrumentation;
+  Instrumentation::Metric itsHold;
+  std::atomic<std::uint64_t>* itsTotal;
+  Instrumentation::Clock::time_point itsAcquired;
+  Lock itsLock;
+};
+
+}  // namespace SmartMet
@@ -10,20 +10,18 @@ InverseConnectionsForwarder::InverseConnectionsForwarder(float balancingCoeffici
 {
 }
 
-void InverseConnectionsForwarder::redistribute(Spine::Reactor& theReactor)
+std::vector<float> InverseConnectionsForwarder::probabilities(Connections& theConnections) const
 {
   try
   {
-    auto connections = theReactor.getBackendRequestStatus();
-
     std::vector<float> probVec;
     probVec.reserve(itsBackendInfos.size());
 
     for (const auto& info : itsBackendInfos)
     {
-      int count = connections[info.hostName][info.port];  // zero if not found
+      int count = theConnections[info.hostName][info.port];  // zero if not found
 
-      probVec.push_back(1.0F / (1.0F + itsBalancingCoefficient * count));
+      probVec.push_back(info.weight / (1.0F + itsBalancingCoefficient * count));
 #ifdef MYDEBUG
       std::cout << "Inverse prob: " << probVec.back() << " from conns " << count << std::endl;
 #endif
@@ -34,7 +32,20 @@ void InverseConnectionsForwarder::redistribute(Spine::Reactor& theReactor)
     for (auto& prob : probVec)
       prob /= sum;
 
-    boost::random::discrete_distribution<> theDistribution(probVec);
+    return probVec;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void InverseConnectionsForwarder::redistribute(ReactorAccess& theReactor)
+{
+  try
+  {
+    auto connections = connectionCounts(theReactor);
+    boost::random::discrete_distribution<> theDistribution(probabilities(connections));
     itsDistribution = theDistribution;
   }
   catch (...)
@@ -43,9 +54,9 @@ void InverseConnectionsForwarder::redistribute(Spine::Reactor& theReactor)
   }
 }
 
-void InverseConnectionsForwarder::rebalance(Spine::Reactor& theReactor)
+void InverseConnectionsForwarder::rebalance(ReactorAccess& theReactor)
 {
-  redistribute(theReactor);
+  distribute(theReactor);
 }
 
 }  // namespace SmartMet
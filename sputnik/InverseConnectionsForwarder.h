@@ -27,8 +27,9 @@ class InverseConnectionsForwarder : public BackendForwarder
   InverseConnectionsForwarder& operator=(InverseConnectionsForwarder&& other) = delete;
 
  private:
-  void redistribute(Spine::Reactor& theReactor) override;
-  void rebalance(Spine::Reactor& theReactor) override;
+  void redistribute(ReactorAccess& theReactor) override;
+  std::vector<float> probabilities(Connections& theConnections) const override;
+  void rebalance(ReactorAccess& theReactor) override;
 };
 
 }  // namespace SmartMet
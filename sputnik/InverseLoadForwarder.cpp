@@ -10,7 +10,7 @@ InverseLoadForwarder::InverseLoadForwarder(float balancingCoefficient)
 {
 }
 
-void InverseLoadForwarder::redistribute(Spine::Reactor& /* theReactor */)
+std::vector<float> InverseLoadForwarder::probabilities(Connections& /* theConnections */) const
 {
   try
   {
@@ -22,7 +22,7 @@ void InverseLoadForwarder::redistribute(Spine::Reactor& /* theReactor */)
       // Limit load to range 1...inf to avoid problems due to loads close to zero
       auto load = std::max(1.0F, info.load);
 
-      probVec.push_back(1.0F / (1.0F + itsBalancingCoefficient * load));
+      probVec.push_back(info.weight / (1.0F + itsBalancingCoefficient * load));
 #ifdef MYDEBUG
       std::cout << "Inverse prob: " << probVec.back() << " from load " << info.load << std::endl;
 #endif
@@ -33,7 +33,20 @@ void InverseLoadForwarder::redistribute(Spine::Reactor& /* theReactor */)
     for (auto& prob : probVec)
       prob /= sum;
 
-    boost::random::discrete_distribution<> theDistribution(probVec);
+    return probVec;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void InverseLoadForwarder::redistribute(ReactorAccess& /* theReactor */)
+{
+  try
+  {
+    Connections connections;
+    boost::random::discrete_distribution<> theDistribution(probabilities(connections));
     itsDistribution = theDistribution;
   }
   catch (...)
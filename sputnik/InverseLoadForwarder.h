@@ -33,7 +33,8 @@ class InverseLoadForwarder : public BackendForwarder
   InverseLoadForwarder& operator=(InverseLoadForwarder&& other) = delete;
 
  private:
-  void redistribute(Spine::Reactor& theReactor) override;
+  void redistribute(ReactorAccess& theReactor) override;
+  std::vector<float> probabilities(Connections& theConnections) const override;
 };
 
 }  // namespace SmartMet
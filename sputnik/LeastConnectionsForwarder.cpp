@@ -7,12 +7,10 @@ LeastConnectionsForwarder::~LeastConnectionsForwarder() = default;
 
 LeastConnectionsForwarder::LeastConnectionsForwarder() : BackendForwarder(0.0) {}
 
-void LeastConnectionsForwarder::redistribute(Spine::Reactor& theReactor)
+std::vector<float> LeastConnectionsForwarder::probabilities(Connections& theConnections) const
 {
   try
   {
-    auto connections = theReactor.getBackendRequestStatus();
-
     std::vector<float> probVec;
     probVec.reserve(itsBackendInfos.size());
 
@@ -20,7 +18,7 @@ void LeastConnectionsForwarder::redistribute(Spine::Reactor& theReactor)
     int min_count = -1;
     for (const auto& info : itsBackendInfos)
     {
-      int count = connections[info.hostName][info.port];  // zero if not found
+      int count = theConnections[info.hostName][info.port];  // zero if not found
       if (min_count < 0)
         min_count = count;
       else
@@ -30,10 +28,10 @@ void LeastConnectionsForwarder::redistribute(Spine::Reactor& theReactor)
     // Choose a server with min_count connections
     for (const auto& info : itsBackendInfos)
     {
-      int count = connections[info.hostName][info.port];  // zero if not found
+      int count = theConnections[info.hostName][info.port];  // zero if not found
 
       if (count == min_count)
-        probVec.push_back(1.0F);
+        probVec.push_back(info.weight);
       else
         probVec.push_back(0.0F);
     }
@@ -44,7 +42,20 @@ void LeastConnectionsForwarder::redistribute(Spine::Reactor& theReactor)
       for (auto& prob : probVec)
         prob /= sum;
 
-    boost::random::discrete_distribution<> theDistribution(probVec);
+    return probVec;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void LeastConnectionsForwarder::redistribute(ReactorAccess& theReactor)
+{
+  try
+  {
+    auto connections = connectionCounts(theReactor);
+    boost::random::discrete_distribution<> theDistribution(probabilities(connections));
     itsDistribution = theDistribution;
   }
   catch (...)
@@ -53,9 +64,9 @@ void LeastConnectionsForwarder::redistribute(Spine::Reactor& theReactor)
   }
 }
 
-void LeastConnectionsForwarder::rebalance(Spine::Reactor& theReactor)
+void LeastConnectionsForwarder::rebalance(ReactorAccess& theReactor)
 {
-  redistribute(theReactor);
+  distribute(theReactor);
 }
 
 }  // namespace SmartMet
@@ -25,8 +25,9 @@ class LeastConnectionsForwarder : public BackendForwarder
   LeastConnectionsForwarder& operator=(LeastConnectionsForwarder&& other) = delete;
 
  private:
-  void redistribute(Spine::Reactor& theReactor) override;
-  void rebalance(Spine::Reactor& theReactor) override;
+  void redistribute(ReactorAccess& theReactor) override;
+  std::vector<float> probabilities(Connections& theConnections) const override;
+  void rebalance(ReactorAccess& theReactor) override;
 };
 
 }  // namespace SmartMet
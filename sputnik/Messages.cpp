@@ -1,12 +1,19 @@
 #include "BroadcastMessage.pb.h"
+#include "Deflate.h"
 #include "Engine.h"
+#include "Probes.h"
 #include "Services.h"
 #include <macgyver/Exception.h>
+#include <spine/Convenience.h>
 #include <spine/Reactor.h>
+#include <algorithm>
+#include <cstdint>
 #include <cstdlib>
+#include <fstream>
 #include <iostream>
 #include <map>
 #include <string>
+#include <string_view>
 
 namespace SmartMet
 {
@@ -14,11 +21,98 @@ namespace Engine
 {
 namespace Sputnik
 {
+namespace
+{
+// Bytes taken by the packed knownCatalogs field besides the tokens: the tag and the length
+constexpr std::size_t kKnownCatalogsOverhead = 2 + 5;
+
+// 64-bit FNV-1a, the catalog versions must not depend on the std::hash implementation
+// since frontends and backends may be built differently.
+constexpr std::uint64_t kFnvOffset = 14695981039346656037ULL;
+constexpr std::uint64_t kFnvPrime = 1099511628211ULL;
+
+std::uint64_t fnv1a(std::string_view str, std::uint64_t seed = kFnvOffset)
+{
+  std::uint64_t hash = seed;
+  for (unsigned char c : str)
+  {
+    hash ^= c;
+    hash *= kFnvPrime;
+  }
+  return hash;
+}
+
+// Space reserved for the message header when a reply is split into fragments
+constexpr std::size_t kFragmentOverhead = 64;
+
+// Largest reassembled reply accepted by the frontend
+constexpr std::size_t kMaxReplySize = 4 * 1024 * 1024;
+
+// Identity of a backend in the catalog tokens
+std::uint64_t catalogId(const std::string& theIP, int thePort)
+{
+  return fnv1a(theIP + ":" + std::to_string(thePort));
+}
+
+// Catalog version of the given handlers and admin requests. Both are sorted,
+// hence the version is independent of the order of registration.
+template <typename Handlers, typename Names>
+std::uint64_t catalogVersion(const Handlers& theHandlers,
+                             const std::vector<bool>& thePrefixes,
+                             const Names& theNames)
+{
+  std::uint64_t version = kFnvOffset;
+  std::size_t i = 0;
+  for (const auto& handler : theHandlers)
+  {
+    version = fnv1a(handler.first, version);
+    version = fnv1a(thePrefixes[i++] ? "P" : "U", version);
+  }
+  for (const auto& name : theNames)
+  {
+    version = fnv1a(name, version);
+    version = fnv1a("I", version);
+  }
+  return version;
+}
+
+// Per-core 1 minute load average
+float perCoreLoad()
+{
+  static unsigned corenum = boost::thread::hardware_concurrency();
+
+  double currentLoad = 0;
+  getloadavg(&currentLoad, 1);
+  return boost::numeric_cast<float>(currentLoad / corenum);
+}
+
+// Per-core number of currently runnable tasks, the 4th field of /proc/loadavg ("2/345").
+// Unlike the load average this reacts immediately to load changes.
+float perCoreRunnable()
+{
+  static unsigned corenum = boost::thread::hardware_concurrency();
+
+  std::ifstream in("/proc/loadavg");
+  double avg1 = 0;
+  double avg5 = 0;
+  double avg15 = 0;
+  unsigned int running = 0;
+  if (!(in >> avg1 >> avg5 >> avg15 >> running))
+    return 0;
+
+  // Do not count the process reading the file
+  if (running > 0)
+    --running;
+  return boost::numeric_cast<float>(1.0 * running / corenum);
+}
+
+}  // namespace
+
 // Frontend
-void Engine::sendDiscoveryRequest(std::string& theMessageBuffer, int theSequenceNumber)
+std::size_t Engine::sendDiscoveryRequest(std::string& theMessageBuffer, int theSequenceNumber)
 {
   if (Spine::Reactor::isShuttingDown())
-    return;
+    return 0;
 
   try
   {
@@ -30,12 +124,74 @@ void Engine::sendDiscoveryRequest(std::string& theMessageBuffer, int theSequence
     theMessage.set_messagetype(SmartMet::BroadcastMessage::SERVICE_DISCOVERY_REQUEST);
     theMessage.set_seqnum(theSequenceNumber);
 
+    // Announce the supported reply formats
+    theMessage.set_maxdatagramsize(boost::numeric_cast<std::uint32_t>(itsReceiveBuffer.size()));
+    theMessage.set_acceptdeflate(true);
+    theMessage.set_acceptprefixcoding(true);
+
+    // Echo the known catalog versions. Forget backends which have not replied for
+    // several cycles so that the request does not grow indefinitely.
+
+    const auto now = std::chrono::steady_clock::now();
+    const auto expiry = std::chrono::milliseconds(
+        (std::max(itsHeartBeatInterval, itsMaxHeartBeatInterval) + itsHeartBeatTimeout) *
+        (itsMaxSkippedCycles + 2));
+
+    std::vector<std::uint64_t> tokens;
+    for (auto it = itsCatalogs.begin(); it != itsCatalogs.end();)
+    {
+      if (now - it->second.updated > expiry)
+        it = itsCatalogs.erase(it);
+      else
+      {
+        const auto& reply = *it->second.reply;
+        tokens.push_back(catalogId(reply.host().ip(), reply.host().port()) ^
+                         reply.catalogversion());
+        ++it;
+      }
+    }
+
+    // The routing objects of vanished backends are not needed either
+    for (auto it = itsBackendRecords.begin(); it != itsBackendRecords.end();)
+    {
+      if (now - it->second.updated > expiry)
+        it = itsBackendRecords.erase(it);
+      else
+        ++it;
+    }
+
+    // The request must fit the receive buffer of the backends, which is the same as ours.
+    // If not all tokens fit, the echoed backends rotate between the cycles so that each
+    // backend is echoed regularly. The others send full replies when not echoed.
+
+    const std::size_t used = theMessage.ByteSizeLong() + kKnownCatalogsOverhead;
+    const std::size_t capacity =
+        (itsReceiveBuffer.size() > used ? (itsReceiveBuffer.size() - used) / sizeof(std::uint64_t)
+                                        : 0);
+
+    std::size_t cut = 0;
+    if (tokens.size() <= capacity)
+    {
+      for (const auto& token : tokens)
+        theMessage.add_knowncatalogs(token);
+    }
+    else
+    {
+      cut = tokens.size() - capacity;
+      const std::size_t first = itsKnownCatalogOffset % tokens.size();
+      for (std::size_t i = 0; i < capacity; i++)
+        theMessage.add_knowncatalogs(tokens[(first + i) % tokens.size()]);
+      itsKnownCatalogOffset = first + capacity;
+    }
+
     // Serialize BroadcastMessage
     theMessage.SerializeToString(&theMessageBuffer);
 
 #ifdef MYDEBUG
     std::cout << "Sending request " << theSequenceNumber << '\n';
 #endif
+
+    return cut;
   }
   catch (...)
   {
@@ -43,23 +199,58 @@ void Engine::sendDiscoveryRequest(std::string& theMessageBuffer, int theSequence
   }
 }
 
-// Backend
-void Engine::sendDiscoveryReply(std::string& theMessageBuffer, int theSequenceNumber)
+// Frontend
+void Engine::sendConnectionGossip(std::string& theMessageBuffer)
 {
   if (Spine::Reactor::isShuttingDown())
     return;
 
   try
   {
-    static unsigned corenum = boost::thread::hardware_concurrency();
+    SmartMet::BroadcastMessage message;
+
+    message.set_name(itsHostname);
+    message.set_messagetype(SmartMet::BroadcastMessage::FRONTEND_GOSSIP);
+    message.set_seqnum(boost::numeric_cast<int>(itsFrontendSequence));
+    message.set_frontendid(itsFrontendId);
+
+    // Only the local counts are sent, idle backends are omitted
+    auto connections = itsReactor->getBackendRequestStatus();
+    for (const auto& host : connections)
+      for (const auto& port : host.second)
+      {
+        if (port.second <= 0)
+          continue;
+        auto* item = message.add_connections();
+        item->set_name(host.first);
+        item->set_port(port.first);
+        item->set_count(port.second);
+      }
 
+    message.SerializeToString(&theMessageBuffer);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// Backend
+void Engine::sendDiscoveryReply(std::string& theMessageBuffer,
+                                const SmartMet::BroadcastMessage& theRequest)
+{
+  if (Spine::Reactor::isShuttingDown())
+    return;
+
+  try
+  {
     // Create a Service message
     SmartMet::BroadcastMessage message;
 
     // Message header
     message.set_name(itsHostname);
     message.set_messagetype(SmartMet::BroadcastMessage::SERVICE_DISCOVERY_REPLY);
-    message.set_seqnum(theSequenceNumber);
+    message.set_seqnum(theRequest.seqnum());
 
     // The Server
     auto* host = message.mutable_host();
@@ -70,21 +261,14 @@ void Engine::sendDiscoveryReply(std::string& theMessageBuffer, int theSequenceNu
       return;
     }
 
-    // Get the system load average
-    double currentLoad = 0;
-    getloadavg(&currentLoad, 1);
-
     // Report the per-core load average
-    currentLoad /= corenum;
-
     host->set_ip(itsHttpAddress);
     host->set_port(boost::numeric_cast<int32_t>(itsHttpPort));
     host->set_comment(itsComment);
-    host->set_load(boost::numeric_cast<float>(currentLoad));
+    host->set_load(perCoreLoad());
     host->set_throttle(boost::numeric_cast<int32_t>(itsThrottleLimit));
 
     // The Services
-    SmartMet::BroadcastMessage::Service* theService = nullptr;
 
     // Better not call the reactor if shutdown is in progress
     if (Spine::Reactor::isShuttingDown())
@@ -92,6 +276,37 @@ void Engine::sendDiscoveryReply(std::string& theMessageBuffer, int theSequenceNu
 
     auto theHandlers = itsReactor->getURIMap();
 
+    std::vector<bool> prefixes;
+    prefixes.reserve(theHandlers.size());
+    for (const auto& handler : theHandlers)
+      prefixes.push_back(itsReactor->isURIPrefix(handler.first));
+
+    // Add info queries (admin request names)
+    if (Spine::Reactor::isShuttingDown())
+      return;
+
+    auto infoRequestNames = itsReactor->getAdminRequestNames();
+
+    const auto version = catalogVersion(theHandlers, prefixes, infoRequestNames);
+    message.set_catalogversion(version);
+
+    // Omit the catalog if the frontend already knows it
+
+    const auto token = catalogId(itsHttpAddress, boost::numeric_cast<int>(itsHttpPort)) ^ version;
+    const auto& knownCatalogs = theRequest.knowncatalogs();
+    if (std::find(knownCatalogs.begin(), knownCatalogs.end(), token) != knownCatalogs.end())
+    {
+      message.SerializeToString(&theMessageBuffer);
+      return;
+    }
+
+    SmartMet::BroadcastMessage::Service* theService = nullptr;
+
+    // With prefix coding only the part differing from the previous (sorted) URI is sent
+    const bool prefixCoding = theRequest.acceptprefixcoding();
+    const std::string* previous = nullptr;
+
+    std::size_t i = 0;
     for (const auto& handler : theHandlers)
     {
       theService = message.add_services();
@@ -101,18 +316,30 @@ void Engine::sendDiscoveryReply(std::string& theMessageBuffer, int theSequenceNu
       }
       else
       {
-        theService->set_uri(handler.first);
+        const std::string& uri = handler.first;
+        std::size_t shared = 0;
+        if (prefixCoding && previous != nullptr)
+        {
+          const std::size_t n = std::min(uri.size(), previous->size());
+          while (shared < n && uri[shared] == (*previous)[shared])
+            ++shared;
+        }
+
+        if (shared > 0)
+        {
+          theService->set_uri(uri.substr(shared));
+          theService->set_sharedprefix(boost::numeric_cast<std::uint32_t>(shared));
+        }
+        else
+          theService->set_uri(uri);
         theService->set_lastupdate(0);
         theService->set_allowcache(false);
-        theService->set_is_prefix(itsReactor->isURIPrefix(handler.first));
+        theService->set_is_prefix(prefixes[i]);
+        previous = &uri;
       }
+      ++i;
     }
 
-    // Add info queries (admin request names)
-    if (Spine::Reactor::isShuttingDown())
-      return;
-
-    auto infoRequestNames = itsReactor->getAdminRequestNames();
     for (const auto& name : infoRequestNames)
     {
       auto* infoQuery = message.add_infoquery();
@@ -136,7 +363,121 @@ void Engine::sendDiscoveryReply(std::string& theMessageBuffer, int theSequenceNu
 }
 
 // Backend
-void Engine::processRequest(SmartMet::BroadcastMessage& theMessage, std::string& theResponseBuffer)
+std::uint64_t Engine::sendDiscoveryBeacon(std::string& theMessageBuffer)
+{
+  if (Spine::Reactor::isShuttingDown())
+    return 0;
+
+  try
+  {
+    SmartMet::BroadcastMessage message;
+
+    // Message header. Beacons are not replies to any particular request.
+    message.set_name(itsHostname);
+    message.set_messagetype(SmartMet::BroadcastMessage::SERVICE_DISCOVERY_BEACON);
+    message.set_seqnum(0);
+
+    auto* host = message.mutable_host();
+    host->set_ip(itsHttpAddress);
+    host->set_port(boost::numeric_cast<int32_t>(itsHttpPort));
+    host->set_comment(itsComment);
+    host->set_load(perCoreLoad());
+    host->set_throttle(boost::numeric_cast<int32_t>(itsThrottleLimit));
+    host->set_runnable(perCoreRunnable());
+
+    // The catalog version lets the frontends notice URI map changes immediately
+
+    if (Spine::Reactor::isShuttingDown())
+      return 0;
+
+    auto theHandlers = itsReactor->getURIMap();
+    std::vector<bool> prefixes;
+    prefixes.reserve(theHandlers.size());
+    for (const auto& handler : theHandlers)
+      prefixes.push_back(itsReactor->isURIPrefix(handler.first));
+
+    const auto version =
+        catalogVersion(theHandlers, prefixes, itsReactor->getAdminRequestNames());
+    message.set_catalogversion(version);
+
+    message.SerializeToString(&theMessageBuffer);
+    return version;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// Backend
+void Engine::packReply(const std::string& theReply,
+                       const SmartMet::BroadcastMessage& theRequest,
+                       std::vector<std::string>& theDatagrams)
+{
+  try
+  {
+    // Frontends which do not announce a datagram size get the reply as is
+    if (!theRequest.has_maxdatagramsize())
+    {
+      theDatagrams.push_back(theReply);
+      return;
+    }
+
+    const std::size_t maxSize =
+        std::min<std::size_t>(theRequest.maxdatagramsize(), itsMaxDatagramSize);
+
+    if (theReply.size() <= maxSize || maxSize <= kFragmentOverhead + itsHostname.size())
+    {
+      theDatagrams.push_back(theReply);
+      return;
+    }
+
+    std::string payload;
+    const bool deflated = (itsCompression && theRequest.acceptdeflate());
+    if (deflated)
+      payload = deflateString(theReply);
+
+    const std::string& data = (deflated ? payload : theReply);
+
+    const std::size_t chunkSize = maxSize - kFragmentOverhead - itsHostname.size();
+    const std::size_t count = (data.size() + chunkSize - 1) / chunkSize;
+
+    if (count > FragmentAssembler::MaxFragments)
+    {
+      std::cerr << Spine::log_time_str() << " Sputnik discovery reply of " << theReply.size()
+                << " bytes is too large to be fragmented\n";
+      return;
+    }
+
+    const unsigned int id = ++itsFragmentId;
+
+    for (std::size_t i = 0; i < count; i++)
+    {
+      SmartMet::BroadcastMessage message;
+      message.set_name(itsHostname);
+      message.set_messagetype(SmartMet::BroadcastMessage::SERVICE_DISCOVERY_REPLY);
+      message.set_seqnum(theRequest.seqnum());
+
+      auto* fragment = message.mutable_fragment();
+      fragment->set_id(id);
+      fragment->set_index(boost::numeric_cast<std::uint32_t>(i));
+      fragment->set_count(boost::numeric_cast<std::uint32_t>(count));
+      fragment->set_deflated(deflated);
+      fragment->set_payload(data.substr(i * chunkSize, chunkSize));
+
+      theDatagrams.emplace_back();
+      message.SerializeToString(&theDatagrams.back());
+    }
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// Backend
+void Engine::processRequest(SmartMet::BroadcastMessage& theMessage,
+                            std::vector<std::string>& theResponses)
 {
   if (Spine::Reactor::isShuttingDown())
     return;
@@ -146,10 +487,20 @@ void Engine::processRequest(SmartMet::BroadcastMessage& theMessage, std::string&
     switch (theMessage.messagetype())
     {
       case BroadcastMessage::SERVICE_DISCOVERY_REQUEST:
-        sendDiscoveryReply(theResponseBuffer, theMessage.seqnum());
+      {
+        // Frontends which have probed us recently receive beacons
+        if (itsBeaconInterval > 0)
+          itsBeaconTargets[itsRemoteEnd] = std::chrono::steady_clock::now();
+
+        std::string reply;
+        sendDiscoveryReply(reply, theMessage);
+        if (!reply.empty())
+          packReply(reply, theMessage, theResponses);
         break;
+      }
       case BroadcastMessage::SERVICE_DISCOVERY_REPLY:
       case BroadcastMessage::SERVICE_DISCOVERY_BEACON:
+      case BroadcastMessage::FRONTEND_GOSSIP:
         break;
     }
   }
@@ -159,6 +510,123 @@ void Engine::processRequest(SmartMet::BroadcastMessage& theMessage, std::string&
   }
 }
 
+// Frontend
+void Engine::processBeacon(const SmartMet::BroadcastMessage& theMessage)
+{
+  if (Spine::Reactor::isShuttingDown())
+    return;
+
+  try
+  {
+    if (theMessage.messagetype() != SmartMet::BroadcastMessage::SERVICE_DISCOVERY_BEACON ||
+        !theMessage.has_host())
+      return;
+
+    const auto& host = theMessage.host();
+
+    // A changed catalog must be requested in full during the next discovery cycle
+    if (theMessage.has_catalogversion())
+    {
+      auto pos = itsCatalogs.find(host.ip() + ":" + std::to_string(host.port()));
+      if (pos != itsCatalogs.end() &&
+          pos->second.reply->catalogversion() != theMessage.catalogversion())
+        itsCatalogs.erase(pos);
+    }
+
+    // The runnable task count reacts to load changes faster than the load average
+    const float load = std::max(host.load(), host.runnable());
+
+    // The throttle sentinel is not reset, beacons say nothing about hanging HTTP requests
+    if (itsServices.updateBackendLoad(theMessage.name(), host.port(), load))
+      itsServices.signalBackendLife(theMessage.name(), host.port());
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// Frontend
+void Engine::processGossip(const SmartMet::BroadcastMessage& theMessage)
+{
+  if (Spine::Reactor::isShuttingDown())
+    return;
+
+  try
+  {
+    // Only the configured peers are trusted, anyone else could skew every forwarder
+    if (std::find(itsGossipEndpoints.begin(), itsGossipEndpoints.end(), itsRemoteEnd) ==
+        itsGossipEndpoints.end())
+      return;
+
+    // Ignore our own messages in case this frontend is listed as a peer too. The socket is
+    // bound to a wildcard address, so the sender address cannot tell.
+    if (theMessage.frontendid() == itsFrontendId)
+      return;
+
+    PeerConnections::Counts counts;
+    for (const auto& item : theMessage.connections())
+      counts[item.name()][item.port()] += item.count();
+
+    const std::string peer =
+        itsRemoteEnd.address().to_string() + ":" + std::to_string(itsRemoteEnd.port());
+
+    itsServices.getPeerConnections().update(peer, std::move(counts));
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// Frontend
+void Engine::processFragment(const SmartMet::BroadcastMessage& theMessage)
+{
+  try
+  {
+    const auto& fragment = theMessage.fragment();
+
+    const std::string sender = theMessage.name() + "@" + itsRemoteEnd.address().to_string() + ":" +
+                               std::to_string(itsRemoteEnd.port());
+
+    auto payload = itsFragments.add(
+        sender, fragment.id(), fragment.index(), fragment.count(), fragment.payload());
+    if (!payload)
+      return;
+
+    // A corrupt or oversized payload is dropped like an unparseable one
+    if (fragment.deflated())
+    {
+      try
+      {
+        *payload = inflateString(*payload, kMaxReplySize);
+      }
+      catch (const std::exception& e)
+      {
+        std::cerr << Spine::log_time_str() << " Sputnik failed to inflate a fragmented reply from "
+                  << theMessage.name() << ": " << e.what() << '\n';
+        itsCycleStats.parseFailure();
+        return;
+      }
+    }
+
+    SmartMet::BroadcastMessage message;
+    if (!message.ParseFromString(*payload))
+    {
+      std::cerr << Spine::log_time_str() << " Sputnik failed to parse a fragmented reply from "
+                << theMessage.name() << '\n';
+      itsCycleStats.parseFailure();
+      return;
+    }
+
+    processReply(message);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
 // Frontend
 void Engine::processReply(SmartMet::BroadcastMessage& theMessage)
 {
@@ -174,73 +642,223 @@ void Engine::processReply(SmartMet::BroadcastMessage& theMessage)
       return;
     }
 
+    // Replies to earlier sequences would be pruned immediately
+    if (theMessage.seqnum() != boost::numeric_cast<int>(itsFrontendSequence))
+      return;
+
     // Check that the required messages are present
-    if (!theMessage.has_host() || theMessage.services_size() == 0)
+    if (!theMessage.has_host() ||
+        (theMessage.services_size() == 0 && !theMessage.has_catalogversion()))
     {
       // Packet didn't contain the required SERVICE_DISCOVERY_REPLY fields
       return;
     }
 
-    // Create a new backend
     const auto& host = theMessage.host();
-    BackendServerPtr theServer(
-        new BackendServer(theMessage.name(),
-                          host.ip(),
-                          host.port(),
-                          host.comment(),
-                          host.load(),
-                          boost::numeric_cast<unsigned int>(host.throttle())));
+    SPUTNIK_PROBE4(reply_parsed,
+                   theMessage.name().c_str(),
+                   host.port(),
+                   theMessage.seqnum(),
+                   theMessage.services_size());
+
+    if (itsCycleStats.enabled())
+      itsCycleStats.reply(
+          itsRemoteEnd.address().to_string() + ":" + std::to_string(itsRemoteEnd.port()),
+          !itsReplyWindowOpen);
+
+    // A backend may be reached via several listener addresses. Only the first accepted
+    // reply to a sequence is used, the others would distort the round trip statistics.
+    const std::string backendName = theMessage.name() + ":" + std::to_string(host.port());
+    if (itsRespondents.count(backendName) > 0)
+      return;
+
+    const double rtt = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() -
+                                                                 itsSequenceStart)
+                           .count();
+
+    // Decode prefix coded URIs
+    const std::string* previous = nullptr;
+    for (auto& service : *theMessage.mutable_services())
+    {
+      if (service.has_sharedprefix())
+      {
+        if (previous != nullptr)
+        {
+          const auto shared = std::min<std::size_t>(service.sharedprefix(), previous->size());
+          service.set_uri(previous->substr(0, shared) + service.uri());
+        }
+        service.clear_sharedprefix();
+      }
+      previous = &service.uri();
+    }
+
+    // The message which lists the services of the backend
+    const SmartMet::BroadcastMessage* services = &theMessage;
+
+    if (theMessage.has_catalogversion())
+    {
+      const std::string backendId = host.ip() + ":" + std::to_string(host.port());
+      auto& catalog = itsCatalogs[backendId];
+
+      if (theMessage.services_size() > 0)
+      {
+        // Full reply, remember it for the following cycles
+        catalog.reply = std::make_shared<SmartMet::BroadcastMessage>(theMessage);
+      }
+      else if (catalog.reply && catalog.reply->catalogversion() == theMessage.catalogversion())
+      {
+        // Unchanged catalog, take the services from the cached reply
+        services = catalog.reply.get();
+      }
+      else
+      {
+        // Unknown catalog version. The next request will not echo any version
+        // for this backend and a full reply will follow.
+        itsCatalogs.erase(backendId);
+        return;
+      }
+      catalog.updated = std::chrono::steady_clock::now();
+    }
+
+    // The reply is accepted. An abbreviated reply with an unknown catalog version returned
+    // above, so the full reply to the next probe of this sequence is not taken as a duplicate.
+    itsRespondents.insert(backendName);
+    itsRoundTrips.add(backendName, rtt);
+    itsServices.getMetrics().roundTrip(backendName, rtt);
+    itsCycleStats.roundTrip(backendName, rtt);
+
+    addReply(theMessage, *services);
+
+    // Replies arriving after the deadline are applied at once instead of waiting a full cycle
+    if (!itsReplyWindowOpen)
+      itsServices.commit(theMessage.seqnum(), false);
+
+    // We have received a valid response, increment the counter
+    ++itsReceivedResponses;
+
+    // Discovery replies are the periodic heartbeats of the failure detector. Beacons only
+    // refresh the backend, their rate depends on the load of the backend.
+    itsServices.heartbeat(theMessage.name(), host.port());
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Test whether a backend record was made from the given catalog
+ *
+ * The last update times are not compared, they are updated in place.
+ */
+// ----------------------------------------------------------------------
+
+bool Engine::BackendRecord::matches(const SmartMet::BroadcastMessage& theMessage,
+                                    const SmartMet::BroadcastMessage& theCatalog) const
+{
+  const auto& host = theMessage.host();
+  if (server->IP() != host.ip() || server->Comment() != host.comment())
+    return false;
+
+  if (services.size() != static_cast<std::size_t>(theCatalog.services_size()) ||
+      infoRequests.size() != static_cast<std::size_t>(theCatalog.infoquery_size()))
+    return false;
+
+  for (std::size_t i = 0; i < services.size(); i++)
+  {
+    const auto& service = theCatalog.services(static_cast<int>(i));
+    const bool is_prefix = service.has_is_prefix() && service.is_prefix();
+    if (services[i]->URI() != service.uri() || services[i]->DefinesPrefix() != is_prefix)
+      return false;
+  }
+
+  for (std::size_t i = 0; i < infoRequests.size(); i++)
+    if (infoRequests[i]->Name() != theCatalog.infoquery(static_cast<int>(i)).name())
+      return false;
+
+  return true;
+}
+
+// Frontend
+void Engine::addReply(const SmartMet::BroadcastMessage& theMessage,
+                      const SmartMet::BroadcastMessage& theCatalog)
+{
+  try
+  {
+    const auto& host = theMessage.host();
+    const auto throttle = boost::numeric_cast<unsigned int>(host.throttle());
+    const int seqnum = theMessage.seqnum();
+
 #ifdef MYDEBUG
     std::cout << "Processing reply " << theMessage.seqnum() << " from " << theMessage.name()
               << '\n';
 #endif
 
-    for (int i = 0; i < theMessage.services_size(); i++)
-    {
-      const auto& service = theMessage.services(i);
-      const bool is_prefix = service.has_is_prefix() && service.is_prefix();
-      BackendServicePtr theService = std::make_shared<BackendService>(theServer,
-                                                                      service.uri(),
-                                                                      service.lastupdate(),
-                                                                      service.allowcache(),
-                                                                      theMessage.seqnum(),
-                                                                      is_prefix);
+    auto& record = itsBackendRecords[theMessage.name() + ":" + std::to_string(host.port())];
+    record.updated = std::chrono::steady_clock::now();
 
-      // Add this BackendService to the list of Services
-      itsServices.addService(theService,
-                             service.uri(),
-                             host.load(),
-                             boost::numeric_cast<unsigned int>(host.throttle()));
+    if (record.server && record.matches(theMessage, theCatalog))
+    {
+      // Unchanged catalog, the routed objects are updated in place
+      record.server->update(host.load(), throttle);
 
-      // Generate a unique URI to allow using only this particular host.
-      std::string itsDirectURI;
-      itsDirectURI = "/";
-      itsDirectURI += theMessage.name();
-      itsDirectURI += service.uri();
+      for (std::size_t i = 0; i < record.services.size(); i++)
+      {
+        const auto& service = theCatalog.services(static_cast<int>(i));
+        record.services[i]->setLastUpdate(service.lastupdate());
+        record.services[i]->setAllowCache(service.allowcache());
+        record.services[i]->setSequenceNumber(seqnum);
+      }
 
-      // Add per-host service URI
-      itsServices.addService(theService,
-                             itsDirectURI,
-                             host.load(),
-                             boost::numeric_cast<unsigned int>(host.throttle()));
+      for (std::size_t i = 0; i < record.infoRequests.size(); i++)
+      {
+        const auto& infoQuery = theCatalog.infoquery(static_cast<int>(i));
+        record.infoRequests[i]->setLastUpdate(infoQuery.lastupdate());
+        record.infoRequests[i]->setSequenceNumber(seqnum);
+      }
     }
-
-    // Process info queries
-    for (int i = 0; i < theMessage.infoquery_size(); i++)
+    else
     {
-      const auto& infoQuery = theMessage.infoquery(i);
-      BackendInfoRequestPtr theInfoRequest = std::make_shared<BackendInfoRequest>(
-          theServer,
-          infoQuery.name(),
-          infoQuery.lastupdate(),
-          theMessage.seqnum());
+      // Create a new backend unless only the catalog changed
+      if (record.server && record.server->IP() == host.ip() &&
+          record.server->Comment() == host.comment())
+        record.server->update(host.load(), throttle);
+      else
+        record.server = std::make_shared<BackendServer>(
+            theMessage.name(), host.ip(), host.port(), host.comment(), host.load(), throttle);
 
-      // Add this BackendInfoRequest to the list of info requests
-      itsServices.addBackendInfoRequest(theInfoRequest);
+      record.services.clear();
+      record.infoRequests.clear();
+
+      for (int i = 0; i < theCatalog.services_size(); i++)
+      {
+        const auto& service = theCatalog.services(i);
+        const bool is_prefix = service.has_is_prefix() && service.is_prefix();
+        record.services.push_back(std::make_shared<BackendService>(record.server,
+                                                                   service.uri(),
+                                                                   service.lastupdate(),
+                                                                   service.allowcache(),
+                                                                   seqnum,
+                                                                   is_prefix));
+      }
+
+      // Process info queries
+      for (int i = 0; i < theCatalog.infoquery_size(); i++)
+      {
+        const auto& infoQuery = theCatalog.infoquery(i);
+        record.infoRequests.push_back(std::make_shared<BackendInfoRequest>(
+            record.server, infoQuery.name(), infoQuery.lastupdate(), seqnum));
+      }
     }
 
-    // We have received a valid response, increment the counter
-    ++itsReceivedResponses;
+    // Stage the services, the routing table is updated when the cycle is committed.
+    // Requests for /hostname/uri are resolved with the host index of Services.
+    for (const auto& service : record.services)
+      itsServices.stageService(service);
+
+    for (const auto& request : record.infoRequests)
+      itsServices.stageInfoRequest(request);
   }
   catch (...)
   {
@@ -0,0 +1,73 @@
+#include "PeerConnections.h"
+#include <macgyver/Exception.h>
+
+namespace SmartMet
+{
+void PeerConnections::update(const std::string& thePeer, Counts theCounts)
+{
+  try
+  {
+    SmartMet::Spine::WriteLock lock(itsMutex);
+    itsPeers[thePeer] = std::make_pair(std::chrono::steady_clock::now(), std::move(theCounts));
+    rebuild();
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void PeerConnections::expire(std::chrono::milliseconds theMaxAge)
+{
+  try
+  {
+    const auto now = std::chrono::steady_clock::now();
+
+    SmartMet::Spine::WriteLock lock(itsMutex);
+
+    bool changed = false;
+    for (auto it = itsPeers.begin(); it != itsPeers.end();)
+    {
+      if (now - it->second.first > theMaxAge)
+      {
+        it = itsPeers.erase(it);
+        changed = true;
+      }
+      else
+        ++it;
+    }
+
+    if (changed)
+      rebuild();
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+std::shared_ptr<const PeerConnections::Counts> PeerConnections::totals() const
+{
+  SmartMet::Spine::ReadLock lock(itsMutex);
+  return itsTotals;
+}
+
+// Called with the write lock held
+void PeerConnections::rebuild()
+{
+  if (itsPeers.empty())
+  {
+    itsTotals.reset();
+    return;
+  }
+
+  auto counts = std::make_shared<Counts>();
+  for (const auto& peer : itsPeers)
+    for (const auto& host : peer.second.second)
+      for (const auto& port : host.second)
+        (*counts)[host.first][port.first] += port.second;
+
+  itsTotals = counts;
+}
+
+}  // namespace SmartMet
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <spine/Thread.h>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+
+namespace SmartMet
+{
+/*! \brief Active backend connection counts reported by the other frontends
+ *
+ * Frontends gossip their in-flight request counts to each other so that the
+ * connection based forwarders can balance on the cluster wide estimate instead
+ * of the local counts only.
+ *
+ * Updates are made by the IO thread, the totals are read by the forwarders.
+ */
+
+class PeerConnections
+{
+ public:
+  /// Connection counts by backend name and port
+  using Counts = std::map<std::string, std::map<int, int>>;
+
+  PeerConnections() = default;
+  ~PeerConnections() = default;
+
+  PeerConnections(const PeerConnections& other) = delete;
+  PeerConnections& operator=(const PeerConnections& other) = delete;
+  PeerConnections(PeerConnections&& other) = delete;
+  PeerConnections& operator=(PeerConnections&& other) = delete;
+
+  /*! \brief Replace the counts reported by a peer */
+  void update(const std::string& thePeer, Counts theCounts);
+
+  /*! \brief Forget peers which have not reported within the given time */
+  void expire(std::chrono::milliseconds theMaxAge);
+
+  /*! \brief Counts summed over all peers, or null if there are none */
+  std::shared_ptr<const Counts> totals() const;
+
+  /*! \brief Add the peer counts to the local connection counts */
+  template <typename T>
+  void addTo(T& theConnections) const
+  {
+    auto counts = totals();
+    if (!counts)
+      return;
+    for (const auto& host : *counts)
+      for (const auto& port : host.second)
+        theConnections[host.first][port.first] += port.second;
+  }
+
+ private:
+  void rebuild();
+
+  mutable SmartMet::Spine::MutexType itsMutex;
+
+  std::map<std::string, std::pair<std::chrono::steady_clock::time_point, Counts>> itsPeers;
+
+  std::shared_ptr<const Counts> itsTotals;
+};
+
+}  // namespace SmartMet
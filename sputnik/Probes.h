@@ -0,0 +1,44 @@
+#pragma once
+
+/*! \brief USDT tracepoints for perf, bpftrace and SystemTap
+ *
+ * The probes are compiled in when <sys/sdt.h> is available (systemtap-sdt-devel)
+ * unless SPUTNIK_NO_PROBES is defined. An unattached probe is a single nop
+ * instruction, and its arguments are only read from registers or memory when
+ * a tracer is attached. Arguments should hence be cheap to evaluate: integers
+ * and the c_str() of existing strings.
+ *
+ * List the probes with: perf list 'sdt_sputnik:*'  or  bpftrace -l 'usdt:sputnik.so:*'
+ *
+ * Probe                       Arguments
+ * get_service_entry           uri
+ * get_service_return          uri, backend host ("" if none), backend port
+ * forwarder_pick              prefix, chosen index, number of candidates
+ * redistribute_entry          forwarder type, number of backends
+ * redistribute_return         forwarder type, number of backends
+ * add_service                 backend host, backend port, uri
+ * remove_backend              backend host, backend port, uri ("" for all)
+ * discovery_send              sequence, number of listeners, request size
+ * reply_received              datagram size, sender port
+ * reply_parsed                backend host, backend port, sequence, number of services
+ * commit                      sequence, prune flag, service entries added, removed
+ */
+
+#if !defined(SPUTNIK_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define SPUTNIK_HAVE_PROBES 1
+#endif
+#endif
+
+#ifdef SPUTNIK_HAVE_PROBES
+#define SPUTNIK_PROBE1(name, a1) DTRACE_PROBE1(sputnik, name, a1)
+#define SPUTNIK_PROBE2(name, a1, a2) DTRACE_PROBE2(sputnik, name, a1, a2)
+#define SPUTNIK_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(sputnik, name, a1, a2, a3)
+#define SPUTNIK_PROBE4(name, a1, a2, a3, a4) DTRACE_PROBE4(sputnik, name, a1, a2, a3, a4)
+#else
+#define SPUTNIK_PROBE1(name, a1) ((void)0)
+#define SPUTNIK_PROBE2(name, a1, a2) ((void)0)
+#define SPUTNIK_PROBE3(name, a1, a2, a3) ((void)0)
+#define SPUTNIK_PROBE4(name, a1, a2, a3, a4) ((void)0)
+#endif
@@ -7,14 +7,16 @@ RandomForwarder::~RandomForwarder() = default;
 
 RandomForwarder::RandomForwarder() : BackendForwarder(0.0) {}
 
-std::size_t RandomForwarder::getBackend(Spine::Reactor& /* theReactor */,
+std::size_t RandomForwarder::getBackend(ReactorAccess& /* theReactor */,
                                         const Spine::HTTP::Request& /* theRequest */)
 {
   try
   {
-    SmartMet::Spine::WriteLock lock(itsMutex);
+    auto lock = this->lock();
     if (itsBackendInfos.empty())
       throw Fmi::Exception(BCP, "No backends available!");
+    if (itsWeighted)
+      return boost::numeric_cast<std::size_t>(itsDistribution(itsGenerator));
     auto maxnum = static_cast<int>(itsBackendInfos.size() - 1);
     boost::random::uniform_int_distribution<> dist{0, maxnum};
     return boost::numeric_cast<std::size_t>(dist(itsGenerator));
@@ -25,4 +27,53 @@ std::size_t RandomForwarder::getBackend(Spine::Reactor& /* theReactor */,
   }
 }
 
+void RandomForwarder::explainChoice(Connections& theConnections,
+                                    const Spine::HTTP::Request& theRequest,
+                                    Explanation& theExplanation) const
+{
+  try
+  {
+    if (itsWeighted)
+    {
+      BackendForwarder::explainChoice(theConnections, theRequest, theExplanation);
+      return;
+    }
+
+    const auto n = itsBackendInfos.size();
+    for (auto& candidate : theExplanation.candidates)
+      candidate.probability = 1.0 / static_cast<double>(n);
+
+    auto generator = itsGenerator;
+    boost::random::uniform_int_distribution<> dist{0, static_cast<int>(n - 1)};
+    theExplanation.chosen = boost::numeric_cast<std::size_t>(dist(generator));
+    theExplanation.method = "uniform random choice";
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void RandomForwarder::redistribute(ReactorAccess& /* theReactor */)
+{
+  try
+  {
+    // The distribution is needed only when some backend is suspected
+    if (!itsWeighted)
+      return;
+
+    std::vector<float> probVec;
+    probVec.reserve(itsBackendInfos.size());
+    for (const auto& info : itsBackendInfos)
+      probVec.push_back(info.weight);
+
+    boost::random::discrete_distribution<> theDistribution(probVec);
+    itsDistribution = theDistribution;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
 }  // namespace SmartMet
@@ -10,7 +10,8 @@ namespace SmartMet
 {
 /*! \brief Random forwarder
  *
- * Old style random sampling forwarder.
+ * Old style random sampling forwarder. Suspected backends are
+ * sampled less often according to their weight.
  */
 
 class RandomForwarder : public BackendForwarder
@@ -24,8 +25,14 @@ class RandomForwarder : public BackendForwarder
   RandomForwarder(RandomForwarder&& other) = delete;
   RandomForwarder& operator=(RandomForwarder&& other) = delete;
 
-  std::size_t getBackend(Spine::Reactor& theReactor,
+  std::size_t getBackend(ReactorAccess& theReactor,
                          const Spine::HTTP::Request& theRequest) override;
+
+ private:
+  void redistribute(ReactorAccess& theReactor) override;
+  void explainChoice(Connections& theConnections,
+                     const Spine::HTTP::Request& theRequest,
+                     Explanation& theExplanation) const override;
 };
 
 using BackendForwarderPtr = std::shared_ptr<BackendForwarder>;
@@ -0,0 +1,38 @@
+#include "ReactorAccess.h"
+
+namespace SmartMet
+{
+ReactorAccess::~ReactorAccess() = default;
+
+ReactorAccess::Connections SpineReactorAccess::getBackendRequestStatus() const
+{
+  return itsReactor.getBackendRequestStatus();
+}
+
+ReactorAccess::URIMap SpineReactorAccess::getURIMap() const
+{
+  return itsReactor.getURIMap();
+}
+
+bool SpineReactorAccess::isURIPrefix(const std::string& theURI) const
+{
+  return itsReactor.isURIPrefix(theURI);
+}
+
+ReactorAccess::AdminRequestNames SpineReactorAccess::getAdminRequestNames() const
+{
+  return itsReactor.getAdminRequestNames();
+}
+
+bool SpineReactorAccess::isLoadHigh() const
+{
+  return itsReactor.isLoadHigh();
+}
+
+bool SpineReactorAccess::addBackendConnectionFinishedHook(const std::string& theName,
+                                                          ConnectionFinishedHook theHook)
+{
+  return itsReactor.addBackendConnectionFinishedHook(theName, std::move(theHook));
+}
+
+}  // namespace SmartMet
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <spine/HTTP.h>
+#include <spine/Reactor.h>
+#include <functional>
+#include <string>
+#include <utility>
+
+namespace SmartMet
+{
+/*! \brief The Reactor services used by the engine
+ *
+ * Services, the forwarders and the discovery code reach the server only
+ * through this interface. The engine wraps the server's Spine::Reactor in
+ * SpineReactorAccess, standalone programs may supply an implementation of
+ * their own.
+ */
+
+class ReactorAccess
+{
+ public:
+  /// Active connections by backend host name and port
+  using Connections = decltype(std::declval<const Spine::Reactor&>().getBackendRequestStatus());
+
+  /// Registered content handlers by URI
+  using URIMap = decltype(std::declval<const Spine::Reactor&>().getURIMap());
+
+  /// Names of the admin requests
+  using AdminRequestNames = decltype(std::declval<const Spine::Reactor&>().getAdminRequestNames());
+
+  /// Called with the backend host name and port when a backend connection finishes
+  using ConnectionFinishedHook = std::function<void(
+      const std::string&, int, Spine::HTTP::ContentStreamer::StreamerStatus)>;
+
+  ReactorAccess() = default;
+  virtual ~ReactorAccess();
+
+  ReactorAccess(const ReactorAccess& other) = delete;
+  ReactorAccess& operator=(const ReactorAccess& other) = delete;
+  ReactorAccess(ReactorAccess&& other) = delete;
+  ReactorAccess& operator=(ReactorAccess&& other) = delete;
+
+  virtual Connections getBackendRequestStatus() const = 0;
+  virtual URIMap getURIMap() const = 0;
+  virtual bool isURIPrefix(const std::string& theURI) const = 0;
+  virtual AdminRequestNames getAdminRequestNames() const = 0;
+  virtual bool isLoadHigh() const = 0;
+
+  /*! \brief Add a named hook, returns false if the name is already in use */
+  virtual bool addBackendConnectionFinishedHook(const std::string& theName,
+                                                ConnectionFinishedHook theHook) = 0;
+};
+
+/*! \brief Access to the Spine::Reactor of the server */
+
+class SpineReactorAccess : public ReactorAccess
+{
+ public:
+  explicit SpineReactorAccess(Spine::Reactor& theReactor) : itsReactor(theReactor) {}
+
+  Connections getBackendRequestStatus() const override;
+  URIMap getURIMap() const override;
+  bool isURIPrefix(const std::string& theURI) const override;
+  AdminRequestNames getAdminRequestNames() const override;
+  bool isLoadHigh() const override;
+  bool addBackendConnectionFinishedHook(const std::string& theName,
+                                        ConnectionFinishedHook theHook) override;
+
+ private:
+  Spine::Reactor& itsReactor;
+};
+
+}  // namespace SmartMet
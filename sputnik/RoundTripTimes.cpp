@@ -0,0 +1,89 @@
+#include "RoundTripTimes.h"
+#include <macgyver/Exception.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace SmartMet
+{
+namespace
+{
+// Number of samples kept per backend
+constexpr std::size_t kSamplesPerBackend = 16;
+}  // namespace
+
+void RoundTripTimes::add(const std::string& theBackend, double theMilliseconds)
+{
+  try
+  {
+    auto& samples = itsSamples[theBackend];
+    samples.values.push_back(theMilliseconds);
+    if (samples.values.size() > kSamplesPerBackend)
+      samples.values.pop_front();
+    samples.updated = Clock::now();
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void RoundTripTimes::expire(Clock::time_point theOldest)
+{
+  for (auto it = itsSamples.begin(); it != itsSamples.end();)
+  {
+    if (it->second.updated < theOldest)
+      it = itsSamples.erase(it);
+    else
+      ++it;
+  }
+}
+
+double RoundTripTimes::percentile(double theFraction) const
+{
+  try
+  {
+    std::vector<double> values;
+    for (const auto& item : itsSamples)
+      values.insert(values.end(), item.second.values.begin(), item.second.values.end());
+
+    if (values.empty())
+      return 0;
+
+    const auto rank = static_cast<std::size_t>(
+        std::ceil(std::clamp(theFraction, 0.0, 1.0) * static_cast<double>(values.size())));
+    const auto index = std::max<std::size_t>(rank, 1) - 1;
+    const auto pos = values.begin() + static_cast<std::ptrdiff_t>(index);
+    std::nth_element(values.begin(), pos, values.end());
+    return *pos;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+std::size_t RoundTripTimes::size() const
+{
+  std::size_t count = 0;
+  for (const auto& item : itsSamples)
+    count += item.second.values.size();
+  return count;
+}
+
+std::map<std::string, std::vector<double>> RoundTripTimes::values() const
+{
+  try
+  {
+    std::map<std::string, std::vector<double>> ret;
+    for (const auto& item : itsSamples)
+      ret[item.first].assign(item.second.values.begin(), item.second.values.end());
+    return ret;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+}  // namespace SmartMet
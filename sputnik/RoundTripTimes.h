@@ -0,0 +1,57 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace SmartMet
+{
+/*! \brief Recent discovery round trip times of the backends
+ *
+ * Each backend keeps its latest samples so that one chatty backend cannot hide
+ * the slow ones. Percentiles are calculated over the samples of all backends.
+ *
+ * The statistics are used only from the IO thread and are hence not thread safe.
+ */
+
+class RoundTripTimes
+{
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  RoundTripTimes() = default;
+  ~RoundTripTimes() = default;
+
+  RoundTripTimes(const RoundTripTimes& other) = delete;
+  RoundTripTimes& operator=(const RoundTripTimes& other) = delete;
+  RoundTripTimes(RoundTripTimes&& other) = delete;
+  RoundTripTimes& operator=(RoundTripTimes&& other) = delete;
+
+  /*! \brief Add a round trip time sample in milliseconds */
+  void add(const std::string& theBackend, double theMilliseconds);
+
+  /*! \brief Forget backends which have not replied since the given time */
+  void expire(Clock::time_point theOldest);
+
+  /*! \brief Percentile (0...1) of the samples in milliseconds, 0 if there are none */
+  double percentile(double theFraction) const;
+
+  /*! \brief Number of samples */
+  std::size_t size() const;
+
+  /*! \brief The samples of each backend */
+  std::map<std::string, std::vector<double>> values() const;
+
+ private:
+  struct Samples
+  {
+    std::deque<double> values;
+    Clock::time_point updated;
+  };
+
+  std::map<std::string, Samples> itsSamples;
+};
+
+}  // namespace SmartMet
@@ -0,0 +1,324 @@
+#include "RoutingTrace.h"
+#include <macgyver/Exception.h>
+#include <smartmet/macgyver/StringConversion.h>
+#include <smartmet/spine/Table.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <iomanip>
+#include <iterator>
+#include <sstream>
+
+namespace SmartMet
+{
+namespace
+{
+const char* const ModeNames[] = {"random",
+                                 "inverseload",
+                                 "inverseconnections",
+                                 "leastconnections",
+                                 "doublerandom",
+                                 "exponentialconnections",
+                                 "sticky"};
+
+std::atomic<std::uint64_t> nextTraceId{1};
+
+// Per thread sampling state and the ring of the trace it was registered to
+struct ThreadState
+{
+  std::uint64_t trace = 0;
+  void* ring = nullptr;
+  std::uint32_t countdown = 0;
+  std::uint32_t random = 0;
+};
+
+thread_local ThreadState threadState;
+
+template <std::size_t N>
+void copy(std::array<char, N>& theTarget, const std::string& theSource)
+{
+  const auto n = std::min(theSource.size(), N - 1);
+  std::memcpy(theTarget.data(), theSource.data(), n);
+  theTarget[n] = '\0';
+}
+
+std::string formatTime(std::int64_t theTime)
+{
+  const auto seconds = static_cast<std::time_t>(theTime / 1000000000);
+  std::tm tm{};
+  gmtime_r(&seconds, &tm);
+
+  std::ostringstream out;
+  out << std::put_time(&tm, "%Y-%m-%dT%H:%M:%S") << '.' << std::setfill('0') << std::setw(6)
+      << (theTime % 1000000000) / 1000 << 'Z';
+  return out.str();
+}
+
+std::string formatCandidates(const RoutingTrace::Record& theRecord)
+{
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(3);
+  const auto n = std::min<std::size_t>(theRecord.candidates, RoutingTrace::kMaxCandidates);
+  for (std::size_t i = 0; i < n; i++)
+  {
+    const auto& c = theRecord.candidate[i];
+    if (i > 0)
+      out << ' ';
+    out << c.id.data() << " p=" << c.probability << " load=" << c.load;
+    if (c.weight < 1.0F)
+      out << " w=" << c.weight;
+  }
+  if (theRecord.candidates > n)
+    out << " ... (" << theRecord.candidates << " total)";
+  return out.str();
+}
+
+}  // namespace
+
+/*! \brief Ring buffer written by a single thread
+ *
+ * The sequence counter of a slot is odd while the slot is being written.
+ */
+
+class RoutingTrace::Ring
+{
+ public:
+  Ring(std::size_t theSize, std::uint32_t theNumber) : itsSlots(theSize), itsNumber(theNumber) {}
+
+  Record& begin()
+  {
+    auto& slot = itsSlots[itsNext];
+    const auto seq = slot.seq.load(std::memory_order_relaxed);
+    slot.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.record.thread = itsNumber;
+    return slot.record;
+  }
+
+  void end()
+  {
+    auto& slot = itsSlots[itsNext];
+    slot.seq.store(slot.seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    itsNext = (itsNext + 1) % itsSlots.size();
+  }
+
+  // Append the consistent records to the output
+  void read(std::vector<Record>& theRecords) const
+  {
+    for (const auto& slot : itsSlots)
+    {
+      const auto before = slot.seq.load(std::memory_order_acquire);
+      if (before == 0 || (before & 1) != 0)
+        continue;
+      Record copy = slot.record;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot.seq.load(std::memory_order_relaxed) == before)
+        theRecords.push_back(copy);
+    }
+  }
+
+ private:
+  struct Slot
+  {
+    std::atomic<std::uint64_t> seq{0};
+    Record record{};
+  };
+
+  std::vector<Slot> itsSlots;
+  std::size_t itsNext = 0;
+  std::uint32_t itsNumber;
+};
+
+RoutingTrace::RoutingTrace() : itsId(nextTraceId++) {}
+
+RoutingTrace::~RoutingTrace() = default;
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Set the sampled fraction of decisions and the records kept per thread
+ *
+ * The ring size is fixed once the first record has been written.
+ */
+// ----------------------------------------------------------------------
+
+void RoutingTrace::configure(double theSampleRate, std::size_t theSize)
+{
+  try
+  {
+    if (theSampleRate < 0 || theSampleRate > 1)
+      throw Fmi::Exception(BCP, "Routing trace sample rate must be in the range 0...1");
+    if (theSize == 0)
+      throw Fmi::Exception(BCP, "Routing trace size must be positive");
+
+    std::lock_guard<std::mutex> lock(itsMutex);
+    if (itsRings.empty())
+      itsSize = theSize;
+
+    if (theSampleRate > 0)
+      itsPeriod = static_cast<std::uint32_t>(std::lround(std::min(1.0 / theSampleRate, 1e9)));
+    itsEnabled = (theSampleRate > 0);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Count down to the next sampled decision
+ *
+ * The gaps are drawn uniformly from 1...2*period-1 so that the samples do
+ * not lock onto periodic request patterns.
+ */
+// ----------------------------------------------------------------------
+
+bool RoutingTrace::countdown() noexcept
+{
+  auto& state = threadState;
+  if (state.countdown > 1)
+  {
+    --state.countdown;
+    return false;
+  }
+
+  if (state.random == 0)
+    state.random = static_cast<std::uint32_t>(
+        std::hash<const void*>()(&state) | 1U);  // Any nonzero seed will do
+
+  // xorshift32
+  state.random ^= state.random << 13;
+  state.random ^= state.random >> 17;
+  state.random ^= state.random << 5;
+
+  const auto period = itsPeriod.load(std::memory_order_relaxed);
+  const bool sampled = (state.countdown == 1);
+  state.countdown = 1 + state.random % (2 * period - 1);
+  return sampled || period == 1;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief The ring of the current thread, created on first use
+ */
+// ----------------------------------------------------------------------
+
+RoutingTrace::Ring& RoutingTrace::ring()
+{
+  auto& state = threadState;
+  if (state.trace != itsId)
+  {
+    std::lock_guard<std::mutex> lock(itsMutex);
+    auto ring = std::make_shared<Ring>(itsSize, static_cast<std::uint32_t>(itsRings.size()));
+    itsRings.push_back(ring);
+    state.trace = itsId;
+    state.ring = ring.get();
+  }
+  return *static_cast<Ring*>(state.ring);
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Record a routing decision
+ */
+// ----------------------------------------------------------------------
+
+void RoutingTrace::record(const std::string& theURI,
+                          const std::string& thePrefix,
+                          std::uint8_t theMode,
+                          const std::vector<BackendInfo>& theCandidates,
+                          const std::vector<double>& theProbabilities,
+                          std::size_t theChosen)
+{
+  try
+  {
+    auto& ring = this->ring();
+    auto& rec = ring.begin();
+
+    rec.time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::system_clock::now().time_since_epoch())
+                   .count();
+    rec.mode = theMode;
+    rec.candidates =
+        static_cast<std::uint16_t>(std::min<std::size_t>(theCandidates.size(), 0xffff));
+    rec.chosen = static_cast<std::uint16_t>(std::min<std::size_t>(theChosen, 0xffff));
+    copy(rec.uri, theURI);
+    copy(rec.prefix, thePrefix);
+
+    const auto n = std::min(theCandidates.size(), kMaxCandidates);
+    for (std::size_t i = 0; i < n; i++)
+    {
+      const auto& info = theCandidates[i];
+      auto& c = rec.candidate[i];
+      copy(c.id, info.hostName + ":" + Fmi::to_string(info.port));
+      c.load = info.load;
+      c.weight = info.weight;
+      c.probability =
+          static_cast<float>(i < theProbabilities.size() ? theProbabilities[i] : 0.0);
+    }
+
+    ring.end();
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief The most recent records of all threads, newest first
+ */
+// ----------------------------------------------------------------------
+
+std::unique_ptr<Spine::Table> RoutingTrace::table(std::size_t theCount) const
+{
+  try
+  {
+    std::vector<std::shared_ptr<Ring>> rings;
+    {
+      std::lock_guard<std::mutex> lock(itsMutex);
+      rings = itsRings;
+    }
+
+    std::vector<Record> records;
+    for (const auto& ring : rings)
+      ring->read(records);
+
+    const auto n = std::min(theCount, records.size());
+    std::partial_sort(records.begin(),
+                      records.begin() + static_cast<std::ptrdiff_t>(n),
+                      records.end(),
+                      [](const Record& a, const Record& b) { return a.time > b.time; });
+
+    auto ret = std::make_unique<Spine::Table>();
+    ret->setTitle(itsEnabled ? "Routing decisions" : "Routing decisions (tracing disabled)");
+    ret->setNames({"Time", "Thread", "URI", "Prefix", "Mode", "Chosen", "Candidates"});
+
+    for (std::size_t row = 0; row < n; row++)
+    {
+      const auto& rec = records[row];
+      ret->set(0, row, formatTime(rec.time));
+      ret->set(1, row, Fmi::to_string(static_cast<std::size_t>(rec.thread)));
+      ret->set(2, row, rec.uri.data());
+      ret->set(3, row, rec.prefix.data());
+      ret->set(4, row, rec.mode < std::size(ModeNames) ? ModeNames[rec.mode] : "host");
+      if (rec.chosen < std::min<std::size_t>(rec.candidates, kMaxCandidates))
+        ret->set(5, row, rec.candidate[rec.chosen].id.data());
+      else
+        ret->set(5, row, "#" + Fmi::to_string(static_cast<std::size_t>(rec.chosen)));
+      ret->set(6, row, formatCandidates(rec));
+    }
+
+    return ret;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+}  // namespace SmartMet
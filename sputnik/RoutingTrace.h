@@ -0,0 +1,103 @@
+#pragma once
+
+#include "BackendInfo.h"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace SmartMet
+{
+namespace Spine
+{
+class Table;
+}
+
+/*! \brief Sampled trace of routing decisions
+ *
+ * Each thread writes the sampled decisions into a ring buffer of its own,
+ * so recording takes no locks. A reader copies the records guarded by a
+ * per-record sequence counter and skips the ones being overwritten.
+ *
+ * Tracing is disabled by default, in which case sample() costs a single
+ * branch.
+ */
+
+class RoutingTrace
+{
+ public:
+  static constexpr std::size_t kMaxCandidates = 16;
+  static constexpr std::uint8_t kHostDirected = 255;  // Mode of /hostname/uri requests
+
+  struct Candidate
+  {
+    std::array<char, 48> id;  // host:port
+    float load;
+    float weight;
+    float probability;
+  };
+
+  struct Record
+  {
+    std::int64_t time;         // Nanoseconds since the epoch
+    std::uint32_t thread;      // Ring buffer number
+    std::uint16_t candidates;  // Number of candidates, only kMaxCandidates are stored
+    std::uint16_t chosen;      // Index of the chosen candidate
+    std::uint8_t mode;         // Services::ForwardingMode or kHostDirected
+    std::array<char, 128> uri;
+    std::array<char, 64> prefix;
+    std::array<Candidate, kMaxCandidates> candidate;
+  };
+
+  RoutingTrace();
+  ~RoutingTrace();
+
+  RoutingTrace(const RoutingTrace& other) = delete;
+  RoutingTrace& operator=(const RoutingTrace& other) = delete;
+  RoutingTrace(RoutingTrace&& other) = delete;
+  RoutingTrace& operator=(RoutingTrace&& other) = delete;
+
+  /*! \brief Set the sampled fraction of decisions and the records kept per thread
+   *
+   * A zero rate disables tracing.
+   */
+
+  void configure(double theSampleRate, std::size_t theSize);
+
+  // True if the current decision should be recorded
+  bool sample() noexcept
+  {
+    if (!itsEnabled.load(std::memory_order_relaxed))
+      return false;
+    return countdown();
+  }
+
+  void record(const std::string& theURI,
+              const std::string& thePrefix,
+              std::uint8_t theMode,
+              const std::vector<BackendInfo>& theCandidates,
+              const std::vector<double>& theProbabilities,
+              std::size_t theChosen);
+
+  // The most recent records of all threads, newest first
+  std::unique_ptr<Spine::Table> table(std::size_t theCount) const;
+
+ private:
+  class Ring;
+
+  bool countdown() noexcept;
+  Ring& ring();
+
+  std::atomic<bool> itsEnabled{false};
+  std::atomic<std::uint32_t> itsPeriod{100};  // Mean number of decisions per sample
+  std::size_t itsSize = 256;
+  std::uint64_t itsId;  // Identifies the thread local state of this trace
+
+  mutable std::mutex itsMutex;  // This guards the ring list
+  std::vector<std::shared_ptr<Ring>> itsRings;
+};
+
+}  // namespace SmartMet
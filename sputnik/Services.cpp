@@ -1,4 +1,5 @@
 #include "Services.h"
+#include "Probes.h"
 #include "DoubleRandomForwarder.h"
 #include "ExponentialConnectionsForwarder.h"
 #include "InverseConnectionsForwarder.h"
@@ -12,34 +13,152 @@
 #include <macgyver/Exception.h>
 #include <smartmet/macgyver/StringConversion.h>
 #include <smartmet/spine/Table.h>
+#include <algorithm>
 #include <csignal>
 #include <iostream>
 #include <list>
 #include <map>
 #include <sstream>
 #include <string>
+#include <string_view>
 
 using namespace std::string_literals;
 
 namespace SmartMet
 {
+namespace
+{
+const char* modeName(Services::ForwardingMode theMode)
+{
+  switch (theMode)
+  {
+    case Services::Random:
+      return "random";
+    case Services::InverseLoad:
+      return "inverseload";
+    case Services::InverseConnections:
+      return "inverseconnections";
+    case Services::LeastConnections:
+      return "leastconnections";
+    case Services::DoubleRandom:
+      return "doublerandom";
+    case Services::ExponentialConnections:
+      return "exponentialconnections";
+    case Services::Sticky:
+      return "sticky";
+  }
+  return "unknown";
+}
+
+// The staged objects are sorted by URI or request name and then by address, so that the
+// objects of a key form a range in which the routed objects can be found by address
+
+const std::string& stagedKey(const BackendServicePtr& theService)
+{
+  return theService->URI();
+}
+
+const std::string& stagedKey(const BackendInfoRequestPtr& theRequest)
+{
+  return theRequest->Name();
+}
+
+struct StagedLess
+{
+  template <typename T>
+  bool operator()(const T& theFirst, const T& theSecond) const
+  {
+    const int cmp = stagedKey(theFirst).compare(stagedKey(theSecond));
+    return (cmp != 0 ? cmp < 0 : theFirst < theSecond);
+  }
+
+  template <typename T>
+  bool operator()(const T& theObject, const std::string& theKey) const
+  {
+    return stagedKey(theObject) < theKey;
+  }
+
+  template <typename T>
+  bool operator()(const std::string& theKey, const T& theObject) const
+  {
+    return theKey < stagedKey(theObject);
+  }
+};
+
+// The backends which replied are sorted by id
+struct IdLess
+{
+  bool operator()(const BackendServerPtr& theFirst, const BackendServerPtr& theSecond) const
+  {
+    return theFirst->Id() < theSecond->Id();
+  }
+  bool operator()(const BackendServerPtr& theBackend, const std::string& theId) const
+  {
+    return theBackend->Id() < theId;
+  }
+  bool operator()(const std::string& theId, const BackendServerPtr& theBackend) const
+  {
+    return theId < theBackend->Id();
+  }
+};
+
+}  // namespace
+
 BackendServicePtr Services::getService(const Spine::HTTP::Request& theRequest)
 {
   try
   {
+    Instrumentation::Timer timer(*itsInstrumentation, Instrumentation::GetService);
+
     const auto uri = theRequest.getResource();
+    SPUTNIK_PROBE1(get_service_entry, uri.c_str());
+
+    auto lock = readLock();
+    timer.mark();
 
-    SmartMet::Spine::ReadLock lock(itsMutex);
+    // Requests of the form /hostname/uri are forwarded to the named backend only. The rest of
+    // the URI is resolved normally and the backends serving it are filtered to the host.
+    const auto slash = uri.find('/', 1);
+    if (!uri.empty() && uri[0] == '/' && slash != std::string::npos)
+    {
+      const auto host = itsHostIndex.find(std::string_view(uri).substr(1, slash - 1));
+      if (host != itsHostIndex.end())
+      {
+        const auto pos = itsServicesByURI.find(itsPrefixMap(uri.substr(slash)));
+        auto theService =
+            (pos != itsServicesByURI.end()
+                 ? getHostService(*pos->second.first,
+                                  host->first,
+                                  itsHostRotation.fetch_add(1, std::memory_order_relaxed))
+                 : nullptr);
+        if (theService)
+        {
+          theService->select();
+          if (itsTrace.sample())
+            traceHostService(uri, theService);
+          SPUTNIK_PROBE3(get_service_return,
+                         uri.c_str(),
+                         theService->Backend()->Name().c_str(),
+                         theService->Backend()->Port());
+          return theService;
+        }
+      }
+    }
 
     // Check that URI map for server list
     const std::string uri_prefix = itsPrefixMap(uri);
+    timer.split(Instrumentation::PrefixLookup);
+
     auto pos = itsServicesByURI.find(uri_prefix);
+    timer.split(Instrumentation::MapLookup);
+
     if (pos == itsServicesByURI.end())
     {
       // Nothing for this URI found on the list. Return with error.
       std::cout << Fmi::SecondClock::local_time() << " Nothing known about URI requested by "
                 << theRequest.getClientIP() << " : " << uri_prefix << '\n';
 
+      SPUTNIK_PROBE3(get_service_return, uri.c_str(), "", 0);
       return {};
     }
 
@@ -53,6 +172,7 @@ BackendServicePtr Services::getService(const Spine::HTTP::Request& theRequest)
       std::cout << Fmi::SecondClock::local_time() << " Backend server list empty for URI " << uri
                 << '\n';
 
+      SPUTNIK_PROBE3(get_service_return, uri.c_str(), "", 0);
       return {};
     }
 
@@ -62,68 +182,1064 @@ BackendServicePtr Services::getService(const Spine::HTTP::Request& theRequest)
     auto backendRandPtr = pos->second.second;
     std::size_t rndServerSlot = backendRandPtr->getBackend(*itsReactor, theRequest);
     auto theService = theBackendList->at(rndServerSlot);
+    timer.split(Instrumentation::ForwarderPick);
+    theService->select();
+    SPUTNIK_PROBE3(forwarder_pick, uri_prefix.c_str(), rndServerSlot, theBackendList->size());
+
+    if (itsTrace.sample())
+      traceDecision(uri, uri_prefix, *backendRandPtr, rndServerSlot);
+
+#ifdef MYDEBUG
+    std::cout << "Broadcast forwarding to backend: " << theService->Backend()->Name() << '\n';
+#endif
+
+    SPUTNIK_PROBE3(get_service_return,
+                   uri.c_str(),
+                   theService->Backend()->Name().c_str(),
+                   theService->Backend()->Port());
+
+    return theService;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Explain how a request would be routed
+ *
+ * The request is resolved like in getService, but no counters, forwarder
+ * state or random generators are changed.
+ */
+// ----------------------------------------------------------------------
+
+std::unique_ptr<SmartMet::Spine::Table> Services::explain(
+    const Spine::HTTP::Request& theRequest) const
+{
+  try
+  {
+    const auto uri = theRequest.getResource();
+
+    auto ret = std::make_unique<SmartMet::Spine::Table>();
+    ret->setNames({"Backend",
+                   "Connections",
+                   "Load",
+                   "Weight",
+                   "Probability",
+                   "Score",
+                   "Note",
+                   "Chosen"});
+
+    auto lock = readLock();
+
+    const auto slash = uri.find('/', 1);
+    if (!uri.empty() && uri[0] == '/' && slash != std::string::npos)
+    {
+      const auto host = itsHostIndex.find(std::string_view(uri).substr(1, slash - 1));
+      if (host != itsHostIndex.end())
+      {
+        const auto host_prefix = itsPrefixMap(uri.substr(slash));
+        const auto pos = itsServicesByURI.find(host_prefix);
+        const auto chosen =
+            (pos != itsServicesByURI.end()
+                 ? getHostService(*pos->second.first,
+                                  host->first,
+                                  itsHostRotation.load(std::memory_order_relaxed))
+                 : nullptr);
+        if (chosen)
+        {
+          // The ports of the host serving the URI, taken in turn
+          ret->setTitle("Routing of " + uri + ": prefix " + host_prefix +
+                        ", forwarded to the named host, ports in turn");
+          std::size_t row = 0;
+          for (const auto& service : *pos->second.first)
+          {
+            const auto& backend = service->Backend();
+            if (backend->Name() != host->first)
+              continue;
+            ret->set(0, row, backend->Id());
+            ret->set(2, row, Fmi::to_string(backend->Load()));
+            ret->set(7, row, service == chosen ? "*" : "");
+            ++row;
+          }
+          return ret;
+        }
+      }
+    }
+
+    const auto uri_prefix = itsPrefixMap(uri);
+    auto pos = itsServicesByURI.find(uri_prefix);
+    if (pos == itsServicesByURI.end() || pos->second.first->empty())
+    {
+      ret->setTitle("Routing of " + uri + ": no backends for prefix " + uri_prefix);
+      return ret;
+    }
+
+    const auto explanation = pos->second.second->explain(*itsReactor, theRequest);
+
+    ret->setTitle("Routing of " + uri + ": prefix " + uri_prefix + ", " +
+                  modeName(itsFwdMode) + " forwarding, " + explanation.method);
+
+    std::size_t row = 0;
+    for (const auto& candidate : explanation.candidates)
+    {
+      ret->set(0, row, candidate.hostName + ":" + Fmi::to_string(candidate.port));
+      ret->set(1, row, Fmi::to_string(candidate.connections));
+      ret->set(2, row, Fmi::to_string(candidate.load));
+      ret->set(3, row, Fmi::to_string(candidate.weight));
+      if (candidate.probability >= 0)
+        ret->set(4, row, Fmi::to_string(candidate.probability));
+      ret->set(5, row, candidate.score);
+      ret->set(6, row, candidate.note);
+      ret->set(7, row, row == explanation.chosen ? "*" : "");
+      ++row;
+    }
+
+    return ret;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Record a sampled forwarding decision
+ */
+// ----------------------------------------------------------------------
+
+void Services::traceDecision(const std::string& theURI,
+                             const std::string& thePrefix,
+                             BackendForwarder& theForwarder,
+                             std::size_t theChosen)
+{
+  try
+  {
+    std::vector<BackendInfo> candidates;
+    std::vector<double> probabilities;
+    theForwarder.describe(candidates, probabilities);
+    itsTrace.record(theURI, thePrefix, itsFwdMode, candidates, probabilities, theChosen);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Record a sampled /hostname/uri request
+ */
+// ----------------------------------------------------------------------
+
+void Services::traceHostService(const std::string& theURI, const BackendServicePtr& theService)
+{
+  try
+  {
+    const auto& backend = theService->Backend();
+    const std::vector<BackendInfo> candidates{
+        BackendInfo(backend->Name(), backend->Port(), backend->Load())};
+    itsTrace.record(theURI, theService->URI(), RoutingTrace::kHostDirected, candidates, {1.0}, 0);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Select a service of a backend host from the services of an URI
+ *
+ * The services of the host, one per port, are counted and the one of the
+ * given turn is returned. Returns null if the host does not serve the URI.
+ */
+// ----------------------------------------------------------------------
+
+BackendServicePtr Services::getHostService(const BackendServiceList& theList,
+                                           std::string_view theHostName,
+                                           std::size_t theTurn)
+{
+  try
+  {
+    auto matches = [theHostName](const BackendServicePtr& theService)
+    { return theService->Backend()->Name() == theHostName; };
+
+    const auto count = static_cast<std::size_t>(
+        std::count_if(theList.begin(), theList.end(), matches));
+    if (count == 0)
+      return {};
+
+    std::size_t skip = theTurn % count;
+    for (const auto& service : theList)
+      if (matches(service) && skip-- == 0)
+        return service;
+
+    return {};
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Rebuild the host index after the service lists have changed
+ *
+ * Only the servers of each host are indexed. The caller must hold the
+ * write lock.
+ */
+// ----------------------------------------------------------------------
+
+void Services::indexHosts()
+{
+  try
+  {
+    itsHostIndex.clear();
+    for (const auto& theURIs : itsServicesByURI)
+    {
+      for (const auto& service : *theURIs.second.first)
+      {
+        const auto& backend = service->Backend();
+        auto& servers = itsHostIndex[backend->Name()];
+        if (std::none_of(servers.begin(),
+                         servers.end(),
+                         [&backend](const BackendServerPtr& theServer)
+                         { return theServer->Port() == backend->Port(); }))
+          servers.push_back(backend);
+      }
+    }
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+bool Services::removeBackend(const std::string& theHostname, int thePort, const std::string& theURI)
+{
+  try
+  {
+    SPUTNIK_PROBE3(remove_backend, theHostname.c_str(), thePort, theURI.c_str());
+
+    auto lock = writeLock();
+
+    bool ejected = false;
+    for (auto& theURIs : itsServicesByURI)
+    {
+      bool changed = false;
+      for (auto it = (*theURIs.second.first).begin(); it != (*theURIs.second.first).end();)
+      {
+        itsPrefixMap.removeBackend(theURI, *it);
+        if (((*it)->Backend()->Name() == theHostname && (*it)->Backend()->Port() == thePort) &&
+            (theURI.empty() || theURI == (*it)->URI()))
+        {
+// Temporarily retire the server from the service.
+#ifdef MYDEBUG
+          std::cout << Fmi::SecondClock::local_time() << " Removing backend "
+                    << (*it)->Backend()->Name() << " seq " << (*it)->SequenceNumber() << " URI "
+                    << (*it)->URI() << '\n';
+#endif
+          it = (*theURIs.second.first).erase(it);
+          changed = true;
+        }
+        else
+        {
+#ifdef MYDEBUG
+          std::cout << Fmi::SecondClock::local_time() << " Keeping backend "
+                    << (*it)->Backend()->Name() << " seq " << (*it)->SequenceNumber() << " URI "
+                    << (*it)->URI() << '\n';
+#endif
+          ++it;
+        }
+      }
+
+      // A pool forwarder may be shared with URIs which still have the backend
+      if (changed)
+      {
+        theURIs.second.second = poolForwarder(*theURIs.second.first);
+        ejected = true;
+      }
+    }
+
+    if (ejected)
+      itsMetrics.eject(theHostname + ":" + std::to_string(thePort));
+
+    // A backend removed entirely starts with a fresh detector if it returns
+    if (theURI.empty())
+    {
+      SmartMet::Spine::WriteLock detectorLock(itsDetectorMutex);
+      itsDetectors.erase(theHostname + ":" + std::to_string(thePort));
+    }
+
+    indexHosts();
+    prunePools();
+
+    // If there are no services left, something has gone wrong.
+    // Better exit and restart.
+
+    for (const auto& theURIs : itsServicesByURI)
+    {
+      if (!theURIs.second.first->empty())
+        return true;
+    }
+
+    std::cout << Fmi::SecondClock::local_time() << " No services left, performing a restart\n";
+    // Using exit might generate a coredump, and we want a fast restart
+    kill(getpid(), SIGKILL);
+
+    // a dummy return to avoid compiler warnings
+    return true;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+bool Services::queryBackendAlive(const std::string& theHostName, int thePort)
+{
+  try
+  {
+    auto lock = sentinelReadLock();
+
+    std::string sname = theHostName + ":" + std::to_string(thePort);
+    auto iter = itsSentinels.find(sname);
+    if (iter != itsSentinels.end())
+      return iter->second->getAlive();
+
+    // Unknown backend, this should not happen
+    return false;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void Services::setBackendAlive(const std::string& theHostName, int thePort)
+{
+  try
+  {
+    auto lock = sentinelReadLock();
+
+    std::string sname = theHostName + ":" + std::to_string(thePort);
+    auto iter = itsSentinels.find(sname);
+    if (iter != itsSentinels.end())
+    {
+#ifdef MYDEBUG
+      std::cout << Fmi::SecondClock::local_time() << " Setting backend " << sname << " alive\n";
+#endif
+      iter->second->setAlive();
+    }
+
+    SmartMet::Spine::ReadLock detectorLock(itsDetectorMutex);
+    auto pos = itsDetectors.find(sname);
+    if (pos != itsDetectors.end())
+      pos->second->alive();
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Record a sign of life which says nothing about the HTTP side
+ *
+ * Only the failure detector is informed. The throttle sentinel is reset by
+ * completed HTTP requests and discovery replies, a backend which keeps
+ * sending beacons while its requests hang must stay throttled.
+ */
+// ----------------------------------------------------------------------
+
+void Services::signalBackendLife(const std::string& theHostName, int thePort)
+{
+  try
+  {
+    SmartMet::Spine::ReadLock detectorLock(itsDetectorMutex);
+    auto pos = itsDetectors.find(theHostName + ":" + std::to_string(thePort));
+    if (pos != itsDetectors.end())
+      pos->second->alive();
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Configure the phi accrual failure detection
+ *
+ * A zero threshold disables the detection, backends are then removed as
+ * soon as they miss a discovery cycle.
+ */
+// ----------------------------------------------------------------------
+
+void Services::setFailureDetection(double thePhiThreshold,
+                                   double thePhiSuspect,
+                                   std::chrono::milliseconds theHeartbeatEstimate,
+                                   std::chrono::milliseconds theMinStdDev,
+                                   std::chrono::milliseconds theAcceptablePause)
+{
+  itsPhiThreshold = thePhiThreshold;
+  itsPhiSuspect = std::min(thePhiSuspect, thePhiThreshold);
+  itsHeartbeatEstimate = theHeartbeatEstimate;
+  itsMinStdDev = theMinStdDev;
+  itsAcceptablePause = theAcceptablePause;
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Record a periodic heartbeat (discovery reply or beacon) of a backend
+ */
+// ----------------------------------------------------------------------
+
+void Services::heartbeat(const std::string& theHostName, int thePort)
+{
+  try
+  {
+    // Detectors are kept only when they are used
+    if (itsPhiThreshold <= 0)
+      return;
+
+    const std::string sname = theHostName + ":" + std::to_string(thePort);
+
+    {
+      SmartMet::Spine::ReadLock lock(itsDetectorMutex);
+      auto pos = itsDetectors.find(sname);
+      if (pos != itsDetectors.end())
+      {
+        pos->second->heartbeat();
+        return;
+      }
+    }
+
+    SmartMet::Spine::WriteLock lock(itsDetectorMutex);
+    auto& detector = itsDetectors[sname];
+    if (!detector)
+      detector = std::make_shared<FailureDetector>(
+          itsHeartbeatEstimate, itsMinStdDev, itsAcceptablePause);
+    detector->heartbeat();
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Inform the failure detectors of a changed discovery cycle length
+ */
+// ----------------------------------------------------------------------
+
+void Services::setHeartbeatInterval(std::chrono::milliseconds theInterval)
+{
+  try
+  {
+    SmartMet::Spine::WriteLock lock(itsDetectorMutex);
+    itsHeartbeatEstimate = theInterval;
+    for (auto& item : itsDetectors)
+      item.second->expect(theInterval);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Return the highest suspicion level of the known backends
+ */
+// ----------------------------------------------------------------------
+
+double Services::maxSuspicion() const
+{
+  try
+  {
+    const auto now = std::chrono::steady_clock::now();
+    double ret = 0;
+    SmartMet::Spine::ReadLock lock(itsDetectorMutex);
+    for (const auto& item : itsDetectors)
+      ret = std::max(ret, item.second->phi(now));
+    return ret;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Return the suspicion level (phi) of a backend, 0 if unknown
+ */
+// ----------------------------------------------------------------------
+
+double Services::suspicion(const std::string& theHostName, int thePort) const
+{
+  try
+  {
+    SmartMet::Spine::ReadLock lock(itsDetectorMutex);
+    auto pos = itsDetectors.find(theHostName + ":" + std::to_string(thePort));
+    if (pos == itsDetectors.end())
+      return 0;
+    return pos->second->phi();
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Forwarding weight for a suspicion level
+ *
+ * The weight decreases linearly from 1 at the suspect level towards zero
+ * at the threshold.
+ */
+// ----------------------------------------------------------------------
+
+float Services::suspicionWeight(double thePhi) const
+{
+  if (thePhi <= itsPhiSuspect || itsPhiThreshold <= itsPhiSuspect)
+    return 1.0F;
+  return static_cast<float>(
+      std::max(0.05, 1 - (thePhi - itsPhiSuspect) / (itsPhiThreshold - itsPhiSuspect)));
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Down-weight suspected backends and remove failed ones
+ */
+// ----------------------------------------------------------------------
+
+void Services::updateSuspicion()
+{
+  try
+  {
+    if (itsPhiThreshold <= 0)
+      return;
+
+    const auto now = std::chrono::steady_clock::now();
+
+    std::map<std::string, double> phis;
+    {
+      SmartMet::Spine::ReadLock lock(itsDetectorMutex);
+      for (const auto& item : itsDetectors)
+        phis[item.first] = item.second->phi(now);
+    }
+
+    // Backends which return will get a fresh detector
+    {
+      SmartMet::Spine::WriteLock lock(itsDetectorMutex);
+      for (const auto& item : phis)
+        if (item.second >= itsPhiThreshold)
+          itsDetectors.erase(item.first);
+    }
+
+    std::set<std::string> failed;
+    {
+      auto lock = readLock();
+      std::set<const BackendForwarder*> visited;  // Pool forwarders are shared by several URIs
+      for (const auto& theURIs : itsServicesByURI)
+      {
+        if (!visited.insert(theURIs.second.second.get()).second)
+          continue;
+        for (const auto& service : *theURIs.second.first)
+        {
+          const auto& backend = service->Backend();
+          const std::string sname = backend->Name() + ":" + std::to_string(backend->Port());
+
+          auto pos = phis.find(sname);
+          const double phi = (pos == phis.end() ? 0.0 : pos->second);
+
+          if (phi >= itsPhiThreshold)
+            failed.insert(sname);
+          else
+            theURIs.second.second->setWeight(
+                backend->Name(), backend->Port(), suspicionWeight(phi), *itsReactor);
+        }
+      }
+    }
+
+    if (failed.empty())
+      return;
+
+    auto lock = writeLock();
+
+    for (auto& theURIs : itsServicesByURI)
+    {
+      bool changed = false;
+      for (auto it = (*theURIs.second.first).begin(); it != (*theURIs.second.first).end();)
+      {
+        const auto backend = (*it)->Backend();
+        if (failed.count(backend->Name() + ":" + std::to_string(backend->Port())) == 0)
+          ++it;
+        else
+        {
+          if ((*it)->DefinesPrefix())
+            itsPrefixMap.removeBackend(theURIs.first, *it);
+          it = (*theURIs.second.first).erase(it);
+          changed = true;
+        }
+      }
+
+      if (changed)
+        theURIs.second.second = poolForwarder(*theURIs.second.first);
+    }
+
+    indexHosts();
+    prunePools();
+
+    for (const auto& sname : failed)
+    {
+      itsMetrics.eject(sname);
+      std::cout << Fmi::SecondClock::local_time() << " Backend " << sname
+                << " removed by the failure detector\n";
+    }
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Update the load of a backend in all forwarders
+ *
+ * Returns false if the backend is not known.
+ */
+// ----------------------------------------------------------------------
+
+bool Services::updateBackendLoad(const std::string& theHostName, int thePort, float theLoad)
+{
+  try
+  {
+    // The forwarders are updated in place, the service map itself does not change
+    auto lock = readLock();
+
+    bool found = false;
+    std::set<const BackendForwarder*> visited;  // Pool forwarders are shared by several URIs
+    for (const auto& theURIs : itsServicesByURI)
+      if (visited.insert(theURIs.second.second.get()).second)
+        found |= theURIs.second.second->updateLoad(theHostName, thePort, theLoad, *itsReactor);
+
+    return found;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void Services::signalBackendConnection(const std::string& theHostName, int thePort)
+{
+  try
+  {
+    auto lock = sentinelReadLock();
+
+    std::string sname = theHostName + ":" + std::to_string(thePort);
+    auto iter = itsSentinels.find(sname);
+    if (iter != itsSentinels.end())
+    {
+      iter->second->signalSentConnection();
+#ifdef MYDEBUG
+      unsigned int count = iter->second->getCurrentThrottle();
+      std::cout << Fmi::SecondClock::local_time() << " Incremented backend " << sname
+                << " connections to " << count << '\n';
+#endif
+    }
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Stage a service from a discovery reply
+ *
+ * Staged services become visible only when the cycle is committed.
+ */
+// ----------------------------------------------------------------------
+
+void Services::stageService(const BackendServicePtr& theBackendService)
+{
+  try
+  {
+    if (!theBackendService)
+      return;
+
+    std::lock_guard<std::mutex> lock(itsStagingMutex);
+    itsStagedServices.push_back(theBackendService);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Stage an info request from a discovery reply
+ */
+// ----------------------------------------------------------------------
+
+void Services::stageInfoRequest(const BackendInfoRequestPtr& theRequest)
+{
+  try
+  {
+    if (!theRequest)
+      return;
+
+    std::lock_guard<std::mutex> lock(itsStagingMutex);
+    itsStagedInfoRequests.push_back(theRequest);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Apply the staged replies to the routing table in one pass
+ *
+ * Entries of backends which have replied are replaced by the staged ones.
+ * When pruning, entries of other sequences are dropped unless the failure
+ * detector still trusts the silent backend. Each changed URI gets a new
+ * service list and forwarder, which are swapped in under a single write lock
+ * so that readers never see a partially updated table.
+ *
+ * The changes are collected under an upgrade lock, which admits readers but
+ * excludes the other writers (removeBackend, updateSuspicion) until the swap
+ * is done. A backend removed meanwhile can hence not be restored by a commit
+ * computed from the table before the removal.
+ *
+ * Backends repeating an unchanged catalog stage the very same service
+ * objects that are already routed. Their URIs keep the existing lists and
+ * forwarders, only the loads are refreshed.
+ */
+// ----------------------------------------------------------------------
+
+void Services::commit(int theSequenceNumber, bool thePrune)
+{
+  try
+  {
+    std::lock_guard<std::mutex> stagingLock(itsStagingMutex);
+
+    if (itsStagedServices.empty() && itsStagedInfoRequests.empty() && !thePrune)
+      return;
+
+    // Backends which have replied. Their older entries are always obsolete.
+
+    itsReplied.clear();
+    for (const auto& service : itsStagedServices)
+      itsReplied.push_back(service->Backend());
+    for (const auto& request : itsStagedInfoRequests)
+      itsReplied.push_back(request->Backend());
+    std::sort(itsReplied.begin(), itsReplied.end(), IdLess());
+    itsReplied.erase(std::unique(itsReplied.begin(),
+                                 itsReplied.end(),
+                                 [](const BackendServerPtr& a, const BackendServerPtr& b)
+                                 { return a->Id() == b->Id(); }),
+                     itsReplied.end());
+
+    auto replied = [&](const std::string& theId)
+    { return std::binary_search(itsReplied.begin(), itsReplied.end(), theId, IdLess()); };
+
+    // Sorted in place for finding the staged objects which are already routed
+    std::sort(itsStagedServices.begin(), itsStagedServices.end(), StagedLess());
+    itsStagedServices.erase(std::unique(itsStagedServices.begin(), itsStagedServices.end()),
+                            itsStagedServices.end());
+    std::sort(itsStagedInfoRequests.begin(), itsStagedInfoRequests.end(), StagedLess());
+    itsStagedInfoRequests.erase(
+        std::unique(itsStagedInfoRequests.begin(), itsStagedInfoRequests.end()),
+        itsStagedInfoRequests.end());
+
+    // Silent backends are kept until the failure detector gives up on them
+
+    using StringRef = std::reference_wrapper<const std::string>;
+    using StringLess = std::less<const std::string>;
+
+    std::map<StringRef, double, StringLess> phis;
+    auto phi = [&](const std::shared_ptr<BackendServer>& theBackend)
+    {
+      auto pos = phis.find(theBackend->Id());
+      if (pos == phis.end())
+        pos = phis.insert({theBackend->Id(), suspicion(theBackend->Name(), theBackend->Port())})
+                  .first;
+      return pos->second;
+    };
+
+    auto keep = [&](const std::shared_ptr<BackendServer>& theBackend, int theSequence)
+    {
+      if (replied(theBackend->Id()))
+        return false;
+      if (!thePrune || theSequence == theSequenceNumber)
+        return true;
+      return (itsPhiThreshold > 0 && phi(theBackend) < itsPhiThreshold);
+    };
+
+    // Merge the live entries with the staged range of the same key. The result is allocated
+    // only if something changed. The marks flag the dropped live and the routed staged entries.
+    auto merge = [&](const auto& theLive,
+                     auto theFirst,
+                     auto theLast,
+                     auto& theResult,
+                     auto& theDropped,
+                     auto& theAdded)
+    {
+      const auto staged = static_cast<std::size_t>(theLast - theFirst);
+      itsLiveMarks.assign(theLive.size(), false);
+      itsStagedMarks.assign(staged, false);
+
+      std::size_t reused = 0;
+      for (std::size_t i = 0; i < theLive.size(); ++i)
+      {
+        const auto& entry = theLive[i];
+        const auto pos = std::lower_bound(theFirst, theLast, entry);
+        if (pos != theLast && *pos == entry)
+        {
+          itsStagedMarks[pos - theFirst] = true;
+          ++reused;
+        }
+        else if (!keep(entry->Backend(), entry->SequenceNumber()))
+        {
+          itsLiveMarks[i] = true;
+          theDropped.push_back(entry);
+        }
+      }
+
+      if (theDropped.empty() && reused == staged)
+        return false;
+
+      theResult = std::make_shared<std::decay_t<decltype(theLive)>>();
+      theResult->reserve(theLive.size() - theDropped.size() + staged - reused);
+      for (std::size_t i = 0; i < theLive.size(); ++i)
+        if (!itsLiveMarks[i])
+          theResult->push_back(theLive[i]);
+
+      for (std::size_t i = 0; i < staged; ++i)
+      {
+        if (!itsStagedMarks[i])
+        {
+          theResult->push_back(theFirst[i]);
+          theAdded.push_back(theFirst[i]);
+        }
+      }
+      return true;
+    };
+
+    struct Update
+    {
+      BackendServiceListPtr list;
+      BackendForwarderPtr forwarder;
+      std::string pool;
+      std::vector<BackendServicePtr> dropped;
+      std::vector<BackendServicePtr> added;
+    };
+
+    std::map<std::string, Update> updates;
+    std::map<std::string, BackendInfoRequestListPtr> requestUpdates;
+    std::set<BackendForwarderPtr> refresh;
+
+    // Collect the changes without blocking the readers
+    Spine::UpgradeReadLock upgradeLock(itsMutex);
+    for (const auto& theURIs : itsServicesByURI)
+    {
+      const auto staged = std::equal_range(
+          itsStagedServices.cbegin(), itsStagedServices.cend(), theURIs.first, StagedLess());
+
+      Update update;
+      if (!merge(*theURIs.second.first,
+                 staged.first,
+                 staged.second,
+                 update.list,
+                 update.dropped,
+                 update.added))
+      {
+        if (staged.first != staged.second)
+          refresh.insert(theURIs.second.second);
+        continue;
+      }
+
+      updates[theURIs.first] = std::move(update);
+    }
+
+    for (auto first = itsStagedServices.cbegin(); first != itsStagedServices.cend();)
+    {
+      const auto& uri = (*first)->URI();
+      const auto last = std::upper_bound(first, itsStagedServices.cend(), uri, StagedLess());
+      if (itsServicesByURI.find(uri) == itsServicesByURI.end())
+      {
+        auto& update = updates[uri];
+        update.list = std::make_shared<BackendServiceList>(first, last);
+        update.added.assign(first, last);
+      }
+      first = last;
+    }
+
+    BackendInfoRequestList droppedRequests;
+    BackendInfoRequestList addedRequests;
+    for (const auto& infoReqPair : itsBackendInfoRequests)
+    {
+      if (!infoReqPair.second)
+        continue;
+
+      const auto staged = std::equal_range(itsStagedInfoRequests.cbegin(),
+                                           itsStagedInfoRequests.cend(),
+                                           infoReqPair.first,
+                                           StagedLess());
+
+      BackendInfoRequestListPtr newlist;
+      droppedRequests.clear();
+      addedRequests.clear();
+      if (merge(*infoReqPair.second,
+                staged.first,
+                staged.second,
+                newlist,
+                droppedRequests,
+                addedRequests))
+        requestUpdates[infoReqPair.first] = newlist;
+    }
+
+    for (auto first = itsStagedInfoRequests.cbegin(); first != itsStagedInfoRequests.cend();)
+    {
+      const auto& name = (*first)->Name();
+      const auto last = std::upper_bound(first, itsStagedInfoRequests.cend(), name, StagedLess());
+      if (itsBackendInfoRequests.find(name) == itsBackendInfoRequests.end())
+        requestUpdates[name] = std::make_shared<BackendInfoRequestList>(first, last);
+      first = last;
+    }
+
+    // URIs with the same backends in the same order share a pool forwarder
+    for (auto& item : updates)
+    {
+      std::sort(item.second.list->begin(),
+                item.second.list->end(),
+                [](const BackendServicePtr& a, const BackendServicePtr& b)
+                { return a->Backend()->Id() < b->Backend()->Id(); });
+
+      item.second.pool = poolKey(*item.second.list);
+      auto pos = itsPools.find(item.second.pool);
+      if (pos != itsPools.end())
+      {
+        item.second.forwarder = pos->second;
+        refresh.insert(pos->second);
+      }
+    }
+
+    // Refresh the loads of the existing forwarders, each is distributed only once
+    if (!refresh.empty())
+    {
+      BackendForwarder::BackendLoads loads;
+      for (const auto& backend : itsReplied)
+        loads[backend->Name()][backend->Port()] = backend->Load();
+
+      for (const auto& forwarder : refresh)
+        forwarder->updateLoads(loads, *itsReactor);
+    }
+
+    // Build the new pool forwarders, each is distributed only once
+
+    std::map<std::string, BackendForwarderPtr> pools;
+    for (auto& item : updates)
+    {
+      if (item.second.forwarder)
+        continue;
+
+      auto& forwarder = pools[item.second.pool];
+      if (!forwarder)
+        forwarder = makeForwarder(*item.second.list);
+      item.second.forwarder = forwarder;
+    }
+
+    // Backends which disappeared without replying are counted as ejected
+
+    std::size_t added = 0;
+    std::size_t removed = 0;
+    std::set<std::string> ejected;
+    for (const auto& item : updates)
+    {
+      added += item.second.added.size();
+      removed += item.second.dropped.size();
+      for (const auto& service : item.second.dropped)
+        if (!replied(service->Backend()->Id()))
+          ejected.insert(service->Backend()->Id());
+    }
+
+    itsMetrics.churn(added, removed, thePrune);
+    SPUTNIK_PROBE4(commit, theSequenceNumber, thePrune ? 1 : 0, added, removed);
+    for (const auto& id : ejected)
+      itsMetrics.eject(id);
+
+    // Swap in the changes
+
+    auto lock = writeLock(upgradeLock);
+
+    for (auto& item : updates)
+    {
+      for (const auto& service : item.second.dropped)
+        if (service->DefinesPrefix())
+          itsPrefixMap.removeBackend(item.first, service);
+
+      for (const auto& service : item.second.added)
+        if (service->DefinesPrefix())
+          itsPrefixMap.addPrefix(item.first, service);
 
-#ifdef MYDEBUG
-    std::cout << "Broadcast forwarding to backend: " << theService->Backend()->Name() << '\n';
-#endif
+      itsServicesByURI[item.first] = std::make_pair(item.second.list, item.second.forwarder);
+    }
 
-    return theService;
-  }
-  catch (...)
-  {
-    throw Fmi::Exception::Trace(BCP, "Operation failed!");
-  }
-}
+    for (auto& item : requestUpdates)
+      itsBackendInfoRequests[item.first] = item.second;
 
-bool Services::removeBackend(const std::string& theHostname, int thePort, const std::string& theURI)
-{
-  try
-  {
-    SmartMet::Spine::WriteLock lock(itsMutex);
+    if (!updates.empty())
+    {
+      itsPools.insert(pools.begin(), pools.end());
+      indexHosts();
+      prunePools();
+    }
 
-    for (auto& theURIs : itsServicesByURI)
-      for (auto it = (*theURIs.second.first).begin(); it != (*theURIs.second.first).end();)
+    // Update the throttle limits. A discovery reply is a sign of life which resets the
+    // unanswered request count.
+    {
+      auto sentinelLock = sentinelWriteLock();
+      for (const auto& backend : itsReplied)
       {
-        itsPrefixMap.removeBackend(theURI, *it);
-        if (((*it)->Backend()->Name() == theHostname && (*it)->Backend()->Port() == thePort) &&
-            (theURI.empty() || theURI == (*it)->URI()))
-        {
-// Temporarily retire the server from the service.
-#ifdef MYDEBUG
-          std::cout << Fmi::SecondClock::local_time() << " Removing backend "
-                    << (*it)->Backend()->Name() << " seq " << (*it)->SequenceNumber() << " URI "
-                    << (*it)->URI() << '\n';
-#endif
-          theURIs.second.second->removeBackend(
-              (*it)->Backend()->Name(), (*it)->Backend()->Port(), *itsReactor);
-          it = (*theURIs.second.first).erase(it);
-        }
+        auto pos = itsSentinels.find(backend->Id());
+        if (pos == itsSentinels.end())
+          itsSentinels.insert(
+              {backend->Id(), std::make_shared<BackendSentinel>(backend->Throttle())});
         else
         {
-#ifdef MYDEBUG
-          std::cout << Fmi::SecondClock::local_time() << " Keeping backend "
-                    << (*it)->Backend()->Name() << " seq " << (*it)->SequenceNumber() << " URI "
-                    << (*it)->URI() << '\n';
-#endif
-          ++it;
+          pos->second->setThrottle(backend->Throttle());
+          pos->second->setAlive();
         }
       }
-
-    // If there are no services left, something has gone wrong.
-    // Better exit and restart.
-
-    for (const auto& theURIs : itsServicesByURI)
-    {
-      if (!theURIs.second.first->empty())
-        return true;
     }
 
-    std::cout << Fmi::SecondClock::local_time() << " No services left, performing a restart\n";
-    // Using exit might generate a coredump, and we want a fast restart
-    kill(getpid(), SIGKILL);
+#ifdef MYDEBUG
+    std::cout << Fmi::SecondClock::local_time() << " Committed sequence " << theSequenceNumber
+              << ": " << itsReplied.size() << " backends replied, " << updates.size()
+              << " URIs changed\n";
+#endif
 
-    // a dummy return to avoid compiler warnings
-    return true;
+    itsStagedServices.clear();
+    itsStagedInfoRequests.clear();
+    itsReplied.clear();
   }
   catch (...)
   {
@@ -131,19 +1247,48 @@ bool Services::removeBackend(const std::string& theHostname, int thePort, const
   }
 }
 
-bool Services::queryBackendAlive(const std::string& theHostName, int thePort)
+// ----------------------------------------------------------------------
+/*!
+ * \brief Make a new forwarder of the configured type
+ */
+// ----------------------------------------------------------------------
+
+BackendForwarderPtr Services::makeForwarder() const
 {
   try
   {
-    SmartMet::Spine::ReadLock lock(itsSentinelMutex);
-
-    std::string sname = theHostName + ":" + std::to_string(thePort);
-    auto iter = itsSentinels.find(sname);
-    if (iter != itsSentinels.end())
-      return iter->second->getAlive();
+    BackendForwarderPtr theForwarder;
+    switch (itsFwdMode)
+    {
+      case ForwardingMode::InverseLoad:
+        theForwarder = BackendForwarderPtr(new InverseLoadForwarder(itsBalancingCoefficient));
+        break;
+      case ForwardingMode::Random:
+        theForwarder = BackendForwarderPtr(new RandomForwarder);
+        break;
+      case ForwardingMode::DoubleRandom:
+        theForwarder = BackendForwarderPtr(new DoubleRandomForwarder);
+        break;
+      case ForwardingMode::LeastConnections:
+        theForwarder = BackendForwarderPtr(new LeastConnectionsForwarder);
+        break;
+      case ForwardingMode::InverseConnections:
+        theForwarder =
+            BackendForwarderPtr(new InverseConnectionsForwarder(itsBalancingCoefficient));
+        break;
+      case ForwardingMode::ExponentialConnections:
+        theForwarder =
+            BackendForwarderPtr(new ExponentialConnectionsForwarder(itsBalancingCoefficient));
+        break;
+      case ForwardingMode::Sticky:
+        theForwarder =
+            BackendForwarderPtr(new StickyForwarder(itsBalancingCoefficient, itsCookieName));
+        break;
+    }
 
-    // Unknown backend, this should not happen
-    return false;
+    theForwarder->setPeerConnections(itsPeerConnections);
+    theForwarder->setInstrumentation(itsInstrumentation, itsFwdMode);
+    return theForwarder;
   }
   catch (...)
   {
@@ -151,21 +1296,32 @@ bool Services::queryBackendAlive(const std::string& theHostName, int thePort)
   }
 }
 
-void Services::setBackendAlive(const std::string& theHostName, int thePort)
+// ----------------------------------------------------------------------
+/*!
+ * \brief Make a new forwarder for the backends of a service list
+ *
+ * The backends are in the order of the list, with their latest loads and the
+ * weights given by the failure detector.
+ */
+// ----------------------------------------------------------------------
+
+BackendForwarderPtr Services::makeForwarder(const BackendServiceList& theList) const
 {
   try
   {
-    SmartMet::Spine::ReadLock lock(itsSentinelMutex);
-
-    std::string sname = theHostName + ":" + std::to_string(thePort);
-    auto iter = itsSentinels.find(sname);
-    if (iter != itsSentinels.end())
+    std::vector<BackendInfo> infos;
+    infos.reserve(theList.size());
+    for (const auto& service : theList)
     {
-#ifdef MYDEBUG
-      std::cout << Fmi::SecondClock::local_time() << " Setting backend " << sname << " alive\n";
-#endif
-      iter->second->setAlive();
+      const auto backend = service->Backend();
+      infos.emplace_back(backend->Name(), backend->Port(), backend->Load());
+      if (itsPhiThreshold > 0)
+        infos.back().weight = suspicionWeight(suspicion(backend->Name(), backend->Port()));
     }
+
+    auto theForwarder = makeForwarder();
+    theForwarder->setBackends(infos, *itsReactor);
+    return theForwarder;
   }
   catch (...)
   {
@@ -173,23 +1329,42 @@ void Services::setBackendAlive(const std::string& theHostName, int thePort)
   }
 }
 
-void Services::signalBackendConnection(const std::string& theHostName, int thePort)
+// ----------------------------------------------------------------------
+/*!
+ * \brief Identify the pool of a service list
+ *
+ * A forwarder can be shared only by lists which have the same backends in
+ * the same order, since the forwarder returns an index to the list.
+ */
+// ----------------------------------------------------------------------
+
+std::string Services::poolKey(const BackendServiceList& theList)
 {
-  try
+  std::string key;
+  for (const auto& service : theList)
   {
-    SmartMet::Spine::ReadLock lock(itsSentinelMutex);
+    key += service->Backend()->Id();
+    key += ' ';
+  }
+  return key;
+}
 
-    std::string sname = theHostName + ":" + std::to_string(thePort);
-    auto iter = itsSentinels.find(sname);
-    if (iter != itsSentinels.end())
-    {
-      iter->second->signalSentConnection();
-#ifdef MYDEBUG
-      unsigned int count = iter->second->getCurrentThrottle();
-      std::cout << Fmi::SecondClock::local_time() << " Incremented backend " << sname
-                << " connections to " << count << '\n';
-#endif
-    }
+// ----------------------------------------------------------------------
+/*!
+ * \brief Return the pool forwarder of a service list, making it if necessary
+ *
+ * The caller must hold the write lock.
+ */
+// ----------------------------------------------------------------------
+
+BackendForwarderPtr Services::poolForwarder(const BackendServiceList& theList)
+{
+  try
+  {
+    auto& forwarder = itsPools[poolKey(theList)];
+    if (!forwarder)
+      forwarder = makeForwarder(theList);
+    return forwarder;
   }
   catch (...)
   {
@@ -197,79 +1372,29 @@ void Services::signalBackendConnection(const std::string& theHostName, int thePo
   }
 }
 
-// Delete all service information from the list whose
-// sequence number doesn't match the latest one.
-//
-// (This is used for timeouting unresponsive Broadcast requests.)
-bool Services::latestSequence(int itsSequenceNumber)
+// ----------------------------------------------------------------------
+/*!
+ * \brief Forget the pools which are no longer used by any URI
+ *
+ * The caller must hold the write lock.
+ */
+// ----------------------------------------------------------------------
+
+void Services::prunePools()
 {
   try
   {
-    SmartMet::Spine::WriteLock lock(itsMutex);
-
-#ifdef MYDEBUG
-    std::cout << "UPDATING TO SEQ " << itsSequenceNumber << '\n';
-#endif
-
-    // Clean up services
+    std::set<const BackendForwarder*> used;
     for (const auto& theURIs : itsServicesByURI)
-      for (auto it = (*theURIs.second.first).begin(); it != (*theURIs.second.first).end();)
-      {
-        if ((*it)->SequenceNumber() != itsSequenceNumber)
-        {
-// Temporarily retire the server from the service.
-#ifdef MYDEBUG
-          std::cout << Fmi::SecondClock::local_time() << "Removing sequence "
-                    << (*it)->SequenceNumber() << " backend " << (*it)->Backend()->Name() << " URI "
-                    << (*it)->URI() << '\n';
-#endif
-
-          // Remove this entry as it has unmatching sequence number
-          theURIs.second.second->removeBackend(
-              (*it)->Backend()->Name(), (*it)->Backend()->Port(), *itsReactor);
-          it = (*theURIs.second.first).erase(it);
-        }
-        else
-        {
-#ifdef MYDEBUG
-          std::cout << Fmi::SecondClock::local_time() << "  sequence " << (*it)->SequenceNumber()
-                    << " backend " << (*it)->Backend()->Name() << " URI " << (*it)->URI() << '\n';
-#endif
-          ++it;
-        }
-      }
+      used.insert(theURIs.second.second.get());
 
-    // Clean up info requests - remove entries from backends that didn't respond
-    for (auto& infoReqPair : itsBackendInfoRequests)
+    for (auto it = itsPools.begin(); it != itsPools.end();)
     {
-      auto& requestList = infoReqPair.second;
-      if (requestList)
-      {
-        for (auto it = requestList->begin(); it != requestList->end();)
-        {
-          if ((*it)->SequenceNumber() != itsSequenceNumber)
-          {
-#ifdef MYDEBUG
-            std::cout << Fmi::SecondClock::local_time() << "Removing info request sequence "
-                      << (*it)->SequenceNumber() << " backend " << (*it)->Backend()->Name()
-                      << " name " << (*it)->Name() << '\n';
-#endif
-            it = requestList->erase(it);
-          }
-          else
-          {
-#ifdef MYDEBUG
-            std::cout << Fmi::SecondClock::local_time() << "  info request sequence "
-                      << (*it)->SequenceNumber() << " backend " << (*it)->Backend()->Name()
-                      << " name " << (*it)->Name() << '\n';
-#endif
-            ++it;
-          }
-        }
-      }
+      if (used.count(it->second.get()) == 0)
+        it = itsPools.erase(it);
+      else
+        ++it;
     }
-
-    return true;
   }
   catch (...)
   {
@@ -296,7 +1421,14 @@ bool Services::addService(const BackendServicePtr& theBackendService,
               << theBackendService->SequenceNumber() << " URI " << theFrontendURI << '\n';
 #endif
 
-    SmartMet::Spine::WriteLock lock(itsMutex);
+    SPUTNIK_PROBE3(add_service,
+                   theBackendService->Backend()->Name().c_str(),
+                   theBackendService->Backend()->Port(),
+                   theFrontendURI.c_str());
+
+    theBackendService->Backend()->update(theLoad, theThrottle);
+
+    auto lock = writeLock();
 
     if (theBackendService->DefinesPrefix())
     {
@@ -306,12 +1438,10 @@ bool Services::addService(const BackendServicePtr& theBackendService,
     const auto pos = itsServicesByURI.find(theFrontendURI);
     if (pos != itsServicesByURI.end())
     {
-      // URI already known, take the URI's existing std::list
+      // URI already known, take the URI's existing std::list. The forwarder may be
+      // shared with other URIs and is not modified in place.
       pos->second.first->push_back(theBackendService);
-      pos->second.second->addBackend(theBackendService->Backend()->Name(),
-                                     theBackendService->Backend()->Port(),
-                                     theLoad,
-                                     *itsReactor);
+      pos->second.second = poolForwarder(*pos->second.first);
     }
     else
     {
@@ -319,45 +1449,14 @@ bool Services::addService(const BackendServicePtr& theBackendService,
       BackendServiceListPtr newlist(new BackendServiceList());
       newlist->push_back(theBackendService);
 
-      BackendForwarderPtr theForwarder;
-      switch (itsFwdMode)
-      {
-        case ForwardingMode::InverseLoad:
-          theForwarder = BackendForwarderPtr(new InverseLoadForwarder(itsBalancingCoefficient));
-          break;
-        case ForwardingMode::Random:
-          theForwarder = BackendForwarderPtr(new RandomForwarder);
-          break;
-        case ForwardingMode::DoubleRandom:
-          theForwarder = BackendForwarderPtr(new DoubleRandomForwarder);
-          break;
-        case ForwardingMode::LeastConnections:
-          theForwarder = BackendForwarderPtr(new LeastConnectionsForwarder);
-          break;
-        case ForwardingMode::InverseConnections:
-          theForwarder =
-              BackendForwarderPtr(new InverseConnectionsForwarder(itsBalancingCoefficient));
-          break;
-        case ForwardingMode::ExponentialConnections:
-          theForwarder =
-              BackendForwarderPtr(new ExponentialConnectionsForwarder(itsBalancingCoefficient));
-          break;
-        case ForwardingMode::Sticky:
-          theForwarder =
-              BackendForwarderPtr(new StickyForwarder(itsBalancingCoefficient, itsCookieName));
-          break;
-      }
-
-      theForwarder->addBackend(theBackendService->Backend()->Name(),
-                               theBackendService->Backend()->Port(),
-                               theLoad,
-                               *itsReactor);
-
-      itsServicesByURI[theFrontendURI] = std::make_pair(newlist, theForwarder);
+      itsServicesByURI[theFrontendURI] = std::make_pair(newlist, poolForwarder(*newlist));
     }
 
+    indexHosts();
+    prunePools();
+
     // Update sentinel information for this backend
-    SmartMet::Spine::WriteLock sentinelLock(itsSentinelMutex);
+    auto sentinelLock = sentinelWriteLock();
 
     std::string sname = theBackendService->Backend()->Name() + ":" +
                         std::to_string(theBackendService->Backend()->Port());
@@ -369,9 +1468,8 @@ bool Services::addService(const BackendServicePtr& theBackendService,
     }
     else
     {
-      // Make a new sentinel, updating the throttle value
-      itsSentinels.erase(it);
-      itsSentinels.insert(std::make_pair(sname, std::make_shared<BackendSentinel>(theThrottle)));
+      // Update the throttle value, the unanswered request count is preserved
+      it->second->setThrottle(theThrottle);
     }
 
     return true;
@@ -393,7 +1491,7 @@ std::unique_ptr<SmartMet::Spine::Table> Services::backends(const std::string& se
 {
   try
   {
-    SmartMet::Spine::ReadLock lock(itsMutex);
+    auto lock = readLock();
 
     std::unique_ptr<SmartMet::Spine::Table> ret = std::make_unique<SmartMet::Spine::Table>();
 
@@ -441,6 +1539,42 @@ std::unique_ptr<SmartMet::Spine::Table> Services::backends(const std::string& se
   }
 }
 
+// ----------------------------------------------------------------------
+/*!
+ * \brief Latency statistics of the routing hot paths
+ */
+// ----------------------------------------------------------------------
+
+std::unique_ptr<SmartMet::Spine::Table> Services::latencies() const
+{
+  try
+  {
+    return itsInstrumentation->table();
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief The most recent sampled routing decisions
+ */
+// ----------------------------------------------------------------------
+
+std::unique_ptr<SmartMet::Spine::Table> Services::routingTrace(std::size_t count) const
+{
+  try
+  {
+    return itsTrace.table(count);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
 // ----------------------------------------------------------------------
 /*!
  * \brief Return list of backends with given service or all service
@@ -451,7 +1585,7 @@ Services::BackendList Services::getBackendList(const std::string& service) const
 {
   try
   {
-    SmartMet::Spine::ReadLock lock(itsMutex);
+    auto lock = readLock();
 
     std::string serviceuri = "/" + itsPrefixMap(service);
 
@@ -488,7 +1622,7 @@ Services::BackendList Services::getInfoRequestBackendList(const std::string& inf
 {
   try
   {
-    SmartMet::Spine::ReadLock lock(itsMutex);
+    auto lock = readLock();
 
     BackendList theList;
 
@@ -524,7 +1658,7 @@ void Services::status(std::ostream& out, bool full) const
 {
   try
   {
-    SmartMet::Spine::ReadLock lock(itsMutex);
+    auto lock = readLock();
 
     // Read the Backend information list
 
@@ -553,6 +1687,123 @@ void Services::status(std::ostream& out, bool full) const
   }
 }
 
+// ----------------------------------------------------------------------
+/*!
+ * \brief Write the routing counters in OpenMetrics text format
+ *
+ * The counters are copied under the read locks and formatted afterwards.
+ */
+// ----------------------------------------------------------------------
+
+void Services::metrics(std::ostream& out) const
+{
+  try
+  {
+    struct Selection
+    {
+      std::string backend;
+      std::string uri;
+      std::uint64_t count;
+    };
+
+    struct Backend
+    {
+      std::string name;
+      int port;
+      float load;
+      unsigned int throttle;
+      unsigned int unanswered = 0;
+      bool alive = true;
+    };
+
+    std::vector<Selection> selections;
+    std::map<std::string, Backend> backends;
+    {
+      auto lock = readLock();
+      for (const auto& uri : itsServicesByURI)
+      {
+        for (const auto& service : *uri.second.first)
+        {
+          const auto& server = service->Backend();
+          selections.push_back({server->Id(), uri.first, service->Selections()});
+          backends.insert(
+              {server->Id(),
+               Backend{server->Name(), server->Port(), server->Load(), server->Throttle()}});
+        }
+      }
+    }
+
+    {
+      auto lock = sentinelReadLock();
+      for (auto& item : backends)
+      {
+        auto pos = itsSentinels.find(item.first);
+        if (pos != itsSentinels.end())
+        {
+          item.second.unanswered = pos->second->getCurrentThrottle();
+          item.second.alive = pos->second->getAlive();
+        }
+      }
+    }
+
+    out << "# TYPE sputnik_backend_selections counter\n"
+           "# HELP sputnik_backend_selections Requests forwarded to the backend for the URI\n";
+    for (const auto& item : selections)
+      out << "sputnik_backend_selections_total{backend=\"" << BackendMetrics::label(item.backend)
+          << "\",uri=\"" << BackendMetrics::label(item.uri) << "\"} " << item.count << '\n';
+
+    out << "# TYPE sputnik_backend_load gauge\n"
+           "# HELP sputnik_backend_load Load reported by the backend\n";
+    for (const auto& item : backends)
+      out << "sputnik_backend_load{backend=\"" << BackendMetrics::label(item.first) << "\"} "
+          << item.second.load << '\n';
+
+    if (itsReactor != nullptr)
+    {
+      const auto connections = itsReactor->getBackendRequestStatus();
+      out << "# TYPE sputnik_backend_in_flight gauge\n"
+             "# HELP sputnik_backend_in_flight Requests in progress on the backend\n";
+      for (const auto& item : backends)
+      {
+        int count = 0;
+        const auto host = connections.find(item.second.name);
+        if (host != connections.end())
+        {
+          const auto port = host->second.find(item.second.port);
+          if (port != host->second.end())
+            count = port->second;
+        }
+        out << "sputnik_backend_in_flight{backend=\"" << BackendMetrics::label(item.first)
+            << "\"} " << count << '\n';
+      }
+    }
+
+    out << "# TYPE sputnik_backend_throttle_limit gauge\n"
+           "# HELP sputnik_backend_throttle_limit Unanswered requests allowed, 0 = unlimited\n";
+    for (const auto& item : backends)
+      out << "sputnik_backend_throttle_limit{backend=\"" << BackendMetrics::label(item.first)
+          << "\"} " << item.second.throttle << '\n';
+
+    out << "# TYPE sputnik_backend_unanswered gauge\n"
+           "# HELP sputnik_backend_unanswered Requests sent since the backend was last alive\n";
+    for (const auto& item : backends)
+      out << "sputnik_backend_unanswered{backend=\"" << BackendMetrics::label(item.first)
+          << "\"} " << item.second.unanswered << '\n';
+
+    out << "# TYPE sputnik_backend_throttled gauge\n"
+           "# HELP sputnik_backend_throttled 1 if the sentinel is holding requests back\n";
+    for (const auto& item : backends)
+      out << "sputnik_backend_throttled{backend=\"" << BackendMetrics::label(item.first)
+          << "\"} " << (item.second.alive ? 0 : 1) << '\n';
+
+    itsMetrics.write(out);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
 // ----------------------------------------------------------------------
 /*!
  * \brief Add backend info request
@@ -573,7 +1824,7 @@ bool Services::addBackendInfoRequest(const BackendInfoRequestPtr& theRequest)
               << theRequest->SequenceNumber() << " name " << theRequest->Name() << '\n';
 #endif
 
-    SmartMet::Spine::WriteLock lock(itsMutex);
+    auto lock = writeLock();
 
     const auto pos = itsBackendInfoRequests.find(theRequest->Name());
     if (pos != itsBackendInfoRequests.end())
@@ -607,7 +1858,7 @@ std::set<std::string> Services::getInfoRequestNames() const
 {
   try
   {
-    SmartMet::Spine::ReadLock lock(itsMutex);
+    auto lock = readLock();
 
     std::set<std::string> names;
     for (const auto& item : itsBackendInfoRequests)
@@ -659,9 +1910,74 @@ void Services::setForwarding(const std::string& theMode,
   }
 }
 
-void Services::setReactor(Spine::Reactor& theReactor)
+void Services::setReactor(ReactorAccess& theReactor)
 {
   itsReactor = &theReactor;
 }
 
+// ----------------------------------------------------------------------
+/*!
+ * \brief Estimate the memory used by the routing table
+ *
+ * Shared objects are counted once. Map nodes are assumed to carry four
+ * pointers of overhead and shared objects a control block of two pointers,
+ * which matches libstdc++. Forwarders are sized outside the routing lock.
+ */
+// ----------------------------------------------------------------------
+
+Services::MemoryUsage Services::memoryUsage() const
+{
+  try
+  {
+    const std::size_t node = 4 * sizeof(void*);
+    const std::size_t control = 2 * sizeof(void*);
+
+    MemoryUsage usage;
+    std::set<const void*> services;
+    std::set<const void*> servers;
+    std::set<BackendForwarderPtr> forwarders;
+    {
+      auto lock = readLock();
+      usage.uris = itsServicesByURI.size();
+      for (const auto& uri : itsServicesByURI)
+      {
+        const auto& list = *uri.second.first;
+        usage.entries += list.size();
+        usage.bytes += node + sizeof(ServiceURIMap::value_type) + uri.first.capacity() +
+                       control + sizeof(BackendServiceList) +
+                       list.capacity() * sizeof(BackendServicePtr);
+        forwarders.insert(uri.second.second);
+
+        for (const auto& service : list)
+        {
+          if (services.insert(service.get()).second)
+            usage.bytes += control + sizeof(BackendService) + service->URI().capacity();
+
+          const auto& server = service->Backend();
+          if (servers.insert(server.get()).second)
+            usage.bytes += control + sizeof(BackendServer) + server->Name().capacity() +
+                           server->IP().capacity() + server->Comment().capacity() +
+                           server->Id().capacity();
+        }
+      }
+
+      for (const auto& host : itsHostIndex)
+        usage.bytes += node + sizeof(host) + host.first.capacity() +
+                       host.second.capacity() * sizeof(BackendServerPtr);
+    }
+
+    usage.backends = servers.size();
+    usage.forwarders = forwarders.size();
+    for (const auto& forwarder : forwarders)
+      if (forwarder)
+        usage.bytes += control + forwarder->memoryUsage();
+
+    return usage;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
 }  // namespace SmartMet
@@ -2,18 +2,26 @@
 
 #include "BackendForwarder.h"
 #include "BackendInfoRequest.h"
+#include "BackendMetrics.h"
 #include "BackendSentinel.h"
 #include "BackendServer.h"
 #include "BackendService.h"
+#include "FailureDetector.h"
+#include "Instrumentation.h"
+#include "PeerConnections.h"
+#include "ReactorAccess.h"
+#include "RoutingTrace.h"
 #include "URIPrefixMap.h"
 #include <boost/thread.hpp>
 #include <boost/tuple/tuple.hpp>
-#include <spine/Reactor.h>
 #include <spine/Thread.h>
+#include <chrono>
 #include <iostream>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <set>
+#include <string_view>
 #include <vector>
 
 namespace SmartMet
@@ -31,7 +39,7 @@ class Services
 {
  private:
   mutable SmartMet::Spine::MutexType itsMutex;
-  Spine::Reactor* itsReactor = nullptr;
+  ReactorAccess* itsReactor = nullptr;
 
  public:
   using BackendServiceList = std::vector<BackendServicePtr>;
@@ -43,6 +51,17 @@ class Services
       std::map<std::string, std::pair<BackendServiceListPtr, BackendForwarderPtr>>;
   using BackendInfoRequestMap =
       std::map<std::string, BackendInfoRequestListPtr>;
+  using DetectorMap = std::map<std::string, std::shared_ptr<FailureDetector>>;
+
+  // Approximate size of the routing table
+  struct MemoryUsage
+  {
+    std::size_t uris = 0;        // Routed URIs
+    std::size_t entries = 0;     // Service entries in the URI lists
+    std::size_t backends = 0;    // Distinct backend servers
+    std::size_t forwarders = 0;  // Distinct forwarders
+    std::size_t bytes = 0;       // Estimated heap and object memory
+  };
 
   enum ForwardingMode : std::uint8_t
   {
@@ -75,9 +94,62 @@ class Services
 
   std::string itsCookieName;  // Affinity cookie name for the Sticky forwarder
 
+  mutable SmartMet::Spine::MutexType itsDetectorMutex;  // This guards the detector map
+
+  DetectorMap itsDetectors;  // Failure detectors by backend host:port
+
+  double itsPhiThreshold = 0;  // Suspicion level for removing a backend, 0 = disabled
+  double itsPhiSuspect = 1;    // Suspicion level at which down-weighting starts
+
+  std::chrono::milliseconds itsHeartbeatEstimate{7000};  // Expected heartbeat interval
+  std::chrono::milliseconds itsMinStdDev{500};           // Minimum heartbeat deviation
+  std::chrono::milliseconds itsAcceptablePause{1000};    // Tolerated extra pause
+
+  // Forwarders shared by the URIs served by the same backends, by poolKey()
+  std::map<std::string, BackendForwarderPtr> itsPools;
+
+  // The servers of each backend host, one per port, for recognizing /hostname/uri requests
+  std::map<std::string, std::vector<BackendServerPtr>, std::less<>> itsHostIndex;
+
+  // Rotates /hostname/uri requests between the ports of a host
+  mutable std::atomic<std::size_t> itsHostRotation{0};
+
+  // Replies of the current discovery cycle, applied to the routing table by commit()
+  std::mutex itsStagingMutex;  // This guards the staged replies
+  std::vector<BackendServicePtr> itsStagedServices;
+  std::vector<BackendInfoRequestPtr> itsStagedInfoRequests;
+
+  // Scratch space of commit(), kept to reuse the allocations between cycles
+  std::vector<BackendServerPtr> itsReplied;  // Backends which replied, sorted by id
+  std::vector<bool> itsLiveMarks;            // Dropped routed entries
+  std::vector<bool> itsStagedMarks;          // Staged entries which are already routed
+
+  // Connection counts gossiped by other frontends, shared by all forwarders
+  std::shared_ptr<PeerConnections> itsPeerConnections = std::make_shared<PeerConnections>();
+
+  // Latency statistics of the routing hot paths, shared by all forwarders
+  std::shared_ptr<Instrumentation> itsInstrumentation = std::make_shared<Instrumentation>();
+
+  // Sampled routing decisions
+  RoutingTrace itsTrace;
+
+  // Counters for the metrics export
+  BackendMetrics itsMetrics;
+
+  // Total time the routing table write lock has been held in nanoseconds
+  mutable std::atomic<std::uint64_t> itsWriteLockTime{0};
+
   // Service accessing methods
   BackendServicePtr getService(const Spine::HTTP::Request& theRequest);
 
+  /**
+   * @brief Explain how a request would be routed
+   *
+   * Lists the candidate backends with their connection counts, loads, weights,
+   * probabilities or scores, and marks the choice. Nothing is modified.
+   */
+  std::unique_ptr<SmartMet::Spine::Table> explain(const Spine::HTTP::Request& theRequest) const;
+
   // Service management methods
   bool addService(const BackendServicePtr& theBackendService,
                   const std::string& theFrontEndURI,
@@ -90,7 +162,11 @@ class Services
 
   bool removeBackend(const std::string& theHostname, int thePort, const std::string& theURI = "");
 
-  bool latestSequence(int itsSequenceNumber);
+  void stageService(const BackendServicePtr& theBackendService);
+
+  void stageInfoRequest(const BackendInfoRequestPtr& theRequest);
+
+  void commit(int theSequenceNumber, bool thePrune);
 
   void setForwarding(const std::string& theMode,
                      float balancingCoefficient,
@@ -102,6 +178,44 @@ class Services
 
   void setBackendAlive(const std::string& theHostName, int thePort);
 
+  void signalBackendLife(const std::string& theHostName, int thePort);
+
+  bool updateBackendLoad(const std::string& theHostName, int thePort, float theLoad);
+
+  void setFailureDetection(double thePhiThreshold,
+                           double thePhiSuspect,
+                           std::chrono::milliseconds theHeartbeatEstimate,
+                           std::chrono::milliseconds theMinStdDev,
+                           std::chrono::milliseconds theAcceptablePause);
+
+  void heartbeat(const std::string& theHostName, int thePort);
+
+  void setHeartbeatInterval(std::chrono::milliseconds theInterval);
+
+  double maxSuspicion() const;
+
+  double suspicion(const std::string& theHostName, int thePort) const;
+
+  void updateSuspicion();
+
+  float suspicionWeight(double thePhi) const;
+
+  BackendForwarderPtr makeForwarder() const;
+
+  BackendForwarderPtr makeForwarder(const BackendServiceList& theList) const;
+
+  static std::string poolKey(const BackendServiceList& theList);
+
+  BackendForwarderPtr poolForwarder(const BackendServiceList& theList);
+
+  void prunePools();
+
+  static BackendServicePtr getHostService(const BackendServiceList& theList,
+                                          std::string_view theHostName,
+                                          std::size_t theTurn);
+
+  void indexHosts();
+
   ~Services() = default;
   Services() = default;
 
@@ -132,7 +246,82 @@ class Services
 
   BackendList getInfoRequestBackendList(const std::string& infoRequestName) const;
 
-  void setReactor(Spine::Reactor& theReactor);
+  void setReactor(ReactorAccess& theReactor);
+
+  PeerConnections& getPeerConnections() { return *itsPeerConnections; }
+
+  Instrumentation& getInstrumentation() { return *itsInstrumentation; }
+
+  /**
+   * @brief Latency statistics of the routing hot paths
+   *
+   * @return Table with one row per measured operation
+   */
+  std::unique_ptr<SmartMet::Spine::Table> latencies() const;
+
+  RoutingTrace& getRoutingTrace() { return itsTrace; }
+
+  BackendMetrics& getMetrics() { return itsMetrics; }
+
+  std::uint64_t writeLockTime() const { return itsWriteLockTime.load(std::memory_order_relaxed); }
+
+  MemoryUsage memoryUsage() const;
+
+  /**
+   * @brief Write the routing counters in OpenMetrics text format
+   *
+   * Only the read locks of the routing table and the sentinel map are taken.
+   * @param out Output stream to write the metrics to
+   */
+  void metrics(std::ostream& out) const;
+
+  /**
+   * @brief The most recent sampled routing decisions
+   *
+   * @param count Maximum number of decisions to list
+   * @return Table with one row per decision, newest first
+   */
+  std::unique_ptr<SmartMet::Spine::Table> routingTrace(std::size_t count) const;
+
+ private:
+  void traceHostService(const std::string& theURI, const BackendServicePtr& theService);
+
+  void traceDecision(const std::string& theURI,
+                     const std::string& thePrefix,
+                     BackendForwarder& theForwarder,
+                     std::size_t theChosen);
+
+  // Locks which record their wait and hold times when instrumentation is enabled
+  TimedLock<Spine::ReadLock> readLock() const
+  {
+    return {itsMutex, itsInstrumentation.get(), Instrumentation::RoutingReadWait,
+            Instrumentation::RoutingReadHold};
+  }
+
+  TimedLock<Spine::WriteLock> writeLock() const
+  {
+    return {itsMutex, itsInstrumentation.get(), Instrumentation::RoutingWriteWait,
+            Instrumentation::RoutingWriteHold, &itsWriteLockTime};
+  }
+
+  // Upgrades a commit's upgrade lock to exclusive access
+  TimedLock<Spine::UpgradeWriteLock> writeLock(Spine::UpgradeReadLock& theLock) const
+  {
+    return {theLock, itsInstrumentation.get(), Instrumentation::RoutingWriteWait,
+            Instrumentation::RoutingWriteHold, &itsWriteLockTime};
+  }
+
+  TimedLock<Spine::ReadLock> sentinelReadLock() const
+  {
+    return {itsSentinelMutex, itsInstrumentation.get(), Instrumentation::SentinelWait,
+            Instrumentation::SentinelHold};
+  }
+
+  TimedLock<Spine::WriteLock> sentinelWriteLock() const
+  {
+    return {itsSentinelMutex, itsInstrumentation.get(), Instrumentation::SentinelWait,
+            Instrumentation::SentinelHold};
+  }
 };
 
 }  // namespace SmartMet
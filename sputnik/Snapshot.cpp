@@ -0,0 +1,195 @@
+#include "BroadcastMessage.pb.h"
+#include "Engine.h"
+#include "Services.h"
+#include <macgyver/Exception.h>
+#include <spine/Convenience.h>
+#include <cstdio>
+#include <ctime>
+#include <limits>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace SmartMet
+{
+namespace Engine
+{
+namespace Sputnik
+{
+namespace
+{
+// Format version of the snapshot, incompatible snapshots are ignored
+constexpr unsigned int kSnapshotFormat = 1;
+
+// Snapshots older than this are more likely to mislead than to help
+constexpr std::time_t kMaxSnapshotAge = 24 * 3600;
+
+// Read only memory mapping of a file
+class MappedFile
+{
+ public:
+  explicit MappedFile(const std::string& theFile)
+  {
+    itsFd = ::open(theFile.c_str(), O_RDONLY | O_CLOEXEC);
+    if (itsFd < 0)
+      return;
+
+    struct stat st;
+    if (::fstat(itsFd, &st) != 0 || st.st_size <= 0)
+      return;
+
+    itsModified = st.st_mtime;
+    const auto size = static_cast<std::size_t>(st.st_size);
+    void* data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, itsFd, 0);
+    if (data == MAP_FAILED)
+      return;
+
+    itsData = data;
+    itsSize = size;
+  }
+
+  ~MappedFile()
+  {
+    if (itsData != nullptr)
+      ::munmap(itsData, itsSize);
+    if (itsFd >= 0)
+      ::close(itsFd);
+  }
+
+  MappedFile(const MappedFile& other) = delete;
+  MappedFile& operator=(const MappedFile& other) = delete;
+  MappedFile(MappedFile&& other) = delete;
+  MappedFile& operator=(MappedFile&& other) = delete;
+
+  const void* data() const { return itsData; }
+  std::size_t size() const { return itsSize; }
+  std::time_t modified() const { return itsModified; }
+
+ private:
+  int itsFd = -1;
+  void* itsData = nullptr;
+  std::size_t itsSize = 0;
+  std::time_t itsModified = 0;
+};
+
+}  // namespace
+
+// Frontend
+void Engine::loadSnapshot()
+{
+  try
+  {
+    MappedFile file(itsSnapshotFile);
+    if (file.data() == nullptr)
+      return;
+
+    if (std::time(nullptr) - file.modified() > kMaxSnapshotAge)
+    {
+      std::cout << Spine::log_time_str() << " Sputnik ignored outdated routing snapshot "
+                << itsSnapshotFile << '\n';
+      return;
+    }
+
+    SmartMet::RoutingSnapshot snapshot;
+    if (file.size() > static_cast<std::size_t>(std::numeric_limits<int>::max()) ||
+        !snapshot.ParseFromArray(file.data(), static_cast<int>(file.size())) ||
+        snapshot.format() != kSnapshotFormat)
+    {
+      std::cerr << Spine::log_time_str() << " Sputnik ignored invalid routing snapshot "
+                << itsSnapshotFile << '\n';
+      return;
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+
+    for (const auto& saved : snapshot.replies())
+    {
+      if (!saved.has_host() || !saved.has_catalogversion() || saved.services_size() == 0)
+        continue;
+
+      // The provisional entries are replaced or pruned by the first discovery cycle
+      auto reply = std::make_shared<SmartMet::BroadcastMessage>(saved);
+      reply->set_seqnum(boost::numeric_cast<int>(itsFrontendSequence));
+      addReply(*reply, *reply);
+
+      // The backends are asked to confirm the cached catalogs instead of resending them
+      const auto& host = reply->host();
+      auto& catalog = itsCatalogs[host.ip() + ":" + std::to_string(host.port())];
+      catalog.reply = reply;
+      catalog.updated = now;
+
+      // Start the failure detector so that silent backends are eventually removed
+      itsServices.heartbeat(reply->name(), host.port());
+    }
+
+    itsServices.commit(boost::numeric_cast<int>(itsFrontendSequence), false);
+
+    for (const auto& roundtrips : snapshot.roundtrips())
+      for (auto value : roundtrips.milliseconds())
+        itsRoundTrips.add(roundtrips.backend(), value);
+
+    std::cout << Spine::log_time_str() << " Sputnik loaded " << snapshot.replies_size()
+              << " backends from routing snapshot " << itsSnapshotFile << '\n';
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+// Frontend
+void Engine::writeSnapshot()
+{
+  try
+  {
+    const auto now = std::chrono::steady_clock::now();
+    if (now - itsSnapshotTime < std::chrono::seconds(itsSnapshotInterval))
+      return;
+    itsSnapshotTime = now;
+
+    // Only backends which are currently responding are saved
+    const auto recent = std::chrono::milliseconds(2 * (itsCurrentInterval + itsHeartBeatTimeout));
+
+    SmartMet::RoutingSnapshot snapshot;
+    snapshot.set_format(kSnapshotFormat);
+
+    for (const auto& item : itsCatalogs)
+      if (item.second.reply && now - item.second.updated <= recent)
+        *snapshot.add_replies() = *item.second.reply;
+
+    for (const auto& item : itsRoundTrips.values())
+    {
+      auto* roundtrips = snapshot.add_roundtrips();
+      roundtrips->set_backend(item.first);
+      for (auto value : item.second)
+        roundtrips->add_milliseconds(static_cast<float>(value));
+    }
+
+    // Write atomically so that a crash never leaves a partial snapshot
+    const std::string tmpfile = itsSnapshotFile + ".tmp";
+    {
+      std::ofstream out(tmpfile, std::ios::binary | std::ios::trunc);
+      if (!out || !snapshot.SerializeToOstream(&out) || !out.flush())
+      {
+        std::cerr << Spine::log_time_str() << " Sputnik failed to write routing snapshot "
+                  << tmpfile << '\n';
+        return;
+      }
+    }
+
+    if (std::rename(tmpfile.c_str(), itsSnapshotFile.c_str()) != 0)
+      std::cerr << Spine::log_time_str() << " Sputnik failed to replace routing snapshot "
+                << itsSnapshotFile << '\n';
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+}  // namespace Sputnik
+}  // namespace Engine
+}  // namespace SmartMet
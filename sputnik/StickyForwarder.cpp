@@ -1,6 +1,7 @@
 #include "StickyForwarder.h"
 #include <boost/algorithm/string.hpp>
 #include <macgyver/Exception.h>
+#include <cmath>
 #include <cstdint>
 #include <limits>
 #include <string_view>
@@ -100,25 +101,52 @@ std::string StickyForwarder::extractKey(const Spine::HTTP::Request& theRequest)
   }
 }
 
-std::size_t StickyForwarder::getBackend(Spine::Reactor& theReactor,
+std::size_t StickyForwarder::getBackend(ReactorAccess& theReactor,
                                         const Spine::HTTP::Request& theRequest)
 {
   try
   {
-    SmartMet::Spine::WriteLock lock(itsMutex);
+    auto lock = this->lock();
 
     if (itsBackendInfos.empty())
       throw Fmi::Exception(BCP, "No backends available!");
 
-    // --- Connection-based safety: exclude clear hotspots --------------------
-    auto connections = theReactor.getBackendRequestStatus();
+    auto connections = connectionCounts(theReactor);
+    return select(connections, theRequest, nullptr);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void StickyForwarder::explainChoice(Connections& theConnections,
+                                    const Spine::HTTP::Request& theRequest,
+                                    Explanation& theExplanation) const
+{
+  try
+  {
+    theExplanation.chosen = select(theConnections, theRequest, &theExplanation);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
 
+std::size_t StickyForwarder::select(Connections& theConnections,
+                                    const Spine::HTTP::Request& theRequest,
+                                    Explanation* theExplanation) const
+{
+  try
+  {
+    // --- Connection-based safety: exclude clear hotspots --------------------
     std::vector<int> counts(itsBackendInfos.size());
     int min_count = std::numeric_limits<int>::max();
     for (std::size_t i = 0; i < itsBackendInfos.size(); ++i)
     {
       const auto& info = itsBackendInfos[i];
-      counts[i] = connections[info.hostName][info.port];  // zero if not found
+      counts[i] = theConnections[info.hostName][info.port];  // zero if not found
       min_count = std::min(min_count, counts[i]);
     }
 
@@ -131,23 +159,55 @@ std::size_t StickyForwarder::getBackend(Spine::Reactor& theReactor,
     const std::string key = extractKey(theRequest);
     const std::uint64_t keyHash = fnv1a(key, kFnvOffset);
 
+    if (theExplanation != nullptr)
+      theExplanation->method = std::string(itsWeighted ? "weighted " : "") +
+                               "rendezvous hashing of key '" + key +
+                               "', excluding backends with more than " +
+                               std::to_string(threshold) + " connections";
+
     std::size_t bestIndex = 0;
     std::uint64_t bestScore = 0;
+    double bestWeightedScore = 0;
     bool first = true;
     for (std::size_t i = 0; i < itsBackendInfos.size(); ++i)
     {
       if (counts[i] > threshold)
+      {
+        if (theExplanation != nullptr)
+          theExplanation->candidates[i].note = "excluded: " + std::to_string(counts[i]) +
+                                               " connections > " + std::to_string(threshold);
         continue;  // hotspot: not selectable at all
+      }
 
       const auto& info = itsBackendInfos[i];
       const std::string id = info.hostName + ":" + std::to_string(info.port);
       const std::uint64_t score = fnv1a(id, keyHash);
 
-      if (first || score > bestScore)
+      if (itsWeighted)
+      {
+        // Weighted rendezvous hashing: -w / ln(u) with u uniform in (0,1). With equal
+        // weights this orders the backends like the plain hash does.
+        const double u = (static_cast<double>(score >> 11) + 0.5) / 9007199254740992.0;
+        const double weighted = -info.weight / std::log(u);
+        if (theExplanation != nullptr)
+          theExplanation->candidates[i].score = std::to_string(weighted);
+        if (first || weighted > bestWeightedScore)
+        {
+          bestWeightedScore = weighted;
+          bestIndex = i;
+          first = false;
+        }
+      }
+      else
       {
-        bestScore = score;
-        bestIndex = i;
-        first = false;
+        if (theExplanation != nullptr)
+          theExplanation->candidates[i].score = std::to_string(score);
+        if (first || score > bestScore)
+        {
+          bestScore = score;
+          bestIndex = i;
+          first = false;
+        }
       }
     }
 
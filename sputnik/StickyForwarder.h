@@ -27,6 +27,10 @@ namespace SmartMet
  * As a safety measure backends whose active-connection count is significantly
  * higher than the least-loaded backend are excluded from selection entirely;
  * their keys spill deterministically to the next-best backend.
+ *
+ * Backends suspected by the failure detector have a reduced weight, and
+ * weighted rendezvous hashing moves a corresponding share of their keys
+ * elsewhere.
  */
 
 class StickyForwarder : public BackendForwarder
@@ -40,10 +44,19 @@ class StickyForwarder : public BackendForwarder
   StickyForwarder(StickyForwarder&& other) = delete;
   StickyForwarder& operator=(StickyForwarder&& other) = delete;
 
-  std::size_t getBackend(Spine::Reactor& theReactor,
+  std::size_t getBackend(ReactorAccess& theReactor,
                          const Spine::HTTP::Request& theRequest) override;
 
  private:
+  void explainChoice(Connections& theConnections,
+                     const Spine::HTTP::Request& theRequest,
+                     Explanation& theExplanation) const override;
+
+  // The HRW choice, optionally recording the scores and exclusions
+  std::size_t select(Connections& theConnections,
+                     const Spine::HTTP::Request& theRequest,
+                     Explanation* theExplanation) const;
+
   std::string extractKey(const Spine::HTTP::Request& theRequest) const;
 
   std::string itsCookieName;  /// Affinity cookie name; empty disables the cookie step.
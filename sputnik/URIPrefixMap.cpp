@@ -11,10 +11,8 @@ namespace
 std::string backend_service_id(const std::string& /* prefix */,
                                const SmartMet::BackendServicePtr& backendService)
 {
-  const auto backend_ptr = backendService->Backend();
-  std::string id = backend_ptr->Name() + ":" + std::to_string(backend_ptr->Port()) + ":" +
-                   std::to_string(backendService->SequenceNumber());
-  return id;
+  // The sequence number is not part of the id, it is updated in place each cycle
+  return backendService->Backend()->Id();
 }
 }  // namespace
 
@@ -0,0 +1,127 @@
+#include "StandInReactor.h"
+#include <utility>
+
+namespace SmartMet
+{
+void StandInReactor::setConnections(const std::string& theHostName, int thePort, int theCount)
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+  itsConnections[theHostName][thePort] = theCount;
+}
+
+void StandInReactor::startConnection(const std::string& theHostName, int thePort)
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+  ++itsConnections[theHostName][thePort];
+}
+
+void StandInReactor::clearConnections()
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+  itsConnections.clear();
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Finish a connection like the reactor does after a backend reply
+ *
+ * The hooks are called without the lock so that they may use the stand-in.
+ * Returns the number of hooks called.
+ */
+// ----------------------------------------------------------------------
+
+std::size_t StandInReactor::finishConnection(
+    const std::string& theHostName,
+    int thePort,
+    Spine::HTTP::ContentStreamer::StreamerStatus theStatus)
+{
+  std::map<std::string, ConnectionFinishedHook> hooks;
+  {
+    std::lock_guard<std::mutex> lock(itsMutex);
+    auto& count = itsConnections[theHostName][thePort];
+    if (count > 0)
+      --count;
+    hooks = itsHooks;
+  }
+
+  for (const auto& hook : hooks)
+    hook.second(theHostName, thePort, theStatus);
+  return hooks.size();
+}
+
+void StandInReactor::addURI(const std::string& theURI, bool thePrefix)
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+  itsURIs[theURI] = thePrefix;
+}
+
+void StandInReactor::clearURIs()
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+  itsURIs.clear();
+}
+
+void StandInReactor::addAdminRequestName(const std::string& theName)
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+  itsAdminRequestNames.insert(theName);
+}
+
+void StandInReactor::setLoadHigh(bool theFlag)
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+  itsLoadHigh = theFlag;
+}
+
+std::size_t StandInReactor::hookCount() const
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+  return itsHooks.size();
+}
+
+StandInReactor::Connections StandInReactor::getBackendRequestStatus() const
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+  return itsConnections;
+}
+
+// Only the keys of the URI map are scripted, the handlers are left empty
+StandInReactor::URIMap StandInReactor::getURIMap() const
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+  URIMap ret;
+  for (const auto& uri : itsURIs)
+    ret.emplace(uri.first, URIMap::mapped_type{});
+  return ret;
+}
+
+bool StandInReactor::isURIPrefix(const std::string& theURI) const
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+  auto pos = itsURIs.find(theURI);
+  return (pos != itsURIs.end() && pos->second);
+}
+
+StandInReactor::AdminRequestNames StandInReactor::getAdminRequestNames() const
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+  AdminRequestNames ret;
+  for (const auto& name : itsAdminRequestNames)
+    ret.insert(name);
+  return ret;
+}
+
+bool StandInReactor::isLoadHigh() const
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+  return itsLoadHigh;
+}
+
+bool StandInReactor::addBackendConnectionFinishedHook(const std::string& theName,
+                                                      ConnectionFinishedHook theHook)
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+  return itsHooks.emplace(theName, std::move(theHook)).second;
+}
+
+}  // namespace SmartMet
@@ -0,0 +1,62 @@
+#pragma once
+
+/*! \brief A stand-in reactor for standalone tools
+ *
+ * Services, the forwarders and Engine reach the server through the
+ * ReactorAccess interface. This implementation of it has a scriptable,
+ * thread safe state instead of a SmartMet server, so programs linking the
+ * engine objects with it can run Services and the forwarders on their own.
+ * Engine itself still needs a configured server.
+ */
+
+#include "ReactorAccess.h"
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+
+namespace SmartMet
+{
+class StandInReactor : public ReactorAccess
+{
+ public:
+  StandInReactor() = default;
+
+  // Connection counts returned by getBackendRequestStatus
+  void setConnections(const std::string& theHostName, int thePort, int theCount);
+  void startConnection(const std::string& theHostName, int thePort);
+  void clearConnections();
+
+  // Decrement the count and call the connection finished hooks in name order
+  std::size_t finishConnection(const std::string& theHostName,
+                               int thePort,
+                               Spine::HTTP::ContentStreamer::StreamerStatus theStatus);
+
+  // URIs returned by getURIMap and isURIPrefix
+  void addURI(const std::string& theURI, bool thePrefix = false);
+  void clearURIs();
+
+  void addAdminRequestName(const std::string& theName);
+  void setLoadHigh(bool theFlag);
+
+  std::size_t hookCount() const;
+
+  // ReactorAccess
+  Connections getBackendRequestStatus() const override;
+  URIMap getURIMap() const override;
+  bool isURIPrefix(const std::string& theURI) const override;
+  AdminRequestNames getAdminRequestNames() const override;
+  bool isLoadHigh() const override;
+  bool addBackendConnectionFinishedHook(const std::string& theName,
+                                        ConnectionFinishedHook theHook) override;
+
+ private:
+  mutable std::mutex itsMutex;
+  Connections itsConnections;
+  std::map<std::string, bool> itsURIs;  // URI and whether it is a prefix
+  std::set<std::string> itsAdminRequestNames;
+  bool itsLoadHigh = false;
+  std::map<std::string, ConnectionFinishedHook> itsHooks;
+};
+
+}  // namespace SmartMet
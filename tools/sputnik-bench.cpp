@@ -0,0 +1,480 @@
+// ======================================================================
+/*!
+ * \brief Microbenchmarks of the backend selection
+ *
+ * Measures BackendForwarder::getBackend for every forwarder type and
+ * Services::getService with a URI prefix map of realistic size, for a
+ * range of backend counts and contending threads. The engine objects run
+ * on the stand-in reactor, which gives each backend a random number of
+ * active connections and copies the counts under a mutex like the Spine
+ * reactor does.
+ *
+ * Each case runs twice. The first pass measures the time and the memory
+ * allocations per operation, the second pass is instrumented and measures
+ * the lock waits. Times are per operation and thread, so they grow with
+ * contention, while the throughput is for all threads together.
+ */
+// ======================================================================
+
+#include "StandInReactor.h"
+#include "DoubleRandomForwarder.h"
+#include "ExponentialConnectionsForwarder.h"
+#include "InverseConnectionsForwarder.h"
+#include "InverseLoadForwarder.h"
+#include "LeastConnectionsForwarder.h"
+#include "RandomForwarder.h"
+#include "Services.h"
+#include "StickyForwarder.h"
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace po = boost::program_options;
+using namespace SmartMet;
+
+// Allocations made by the current thread, counted by the replaced operator new.
+// The other forms of new call this one, and the default operator delete frees
+// the memory with std::free. Not inlined, since the compiler would then see
+// std::malloc paired with operator delete and warn about a mismatch.
+
+namespace
+{
+thread_local std::uint64_t allocations = 0;
+}  // namespace
+
+__attribute__((noinline)) void* operator new(std::size_t theSize)
+{
+  ++allocations;
+  if (void* ptr = std::malloc(theSize > 0 ? theSize : 1))
+    return ptr;
+  throw std::bad_alloc();
+}
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+  std::string forwarders =
+      "random,doublerandom,inverseload,inverseconnections,leastconnections,"
+      "exponentialconnections,sticky";
+  std::string suites = "forwarders,services";
+  std::string backends = "2,16,128,1024";
+  std::string threads = "1,2,4,8,16,32,64";
+  unsigned int duration = 200;
+  unsigned int uris = 200;
+  double prefixes = 0.2;
+  unsigned int maxConnections = 20;
+  float balanceFactor = 2.0F;
+};
+
+// The forwarding modes and their Services::ForwardingMode values
+const std::vector<std::pair<std::string, Services::ForwardingMode>> kModes = {
+    {"random", Services::Random},
+    {"inverseload", Services::InverseLoad},
+    {"inverseconnections", Services::InverseConnections},
+    {"leastconnections", Services::LeastConnections},
+    {"doublerandom", Services::DoubleRandom},
+    {"exponentialconnections", Services::ExponentialConnections},
+    {"sticky", Services::Sticky}};
+
+// Requests cycled through by each thread. They differ in the client and the
+// user agent, so that the sticky forwarder hashes different keys.
+constexpr std::size_t kRequestsPerThread = 64;
+
+struct Result
+{
+  double nsPerOp = 0;
+  double opsPerSecond = 0;
+  double allocsPerOp = 0;
+  LatencyHistogram::Summary forwarderWait;
+  LatencyHistogram::Summary tableWait;
+  bool hasTableWait = false;
+};
+
+std::vector<unsigned int> parseList(const std::string& theList)
+{
+  std::vector<std::string> parts;
+  boost::algorithm::split(parts, theList, boost::algorithm::is_any_of(","));
+  std::vector<unsigned int> ret;
+  for (const auto& part : parts)
+  {
+    const auto value = std::stoul(part);
+    if (value == 0)
+      throw std::runtime_error("Zero in list '" + theList + "'");
+    ret.push_back(static_cast<unsigned int>(value));
+  }
+  return ret;
+}
+
+std::vector<std::string> parseNames(const std::string& theList)
+{
+  std::vector<std::string> ret;
+  boost::algorithm::split(ret, theList, boost::algorithm::is_any_of(","));
+  return ret;
+}
+
+Services::ForwardingMode parseMode(const std::string& theName)
+{
+  for (const auto& mode : kModes)
+    if (mode.first == theName)
+      return mode.second;
+  throw std::runtime_error("Unknown forwarder '" + theName + "'");
+}
+
+BackendForwarderPtr makeForwarder(Services::ForwardingMode theMode, const Options& theOptions)
+{
+  switch (theMode)
+  {
+    case Services::Random:
+      return std::make_shared<RandomForwarder>();
+    case Services::InverseLoad:
+      return std::make_shared<InverseLoadForwarder>(theOptions.balanceFactor);
+    case Services::InverseConnections:
+      return std::make_shared<InverseConnectionsForwarder>(theOptions.balanceFactor);
+    case Services::LeastConnections:
+      return std::make_shared<LeastConnectionsForwarder>();
+    case Services::DoubleRandom:
+      return std::make_shared<DoubleRandomForwarder>();
+    case Services::ExponentialConnections:
+      return std::make_shared<ExponentialConnectionsForwarder>(theOptions.balanceFactor);
+    case Services::Sticky:
+      return std::make_shared<StickyForwarder>(theOptions.balanceFactor, "smartmet-session-id");
+  }
+  throw std::runtime_error("Unknown forwarder");
+}
+
+std::string backendName(unsigned int theIndex)
+{
+  return "backend" + std::to_string(theIndex);
+}
+
+// Random loads and connection counts for the backends
+std::vector<BackendInfo> makeBackends(unsigned int theCount,
+                                      const Options& theOptions,
+                                      StandInReactor& theReactor,
+                                      std::mt19937& theGenerator)
+{
+  std::uniform_real_distribution<float> load(0.0F, 4.0F);
+  std::uniform_int_distribution<int> connections(0, static_cast<int>(theOptions.maxConnections));
+
+  theReactor.clearConnections();
+  std::vector<BackendInfo> ret;
+  ret.reserve(theCount);
+  for (unsigned int i = 0; i < theCount; i++)
+  {
+    ret.emplace_back(backendName(i), 8080, load(theGenerator));
+    theReactor.setConnections(backendName(i), 8080, connections(theGenerator));
+  }
+  return ret;
+}
+
+// The catalog served by every backend, the first URIs are prefixes
+std::vector<std::string> makeCatalog(const Options& theOptions)
+{
+  const auto prefixes = static_cast<unsigned int>(theOptions.prefixes * theOptions.uris);
+  std::vector<std::string> ret;
+  ret.reserve(theOptions.uris);
+  for (unsigned int i = 0; i < theOptions.uris; i++)
+  {
+    if (i < prefixes)
+      ret.push_back("/prefix" + std::to_string(i));
+    else
+      ret.push_back("/service" + std::to_string(i) + "/data");
+  }
+  return ret;
+}
+
+std::vector<Spine::HTTP::Request> makeRequests(unsigned int theThread,
+                                               const std::vector<std::string>& theURIs)
+{
+  std::vector<Spine::HTTP::Request> ret(kRequestsPerThread);
+  for (std::size_t i = 0; i < ret.size(); i++)
+  {
+    auto& request = ret[i];
+    request.setResource(theURIs[(theThread * kRequestsPerThread + i) % theURIs.size()]);
+    request.setClientIP("10.0." + std::to_string(theThread) + "." + std::to_string(i));
+    request.setHeader("User-Agent", "bench/" + std::to_string(i));
+  }
+  return ret;
+}
+
+// Run the operation in the given number of threads for the configured time
+void runThreads(unsigned int theThreads,
+                const Options& theOptions,
+                const std::vector<std::string>& theURIs,
+                const std::function<void(const Spine::HTTP::Request&)>& theOperation,
+                Result& theResult)
+{
+  std::atomic<unsigned int> ready{0};
+  std::atomic<bool> started{false};
+  std::atomic<bool> stopped{false};
+
+  std::vector<std::uint64_t> ops(theThreads, 0);
+  std::vector<std::uint64_t> allocs(theThreads, 0);
+  std::vector<double> seconds(theThreads, 0);
+
+  std::vector<std::thread> workers;
+  workers.reserve(theThreads);
+  for (unsigned int t = 0; t < theThreads; t++)
+  {
+    workers.emplace_back(
+        [&, t]()
+        {
+          const auto requests = makeRequests(t, theURIs);
+          ++ready;
+          while (!started.load(std::memory_order_acquire))
+            std::this_thread::yield();
+
+          const auto allocStart = allocations;
+          const auto start = Clock::now();
+          std::uint64_t count = 0;
+          while (!stopped.load(std::memory_order_relaxed))
+          {
+            // Check the stop flag only once per round of requests
+            for (const auto& request : requests)
+              theOperation(request);
+            count += requests.size();
+          }
+          seconds[t] = std::chrono::duration<double>(Clock::now() - start).count();
+          allocs[t] = allocations - allocStart;
+          ops[t] = count;
+        });
+  }
+
+  while (ready.load() < theThreads)
+    std::this_thread::yield();
+
+  const auto start = Clock::now();
+  started.store(true, std::memory_order_release);
+  std::this_thread::sleep_for(std::chrono::milliseconds(theOptions.duration));
+  stopped = true;
+  for (auto& worker : workers)
+    worker.join();
+  const auto wall = std::chrono::duration<double>(Clock::now() - start).count();
+
+  std::uint64_t totalOps = 0;
+  std::uint64_t totalAllocs = 0;
+  double nsPerOp = 0;
+  for (unsigned int t = 0; t < theThreads; t++)
+  {
+    totalOps += ops[t];
+    totalAllocs += allocs[t];
+    nsPerOp += 1e9 * seconds[t] / static_cast<double>(std::max<std::uint64_t>(ops[t], 1));
+  }
+
+  theResult.nsPerOp = nsPerOp / theThreads;
+  theResult.opsPerSecond = static_cast<double>(totalOps) / wall;
+  theResult.allocsPerOp =
+      static_cast<double>(totalAllocs) / static_cast<double>(std::max<std::uint64_t>(totalOps, 1));
+}
+
+void printHeader(const std::string& theTitle)
+{
+  std::cout << '\n'
+            << theTitle << '\n'
+            << std::left << std::setw(24) << "forwarder" << std::right << std::setw(9)
+            << "backends" << std::setw(8) << "threads" << std::setw(11) << "ns/op"
+            << std::setw(11) << "Mops/s" << std::setw(10) << "allocs/op" << std::setw(14)
+            << "fwd wait us" << std::setw(14) << "fwd wait p99" << std::setw(14)
+            << "table wait us" << '\n';
+}
+
+void printResult(const std::string& theName,
+                 unsigned int theBackends,
+                 unsigned int theThreads,
+                 const Result& theResult)
+{
+  std::cout << std::left << std::setw(24) << theName << std::right << std::setw(9) << theBackends
+            << std::setw(8) << theThreads << std::fixed << std::setprecision(1) << std::setw(11)
+            << theResult.nsPerOp << std::setprecision(3) << std::setw(11)
+            << theResult.opsPerSecond / 1e6 << std::setprecision(2) << std::setw(10)
+            << theResult.allocsPerOp << std::setprecision(3) << std::setw(14)
+            << theResult.forwarderWait.mean << std::setw(14) << theResult.forwarderWait.p99
+            << std::setw(14);
+  if (theResult.hasTableWait)
+    std::cout << theResult.tableWait.mean;
+  else
+    std::cout << '-';
+  std::cout << std::endl;
+}
+
+// BackendForwarder::getBackend on its own
+void benchForwarders(const Options& theOptions, std::mt19937& theGenerator)
+{
+  const auto backendCounts = parseList(theOptions.backends);
+  const auto threadCounts = parseList(theOptions.threads);
+  const std::vector<std::string> uris = {"/timeseries"};
+
+  printHeader("BackendForwarder::getBackend");
+
+  for (const auto& name : parseNames(theOptions.forwarders))
+  {
+    const auto mode = parseMode(name);
+    for (auto backends : backendCounts)
+    {
+      StandInReactor standin;
+      ReactorAccess& reactor = standin;
+      auto infos = makeBackends(backends, theOptions, standin, theGenerator);
+
+      for (auto threads : threadCounts)
+      {
+        auto forwarder = makeForwarder(mode, theOptions);
+        auto instrumentation = std::make_shared<Instrumentation>();
+        forwarder->setInstrumentation(instrumentation, mode);
+        forwarder->setBackends(infos, reactor);
+
+        auto operation = [&](const Spine::HTTP::Request& theRequest)
+        { forwarder->getBackend(reactor, theRequest); };
+
+        Result result;
+        runThreads(threads, theOptions, uris, operation, result);
+
+        instrumentation->setEnabled(true);
+        Result instrumented;
+        runThreads(threads, theOptions, uris, operation, instrumented);
+        result.forwarderWait = instrumentation->histogram(Instrumentation::ForwarderWait).summary();
+
+        printResult(name, backends, threads, result);
+      }
+    }
+  }
+}
+
+// Services::getService with a routing table of every backend serving every URI
+void benchServices(const Options& theOptions, std::mt19937& theGenerator)
+{
+  const auto backendCounts = parseList(theOptions.backends);
+  const auto threadCounts = parseList(theOptions.threads);
+  const auto catalog = makeCatalog(theOptions);
+  const auto prefixes = static_cast<std::size_t>(theOptions.prefixes * theOptions.uris);
+
+  // Requests under the prefixes have a path after the prefix
+  std::vector<std::string> uris;
+  uris.reserve(catalog.size());
+  for (std::size_t i = 0; i < catalog.size(); i++)
+    uris.push_back(i < prefixes ? catalog[i] + "/layer/" + std::to_string(i) : catalog[i]);
+  std::shuffle(uris.begin(), uris.end(), theGenerator);
+
+  printHeader("Services::getService with " + std::to_string(catalog.size()) + " URIs, " +
+              std::to_string(prefixes) + " of them prefixes");
+
+  for (const auto& name : parseNames(theOptions.forwarders))
+  {
+    parseMode(name);
+    for (auto backends : backendCounts)
+    {
+      StandInReactor standin;
+      auto infos = makeBackends(backends, theOptions, standin, theGenerator);
+
+      for (auto threads : threadCounts)
+      {
+        // A fresh table for every case, since the lock statistics cannot be reset
+        Services services;
+        services.setReactor(standin);
+        services.setForwarding(name, theOptions.balanceFactor);
+        for (const auto& info : infos)
+        {
+          auto server = std::make_shared<BackendServer>(
+              info.hostName, "127.0.0.1", info.port, "", info.load, 100);
+          for (std::size_t i = 0; i < catalog.size(); i++)
+            services.stageService(
+                std::make_shared<BackendService>(server, catalog[i], 0, true, 1, i < prefixes));
+        }
+        services.commit(1, false);
+
+        auto operation = [&services](const Spine::HTTP::Request& theRequest)
+        { services.getService(theRequest); };
+
+        Result result;
+        runThreads(threads, theOptions, uris, operation, result);
+
+        auto& instrumentation = services.getInstrumentation();
+        instrumentation.setEnabled(true);
+        Result instrumented;
+        runThreads(threads, theOptions, uris, operation, instrumented);
+        instrumentation.setEnabled(false);
+
+        result.forwarderWait = instrumentation.histogram(Instrumentation::ForwarderWait).summary();
+        result.tableWait = instrumentation.histogram(Instrumentation::RoutingReadWait).summary();
+        result.hasTableWait = true;
+
+        printResult(name, backends, threads, result);
+      }
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+  try
+  {
+    Options options;
+
+    po::options_description desc("Benchmark the Sputnik backend selection");
+    desc.add_options()("help,h", "print this help")(
+        "forwarders,f", po::value(&options.forwarders), "comma separated forwarding modes")(
+        "suites,s",
+        po::value(&options.suites),
+        "comma separated suites: forwarders and services")(
+        "backends,n", po::value(&options.backends), "comma separated backend counts")(
+        "threads,t", po::value(&options.threads), "comma separated thread counts")(
+        "duration,d", po::value(&options.duration), "duration of each pass in milliseconds")(
+        "uris,u", po::value(&options.uris), "number of URIs in the routing table")(
+        "prefixes,p", po::value(&options.prefixes), "fraction of the URIs which are prefixes")(
+        "connections,c",
+        po::value(&options.maxConnections),
+        "maximum number of active connections per backend")(
+        "balance-factor,b", po::value(&options.balanceFactor), "forwarder balancing coefficient");
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help") > 0)
+    {
+      std::cout << desc << '\n';
+      return 0;
+    }
+
+    if (options.uris == 0)
+      throw std::runtime_error("The number of URIs must be positive");
+    if (options.prefixes < 0 || options.prefixes > 1)
+      throw std::runtime_error("The prefix fraction must be in the range 0...1");
+
+    std::mt19937 generator(12345);
+    for (const auto& suite : parseNames(options.suites))
+    {
+      if (suite == "forwarders")
+        benchForwarders(options, generator);
+      else if (suite == "services")
+        benchServices(options, generator);
+      else
+        throw std::runtime_error("Unknown suite '" + suite + "'");
+    }
+    return 0;
+  }
+  catch (const std::exception& e)
+  {
+    std::cerr << "Error: " << e.what() << '\n';
+    return 1;
+  }
+}
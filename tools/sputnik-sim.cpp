@@ -0,0 +1,806 @@
+// ======================================================================
+/*!
+ * \brief Discrete-event simulation of a frontend cluster
+ *
+ * Compares the forwarding strategies and their balance factors on the same
+ * workload. The real forwarder classes choose the backends, each frontend
+ * with its own stand-in reactor holding the frontend's active connections.
+ *
+ * The requests arrive at random frontends, as behind a common load
+ * balancer, either as a Poisson process or from a recorded trace. Each
+ * backend serves a fixed number of requests in parallel at its own speed
+ * and queues the rest up to a limit, beyond which requests are rejected.
+ * The backends report their loads to the frontends every heartbeat with a
+ * delay. Failed backends refuse requests until the frontends notice the
+ * failure, and rejoin at the first heartbeat after recovering.
+ *
+ * Every strategy sees the same arrivals and service demands. The report
+ * gives the latency percentiles of the completed requests, the rejected
+ * and failed requests, and the imbalance of the backend utilizations.
+ */
+// ======================================================================
+
+#include "StandInReactor.h"
+#include "DoubleRandomForwarder.h"
+#include "ExponentialConnectionsForwarder.h"
+#include "InverseConnectionsForwarder.h"
+#include "InverseLoadForwarder.h"
+#include "LeastConnectionsForwarder.h"
+#include "RandomForwarder.h"
+#include "StickyForwarder.h"
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <queue>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace po = boost::program_options;
+using namespace SmartMet;
+
+namespace
+{
+using StreamerStatus = Spine::HTTP::ContentStreamer::StreamerStatus;
+
+constexpr int kPort = 8080;
+
+struct Options
+{
+  unsigned int frontends = 2;
+  unsigned int backends = 16;
+  unsigned int capacity = 8;
+  unsigned int queueLimit = 64;
+  std::string speeds = "1";
+  double rate = 6000;
+  double duration = 60;
+  std::string mix = "light:0.9:5,heavy:0.1:100";
+  std::string distribution = "lognormal";
+  double sigma = 1.0;
+  double alpha = 2.5;
+  double heartbeat = 5000;
+  double heartbeatDelay = 100;
+  std::string failures;
+  double detection = 2000;
+  unsigned int clients = 1000;
+  std::string strategies =
+      "random,doublerandom,inverseload,inverseconnections,leastconnections,"
+      "exponentialconnections,sticky";
+  std::string balanceFactors = "2";
+  std::string trace;
+  unsigned int seed = 1;
+};
+
+// A request class of the workload
+struct RequestClass
+{
+  std::string name;
+  double share = 0;
+  double mean = 0;  // Mean service time in milliseconds at speed one
+};
+
+// The workload shared by all strategies
+struct Arrival
+{
+  double time = 0;
+  unsigned int frontend = 0;
+  unsigned int client = 0;
+  double demand = 0;  // Service time in milliseconds at speed one
+};
+
+struct Failure
+{
+  unsigned int backend = 0;
+  double start = 0;
+  double duration = 0;
+};
+
+struct Request
+{
+  std::size_t arrival = 0;
+  unsigned int frontend = 0;
+  double service = 0;
+};
+
+struct Backend
+{
+  std::string name;
+  double speed = 1;
+  bool down = false;
+  unsigned int epoch = 0;  // Incremented on failure to drop the pending completions
+  unsigned int busy = 0;
+  std::vector<unsigned int> active;  // Requests in service by frontend
+  std::deque<Request> queue;
+  double busyTime = 0;  // Integral of the busy workers over time
+  double lastChange = 0;
+};
+
+struct Frontend
+{
+  std::unique_ptr<StandInReactor> reactor;
+  BackendForwarderPtr forwarder;
+  std::vector<unsigned int> slots;  // Backend indexes in the order of the forwarder list
+};
+
+enum class EventType
+{
+  Arrival,
+  Completion,
+  Heartbeat,
+  Loads,
+  Failure,
+  Detection,
+  Recovery
+};
+
+struct Event
+{
+  double time = 0;
+  std::uint64_t sequence = 0;  // Keeps simultaneous events in creation order
+  EventType type = EventType::Arrival;
+  std::size_t index = 0;  // Arrival or backend index
+  unsigned int epoch = 0;
+  Request request;
+  std::vector<float> loads;
+
+  bool operator>(const Event& other) const
+  {
+    return time > other.time || (time == other.time && sequence > other.sequence);
+  }
+};
+
+struct Result
+{
+  std::string strategy;
+  float balanceFactor = 0;
+  std::size_t completed = 0;
+  std::size_t rejected = 0;
+  std::size_t failed = 0;
+  std::vector<double> latencies;
+  std::vector<double> utilizations;
+};
+
+std::vector<std::string> split(const std::string& theList, const char* theSeparators)
+{
+  std::vector<std::string> ret;
+  boost::algorithm::split(ret, theList, boost::algorithm::is_any_of(theSeparators));
+  return ret;
+}
+
+std::vector<RequestClass> parseMix(const std::string& theMix)
+{
+  std::vector<RequestClass> ret;
+  double total = 0;
+  for (const auto& item : split(theMix, ","))
+  {
+    const auto parts = split(item, ":");
+    if (parts.size() != 3)
+      throw std::runtime_error("Request class '" + item + "' is not of the form name:share:ms");
+    RequestClass rc{parts[0], std::stod(parts[1]), std::stod(parts[2])};
+    if (rc.share < 0 || rc.mean <= 0)
+      throw std::runtime_error("Invalid request class '" + item + "'");
+    total += rc.share;
+    ret.push_back(rc);
+  }
+  if (total <= 0)
+    throw std::runtime_error("The request class shares sum to zero");
+  for (auto& rc : ret)
+    rc.share /= total;
+  return ret;
+}
+
+// Failures in the form backend@start+duration, times in milliseconds
+std::vector<Failure> parseFailures(const std::string& theList, unsigned int theBackends)
+{
+  std::vector<Failure> ret;
+  if (theList.empty())
+    return ret;
+  for (const auto& item : split(theList, ","))
+  {
+    const auto parts = split(item, "@+");
+    if (parts.size() != 3)
+      throw std::runtime_error("Failure '" + item + "' is not of the form backend@start+duration");
+    Failure failure{static_cast<unsigned int>(std::stoul(parts[0])),
+                    std::stod(parts[1]),
+                    std::stod(parts[2])};
+    if (failure.backend >= theBackends)
+      throw std::runtime_error("Failure '" + item + "' refers to a nonexistent backend");
+    ret.push_back(failure);
+  }
+  return ret;
+}
+
+// Service demand with the given mean from the configured distribution
+double sampleDemand(double theMean, const Options& theOptions, std::mt19937_64& theGenerator)
+{
+  if (theOptions.distribution == "exponential")
+    return std::exponential_distribution<double>(1.0 / theMean)(theGenerator);
+  if (theOptions.distribution == "lognormal")
+  {
+    const double mu = std::log(theMean) - theOptions.sigma * theOptions.sigma / 2;
+    return std::lognormal_distribution<double>(mu, theOptions.sigma)(theGenerator);
+  }
+  if (theOptions.distribution == "pareto")
+  {
+    const double scale = theMean * (theOptions.alpha - 1) / theOptions.alpha;
+    const double u = std::uniform_real_distribution<double>(0, 1)(theGenerator);
+    return scale / std::pow(1 - u, 1 / theOptions.alpha);
+  }
+  if (theOptions.distribution == "constant")
+    return theMean;
+  throw std::runtime_error("Unknown distribution '" + theOptions.distribution + "'");
+}
+
+// Poisson arrivals, or the recorded ones from a trace of "time_ms class [client]" lines
+std::vector<Arrival> makeWorkload(const Options& theOptions,
+                                  const std::vector<RequestClass>& theClasses)
+{
+  std::mt19937_64 generator(theOptions.seed);
+  std::uniform_int_distribution<unsigned int> frontend(0, theOptions.frontends - 1);
+  std::uniform_int_distribution<unsigned int> client(0, theOptions.clients - 1);
+
+  std::vector<Arrival> ret;
+
+  if (!theOptions.trace.empty())
+  {
+    std::ifstream in(theOptions.trace);
+    if (!in)
+      throw std::runtime_error("Failed to open trace '" + theOptions.trace + "'");
+
+    std::string line;
+    while (std::getline(in, line))
+    {
+      if (line.empty() || line[0] == '#')
+        continue;
+      const auto parts = split(line, " \t");
+      if (parts.size() < 2)
+        throw std::runtime_error("Invalid trace line '" + line + "'");
+      const auto rc = std::find_if(theClasses.begin(),
+                                   theClasses.end(),
+                                   [&parts](const RequestClass& c) { return c.name == parts[1]; });
+      if (rc == theClasses.end())
+        throw std::runtime_error("Unknown request class in trace line '" + line + "'");
+
+      Arrival arrival;
+      arrival.time = std::stod(parts[0]);
+      arrival.frontend = frontend(generator);
+      arrival.client = (parts.size() > 2 ? static_cast<unsigned int>(std::stoul(parts[2]))
+                                         : client(generator));
+      arrival.demand = sampleDemand(rc->mean, theOptions, generator);
+      ret.push_back(arrival);
+    }
+    std::stable_sort(ret.begin(),
+                     ret.end(),
+                     [](const Arrival& a, const Arrival& b) { return a.time < b.time; });
+    return ret;
+  }
+
+  std::exponential_distribution<double> gap(theOptions.rate / 1000);
+  std::vector<double> shares;
+  for (const auto& rc : theClasses)
+    shares.push_back(rc.share);
+  std::discrete_distribution<std::size_t> pick(shares.begin(), shares.end());
+
+  const double end = 1000 * theOptions.duration;
+  for (double t = gap(generator); t < end; t += gap(generator))
+  {
+    Arrival arrival;
+    arrival.time = t;
+    arrival.frontend = frontend(generator);
+    arrival.client = client(generator);
+    arrival.demand = sampleDemand(theClasses[pick(generator)].mean, theOptions, generator);
+    ret.push_back(arrival);
+  }
+  return ret;
+}
+
+BackendForwarderPtr makeForwarder(const std::string& theStrategy, float theBalanceFactor)
+{
+  if (theStrategy == "random")
+    return std::make_shared<RandomForwarder>();
+  if (theStrategy == "doublerandom")
+    return std::make_shared<DoubleRandomForwarder>();
+  if (theStrategy == "inverseload")
+    return std::make_shared<InverseLoadForwarder>(theBalanceFactor);
+  if (theStrategy == "inverseconnections")
+    return std::make_shared<InverseConnectionsForwarder>(theBalanceFactor);
+  if (theStrategy == "leastconnections")
+    return std::make_shared<LeastConnectionsForwarder>();
+  if (theStrategy == "exponentialconnections")
+    return std::make_shared<ExponentialConnectionsForwarder>(theBalanceFactor);
+  if (theStrategy == "sticky")
+    return std::make_shared<StickyForwarder>(theBalanceFactor, "");
+  throw std::runtime_error("Unknown strategy '" + theStrategy + "'");
+}
+
+// Whether the balance factor changes the behaviour of the strategy
+bool usesBalanceFactor(const std::string& theStrategy)
+{
+  return (theStrategy == "inverseload" || theStrategy == "inverseconnections" ||
+          theStrategy == "exponentialconnections" || theStrategy == "sticky");
+}
+
+class Simulation
+{
+ public:
+  Simulation(const Options& theOptions,
+             const std::vector<Arrival>& theArrivals,
+             const std::vector<Failure>& theFailures,
+             const std::string& theStrategy,
+             float theBalanceFactor);
+
+  Result run();
+
+ private:
+  void schedule(Event theEvent);
+  void advance(Backend& theBackend, double theTime);
+  void arrive(const Event& theEvent);
+  void start(unsigned int theBackend, const Request& theRequest, double theTime);
+  void complete(const Event& theEvent);
+  void fail(unsigned int theBackend, double theTime);
+  void deliverLoads(const Event& theEvent);
+
+  const Options& itsOptions;
+  const std::vector<Arrival>& itsArrivals;
+  const std::vector<Failure>& itsFailures;
+
+  std::vector<Backend> itsBackends;
+  std::vector<Frontend> itsFrontends;
+  std::priority_queue<Event, std::vector<Event>, std::greater<>> itsEvents;
+  std::uint64_t itsSequence = 0;
+  double itsNow = 0;
+  Result itsResult;
+};
+
+Simulation::Simulation(const Options& theOptions,
+                       const std::vector<Arrival>& theArrivals,
+                       const std::vector<Failure>& theFailures,
+                       const std::string& theStrategy,
+                       float theBalanceFactor)
+    : itsOptions(theOptions), itsArrivals(theArrivals), itsFailures(theFailures)
+{
+  itsResult.strategy = theStrategy;
+  itsResult.balanceFactor = theBalanceFactor;
+
+  const auto speeds = split(theOptions.speeds, ",");
+  std::vector<BackendInfo> infos;
+  for (unsigned int i = 0; i < theOptions.backends; i++)
+  {
+    Backend backend;
+    backend.name = "backend" + std::to_string(i);
+    backend.speed = std::stod(speeds[i % speeds.size()]);
+    if (backend.speed <= 0)
+      throw std::runtime_error("Backend speeds must be positive");
+    backend.active.resize(theOptions.frontends, 0);
+    infos.emplace_back(backend.name, kPort, 0.0F);
+    itsBackends.push_back(std::move(backend));
+  }
+
+  for (unsigned int i = 0; i < theOptions.frontends; i++)
+  {
+    Frontend frontend;
+    frontend.reactor = std::make_unique<StandInReactor>();
+    frontend.forwarder = makeForwarder(theStrategy, theBalanceFactor);
+    frontend.forwarder->setBackends(infos, *frontend.reactor);
+    for (unsigned int b = 0; b < theOptions.backends; b++)
+      frontend.slots.push_back(b);
+    itsFrontends.push_back(std::move(frontend));
+  }
+}
+
+void Simulation::schedule(Event theEvent)
+{
+  theEvent.sequence = itsSequence++;
+  itsEvents.push(std::move(theEvent));
+}
+
+// Accumulate the busy time of the backend up to the given time
+void Simulation::advance(Backend& theBackend, double theTime)
+{
+  theBackend.busyTime += theBackend.busy * (theTime - theBackend.lastChange);
+  theBackend.lastChange = theTime;
+}
+
+void Simulation::arrive(const Event& theEvent)
+{
+  const auto& arrival = itsArrivals[theEvent.index];
+  auto& frontend = itsFrontends[arrival.frontend];
+  if (frontend.slots.empty())
+  {
+    ++itsResult.failed;
+    return;
+  }
+
+  Spine::HTTP::Request request;
+  request.setResource("/simulation");
+  request.setClientIP("10." + std::to_string(arrival.client / 65536) + "." +
+                      std::to_string(arrival.client / 256 % 256) + "." +
+                      std::to_string(arrival.client % 256));
+  request.setHeader("User-Agent", "sputnik-sim");
+
+  const auto slot = frontend.forwarder->getBackend(*frontend.reactor, request);
+  const auto index = frontend.slots.at(slot);
+  auto& backend = itsBackends[index];
+
+  // Connections to a failed backend are refused at once
+  if (backend.down)
+  {
+    ++itsResult.failed;
+    return;
+  }
+
+  Request req{theEvent.index, arrival.frontend, arrival.demand / backend.speed};
+  if (backend.busy < itsOptions.capacity)
+    start(index, req, itsNow);
+  else if (backend.queue.size() < itsOptions.queueLimit)
+    backend.queue.push_back(req);
+  else
+  {
+    ++itsResult.rejected;
+    return;
+  }
+  frontend.reactor->startConnection(backend.name, kPort);
+}
+
+void Simulation::start(unsigned int theBackend, const Request& theRequest, double theTime)
+{
+  auto& backend = itsBackends[theBackend];
+  advance(backend, theTime);
+  ++backend.busy;
+  ++backend.active[theRequest.frontend];
+
+  Event event;
+  event.time = theTime + theRequest.service;
+  event.type = EventType::Completion;
+  event.index = theBackend;
+  event.epoch = backend.epoch;
+  event.request = theRequest;
+  schedule(std::move(event));
+}
+
+void Simulation::complete(const Event& theEvent)
+{
+  auto& backend = itsBackends[theEvent.index];
+  if (theEvent.epoch != backend.epoch)
+    return;
+
+  advance(backend, itsNow);
+  --backend.busy;
+  --backend.active[theEvent.request.frontend];
+
+  const auto& request = theEvent.request;
+  itsResult.latencies.push_back(itsNow - itsArrivals[request.arrival].time);
+  ++itsResult.completed;
+  itsFrontends[request.frontend].reactor->finishConnection(
+      backend.name, kPort, StreamerStatus::EXIT_OK);
+
+  if (!backend.queue.empty())
+  {
+    const auto next = backend.queue.front();
+    backend.queue.pop_front();
+    start(static_cast<unsigned int>(theEvent.index), next, itsNow);
+  }
+}
+
+// The requests in service and in the queue fail with the backend
+void Simulation::fail(unsigned int theBackend, double theTime)
+{
+  auto& backend = itsBackends[theBackend];
+  advance(backend, theTime);
+
+  for (unsigned int f = 0; f < itsFrontends.size(); f++)
+  {
+    for (unsigned int i = 0; i < backend.active[f]; i++)
+      itsFrontends[f].reactor->finishConnection(backend.name, kPort, StreamerStatus::EXIT_ERROR);
+    itsResult.failed += backend.active[f];
+    backend.active[f] = 0;
+  }
+  for (const auto& request : backend.queue)
+    itsFrontends[request.frontend].reactor->finishConnection(
+        backend.name, kPort, StreamerStatus::EXIT_ERROR);
+  itsResult.failed += backend.queue.size();
+
+  backend.queue.clear();
+  backend.busy = 0;
+  backend.down = true;
+  ++backend.epoch;
+}
+
+// Update the loads and add the recovered backends the frontends have removed
+void Simulation::deliverLoads(const Event& theEvent)
+{
+  BackendForwarder::BackendLoads loads;
+  for (std::size_t i = 0; i < itsBackends.size(); i++)
+    loads[itsBackends[i].name][kPort] = theEvent.loads[i];
+
+  for (auto& frontend : itsFrontends)
+  {
+    auto& reactor = *frontend.reactor;
+    for (unsigned int i = 0; i < itsBackends.size(); i++)
+    {
+      const auto& backend = itsBackends[i];
+      if (backend.down ||
+          std::find(frontend.slots.begin(), frontend.slots.end(), i) != frontend.slots.end())
+        continue;
+      frontend.forwarder->addBackend(backend.name, kPort, theEvent.loads[i], reactor);
+      frontend.slots.push_back(i);
+    }
+    frontend.forwarder->updateLoads(loads, reactor);
+  }
+}
+
+Result Simulation::run()
+{
+  for (std::size_t i = 0; i < itsArrivals.size(); i++)
+  {
+    Event event;
+    event.time = itsArrivals[i].time;
+    event.type = EventType::Arrival;
+    event.index = i;
+    schedule(std::move(event));
+  }
+
+  for (std::size_t i = 0; i < itsFailures.size(); i++)
+  {
+    const auto& failure = itsFailures[i];
+    Event event;
+    event.index = failure.backend;
+    event.type = EventType::Failure;
+    event.time = failure.start;
+    schedule(event);
+    event.type = EventType::Detection;
+    event.time = failure.start + itsOptions.detection;
+    schedule(event);
+    event.type = EventType::Recovery;
+    event.time = failure.start + failure.duration;
+    schedule(event);
+  }
+
+  const double end = (itsArrivals.empty() ? 0 : itsArrivals.back().time);
+  if (itsOptions.heartbeat > 0)
+  {
+    Event event;
+    event.type = EventType::Heartbeat;
+    event.time = itsOptions.heartbeat;
+    schedule(event);
+  }
+
+  while (!itsEvents.empty())
+  {
+    const auto event = itsEvents.top();
+    itsEvents.pop();
+    itsNow = event.time;
+
+    switch (event.type)
+    {
+      case EventType::Arrival:
+        arrive(event);
+        break;
+      case EventType::Completion:
+        complete(event);
+        break;
+      case EventType::Heartbeat:
+      {
+        // The loads are measured now and reach the frontends after the delay
+        Event loads;
+        loads.type = EventType::Loads;
+        loads.time = itsNow + itsOptions.heartbeatDelay;
+        for (const auto& backend : itsBackends)
+          loads.loads.push_back(static_cast<float>(backend.busy + backend.queue.size()) /
+                                static_cast<float>(itsOptions.capacity));
+        schedule(std::move(loads));
+
+        if (itsNow + itsOptions.heartbeat <= end)
+        {
+          Event next;
+          next.type = EventType::Heartbeat;
+          next.time = itsNow + itsOptions.heartbeat;
+          schedule(next);
+        }
+        break;
+      }
+      case EventType::Loads:
+        deliverLoads(event);
+        break;
+      case EventType::Failure:
+        fail(static_cast<unsigned int>(event.index), itsNow);
+        break;
+      case EventType::Detection:
+      {
+        const auto index = static_cast<unsigned int>(event.index);
+        const auto& backend = itsBackends[index];
+        if (!backend.down)
+          break;
+        for (auto& frontend : itsFrontends)
+        {
+          auto pos = std::find(frontend.slots.begin(), frontend.slots.end(), index);
+          if (pos == frontend.slots.end())
+            continue;
+          frontend.slots.erase(pos);
+          frontend.forwarder->removeBackend(backend.name, kPort, *frontend.reactor);
+        }
+        break;
+      }
+      case EventType::Recovery:
+      {
+        auto& backend = itsBackends[event.index];
+        advance(backend, itsNow);
+        backend.down = false;
+        break;
+      }
+    }
+  }
+
+  for (auto& backend : itsBackends)
+  {
+    advance(backend, itsNow);
+    itsResult.utilizations.push_back(
+        itsNow > 0 ? backend.busyTime / (itsNow * itsOptions.capacity) : 0.0);
+  }
+
+  return std::move(itsResult);
+}
+
+double percentile(std::vector<double>& theValues, double theFraction)
+{
+  if (theValues.empty())
+    return 0;
+  const auto n = static_cast<std::size_t>(theFraction * static_cast<double>(theValues.size() - 1));
+  std::nth_element(theValues.begin(), theValues.begin() + static_cast<std::ptrdiff_t>(n),
+                   theValues.end());
+  return theValues[n];
+}
+
+void printHeader()
+{
+  std::cout << std::left << std::setw(24) << "strategy" << std::right << std::setw(7) << "factor"
+            << std::setw(10) << "completed" << std::setw(9) << "rejected" << std::setw(8)
+            << "failed" << std::setw(10) << "p50 ms" << std::setw(10) << "p99 ms"
+            << std::setw(10) << "p999 ms" << std::setw(10) << "util avg" << std::setw(10)
+            << "util max" << std::setw(9) << "max/avg" << std::setw(8) << "cv" << '\n';
+}
+
+void printResult(Result& theResult)
+{
+  const auto& utils = theResult.utilizations;
+  const double mean =
+      utils.empty() ? 0 : std::accumulate(utils.begin(), utils.end(), 0.0) / utils.size();
+  const double max = utils.empty() ? 0 : *std::max_element(utils.begin(), utils.end());
+  double variance = 0;
+  for (auto u : utils)
+    variance += (u - mean) * (u - mean);
+  if (!utils.empty())
+    variance /= utils.size();
+
+  std::cout << std::left << std::setw(24) << theResult.strategy << std::right << std::fixed
+            << std::setprecision(2) << std::setw(7);
+  if (usesBalanceFactor(theResult.strategy))
+    std::cout << theResult.balanceFactor;
+  else
+    std::cout << '-';
+  std::cout << std::setw(10) << theResult.completed << std::setw(9) << theResult.rejected
+            << std::setw(8) << theResult.failed << std::setprecision(1) << std::setw(10)
+            << percentile(theResult.latencies, 0.5) << std::setw(10)
+            << percentile(theResult.latencies, 0.99) << std::setw(10)
+            << percentile(theResult.latencies, 0.999) << std::setprecision(3) << std::setw(10)
+            << mean << std::setw(10) << max << std::setw(9) << (mean > 0 ? max / mean : 0.0)
+            << std::setw(8) << (mean > 0 ? std::sqrt(variance) / mean : 0.0) << std::endl;
+}
+
+int run(const Options& theOptions)
+{
+  const auto classes = parseMix(theOptions.mix);
+  const auto failures = parseFailures(theOptions.failures, theOptions.backends);
+  const auto arrivals = makeWorkload(theOptions, classes);
+
+  std::vector<float> factors;
+  for (const auto& factor : split(theOptions.balanceFactors, ","))
+    factors.push_back(std::stof(factor));
+
+  std::cout << "Simulating " << arrivals.size() << " requests over " << theOptions.frontends
+            << " frontends and " << theOptions.backends << " backends with "
+            << theOptions.capacity << " workers each\n";
+  printHeader();
+
+  for (const auto& strategy : split(theOptions.strategies, ","))
+  {
+    // The factor does not matter to the other strategies
+    const std::size_t count = (usesBalanceFactor(strategy) ? factors.size() : 1);
+    for (std::size_t i = 0; i < count; i++)
+    {
+      Simulation simulation(theOptions, arrivals, failures, strategy, factors[i]);
+      auto result = simulation.run();
+      printResult(result);
+    }
+  }
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+  try
+  {
+    Options options;
+
+    po::options_description desc("Simulate a Sputnik frontend cluster");
+    desc.add_options()("help,h", "print this help")(
+        "frontends,f", po::value(&options.frontends), "number of frontends")(
+        "backends,n", po::value(&options.backends), "number of backends")(
+        "capacity,c", po::value(&options.capacity), "requests served in parallel per backend")(
+        "queue-limit,q",
+        po::value(&options.queueLimit),
+        "queued requests per backend before rejecting")(
+        "speeds",
+        po::value(&options.speeds),
+        "comma separated backend speeds, repeated over the backends")(
+        "rate,r", po::value(&options.rate), "requests per second")(
+        "duration,d", po::value(&options.duration), "simulated seconds")(
+        "mix,m",
+        po::value(&options.mix),
+        "request classes as name:share:mean_ms, separated by commas")(
+        "distribution",
+        po::value(&options.distribution),
+        "service time distribution: constant, exponential, lognormal or pareto")(
+        "sigma", po::value(&options.sigma), "lognormal shape")(
+        "alpha", po::value(&options.alpha), "pareto shape, above one")(
+        "heartbeat", po::value(&options.heartbeat), "load report interval in milliseconds")(
+        "heartbeat-delay",
+        po::value(&options.heartbeatDelay),
+        "load report delay in milliseconds")(
+        "failures",
+        po::value(&options.failures),
+        "backend failures as index@start_ms+duration_ms, separated by commas")(
+        "detection",
+        po::value(&options.detection),
+        "milliseconds until the frontends remove a failed backend")(
+        "clients", po::value(&options.clients), "number of distinct clients")(
+        "strategies,s", po::value(&options.strategies), "comma separated forwarding modes")(
+        "balance-factors,b",
+        po::value(&options.balanceFactors),
+        "comma separated balance factors to compare")(
+        "trace,t",
+        po::value(&options.trace),
+        "recorded arrivals as 'time_ms class [client]' lines instead of the rate")(
+        "seed", po::value(&options.seed), "random seed");
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help") > 0)
+    {
+      std::cout << desc << '\n';
+      return 0;
+    }
+
+    if (options.frontends == 0 || options.backends == 0 || options.capacity == 0 ||
+        options.clients == 0)
+      throw std::runtime_error(
+          "The frontend, backend, capacity and client counts must be positive");
+    if (options.rate <= 0 || options.duration <= 0)
+      throw std::runtime_error("The rate and the duration must be positive");
+    if (options.distribution == "pareto" && options.alpha <= 1)
+      throw std::runtime_error("The pareto shape must exceed one");
+    if (options.heartbeatDelay < 0 || options.detection < 0)
+      throw std::runtime_error("The delays must be nonnegative");
+
+    return run(options);
+  }
+  catch (const std::exception& e)
+  {
+    std::cerr << "Error: " << e.what() << '\n';
+    return 1;
+  }
+}
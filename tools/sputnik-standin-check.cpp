@@ -0,0 +1,157 @@
+// ======================================================================
+/*!
+ * \brief Check the routing code against the stand-in reactor
+ *
+ * Runs the Services routing table and the forwarders with scripted
+ * connection counts, URI maps and connection finished hooks. Prints the
+ * failed checks and exits with a nonzero status if there are any.
+ */
+// ======================================================================
+
+#include "StandInReactor.h"
+#include "Services.h"
+#include <exception>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+
+using namespace SmartMet;
+
+namespace
+{
+int failures = 0;
+
+void check(bool theCondition, const std::string& theName)
+{
+  if (theCondition)
+    return;
+  std::cerr << "FAILED: " << theName << '\n';
+  ++failures;
+}
+
+std::shared_ptr<BackendServer> makeServer(const std::string& theName, int thePort)
+{
+  return std::make_shared<BackendServer>(theName, "127.0.0.1", thePort, "", 0.0F, 100);
+}
+
+void addService(Services& theServices,
+                const std::shared_ptr<BackendServer>& theServer,
+                const std::string& theURI,
+                bool thePrefix = false)
+{
+  auto service = std::make_shared<BackendService>(theServer, theURI, 0, true, 1, thePrefix);
+  theServices.addService(service, theURI, theServer->Load(), theServer->Throttle());
+}
+
+std::string route(Services& theServices, const std::string& theURI)
+{
+  Spine::HTTP::Request request;
+  request.setResource(theURI);
+  auto service = theServices.getService(request);
+  return service ? service->Backend()->Id() : "none";
+}
+
+// The idle backend is always chosen by the least connections forwarder
+void checkConnectionCounts()
+{
+  StandInReactor standin;
+  Services services;
+  services.setReactor(standin);
+  services.setForwarding("leastconnections", 2.0F);
+
+  for (int port : {8081, 8082, 8083})
+    addService(services, makeServer("backend", port), "/timeseries");
+
+  standin.setConnections("backend", 8081, 10);
+  standin.setConnections("backend", 8082, 0);
+  standin.setConnections("backend", 8083, 10);
+
+  std::map<std::string, int> counts;
+  for (int i = 0; i < 100; i++)
+    ++counts[route(services, "/timeseries")];
+  check(counts.size() == 1 && counts["backend:8082"] == 100, "least connections choice");
+
+  standin.setConnections("backend", 8082, 20);
+  standin.setConnections("backend", 8083, 0);
+  check(route(services, "/timeseries") == "backend:8083", "least connections change");
+}
+
+// Prefixes are matched, unknown URIs are not routed
+void checkPrefixes()
+{
+  StandInReactor standin;
+  Services services;
+  services.setReactor(standin);
+  services.setForwarding("random", 2.0F);
+
+  addService(services, makeServer("wms", 8080), "/wms", true);
+  addService(services, makeServer("ts", 8080), "/timeseries");
+
+  check(route(services, "/wms/layers") == "wms:8080", "prefix routing");
+  check(route(services, "/timeseries") == "ts:8080", "exact routing");
+  check(route(services, "/unknown") == "none", "unknown URI");
+
+  services.removeBackend("wms", 8080);
+  check(route(services, "/wms/layers") == "none", "removed backend");
+}
+
+// The scripted reactor state is what the engine sees
+void checkReactor()
+{
+  StandInReactor standin;
+  ReactorAccess& reactor = standin;
+
+  standin.addURI("/timeseries");
+  standin.addURI("/wms", true);
+  check(reactor.getURIMap().size() == 2, "URI map");
+  check(reactor.isURIPrefix("/wms") && !reactor.isURIPrefix("/timeseries"), "URI prefixes");
+
+  check(!reactor.isLoadHigh(), "load initially low");
+  standin.setLoadHigh(true);
+  check(reactor.isLoadHigh(), "high load");
+
+  std::map<std::string, int> finished;
+  const bool added = reactor.addBackendConnectionFinishedHook(
+      "check",
+      [&finished](const std::string& theHostName,
+                  int thePort,
+                  Spine::HTTP::ContentStreamer::StreamerStatus /* theStatus */)
+      { ++finished[theHostName + ":" + std::to_string(thePort)]; });
+  check(added, "hook added");
+  check(!reactor.addBackendConnectionFinishedHook("check", {}), "duplicate hook rejected");
+
+  standin.startConnection("backend", 8080);
+  standin.startConnection("backend", 8080);
+  check(reactor.getBackendRequestStatus()["backend"][8080] == 2, "started connections");
+
+  const auto hooks = standin.finishConnection(
+      "backend", 8080, Spine::HTTP::ContentStreamer::StreamerStatus::EXIT_OK);
+  check(hooks == 1 && finished["backend:8080"] == 1, "hook fired");
+  check(reactor.getBackendRequestStatus()["backend"][8080] == 1, "finished connection");
+}
+
+}  // namespace
+
+int main()
+{
+  try
+  {
+    checkReactor();
+    checkConnectionCounts();
+    checkPrefixes();
+
+    if (failures > 0)
+    {
+      std::cerr << failures << " checks failed\n";
+      return 1;
+    }
+    std::cout << "All checks passed\n";
+    return 0;
+  }
+  catch (const std::exception& e)
+  {
+    std::cerr << "Error: " << e.what() << '\n';
+    return 1;
+  }
+}
@@ -0,0 +1,488 @@
+// ======================================================================
+/*!
+ * \brief Simulate a swarm of Sputnik backends on a single host
+ *
+ * Every fake backend answers the SERVICE_DISCOVERY_REQUEST messages sent to
+ * the listening address like a real backend would, with its own name, HTTP
+ * port, URI catalog, catalog version and load. The replies can be delayed,
+ * lost and their catalogs changed to see how a frontend copes with thousands
+ * of backends.
+ *
+ * Point the frontend to the swarm with
+ *
+ *   backendUdpListeners = ["127.0.0.1:31337"];
+ *
+ * For each discovery sequence the swarm reports the number of requests
+ * (startup probes), the time from the first to the last request of the
+ * sequence, the replies sent, lost and abbreviated, and the CPU time used by
+ * the swarm itself. The time until the frontend starts the next sequence
+ * after its startup burst is its convergence time. The frontend side costs
+ * are available from the frontend's own status reports.
+ */
+// ======================================================================
+
+#include "BroadcastMessage.pb.h"
+#include <boost/program_options.hpp>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <queue>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace po = boost::program_options;
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+std::atomic<bool> stopped{false};
+
+void handleSignal(int /* signal */)
+{
+  stopped = true;
+}
+
+// The catalog tokens must match the ones computed by the engine (64-bit FNV-1a)
+constexpr std::uint64_t kFnvOffset = 14695981039346656037ULL;
+constexpr std::uint64_t kFnvPrime = 1099511628211ULL;
+
+std::uint64_t fnv1a(std::string_view str, std::uint64_t seed = kFnvOffset)
+{
+  std::uint64_t hash = seed;
+  for (unsigned char c : str)
+  {
+    hash ^= c;
+    hash *= kFnvPrime;
+  }
+  return hash;
+}
+
+struct Options
+{
+  std::string listen = "127.0.0.1:31337";
+  unsigned int backends = 500;
+  unsigned int uris = 50;
+  double shared = 0.9;
+  unsigned int basePort = 20000;
+  double delay = 0.5;
+  double jitter = 20;
+  double loss = 0;
+  double churn = 0;
+  std::string loadProfile = "uniform";
+  double load = 0.5;
+  double loadAmplitude = 0.5;
+  double loadPeriod = 60;
+  int throttle = 0;
+};
+
+struct Backend
+{
+  std::string name;
+  int port = 0;
+  double phase = 0;
+  bool churned = false;  // Whether the optional churn URI is currently advertised
+  SmartMet::BroadcastMessage reply;
+  std::uint64_t token = 0;  // Catalog id xor'ed with the catalog version
+};
+
+// A reply waiting for its send time
+struct Pending
+{
+  Clock::time_point time;
+  unsigned int backend;
+  int seqnum;
+  bool full;
+  sockaddr_storage address;
+  socklen_t length;
+
+  bool operator>(const Pending& other) const { return time > other.time; }
+};
+
+// Statistics of one discovery sequence
+struct Sequence
+{
+  int seqnum = -1;
+  unsigned int requests = 0;
+  Clock::time_point first;
+  Clock::time_point last;
+  unsigned int sent = 0;
+  unsigned int lost = 0;
+  unsigned int abbreviated = 0;
+  unsigned int oversize = 0;
+  unsigned int errors = 0;
+  double cpu = 0;
+};
+
+double cpuSeconds()
+{
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  return static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+         static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+}
+
+double milliseconds(Clock::duration theDuration)
+{
+  return std::chrono::duration<double, std::milli>(theDuration).count();
+}
+
+// Build the catalog of a backend and its version like the engine does
+void buildCatalog(Backend& theBackend, const Options& theOptions)
+{
+  auto& reply = theBackend.reply;
+  reply.clear_services();
+
+  const auto shared = static_cast<unsigned int>(std::lround(theOptions.shared * theOptions.uris));
+
+  std::vector<std::string> uris;
+  uris.reserve(theOptions.uris + 1);
+  for (unsigned int i = 0; i < theOptions.uris; i++)
+  {
+    if (i < shared)
+      uris.push_back("/swarm/shared/" + std::to_string(i));
+    else
+      uris.push_back("/swarm/" + theBackend.name + "/" + std::to_string(i));
+  }
+  if (theBackend.churned)
+    uris.push_back("/swarm/" + theBackend.name + "/churn");
+
+  // The engine lists the handlers in sorted order
+  std::sort(uris.begin(), uris.end());
+
+  std::uint64_t version = kFnvOffset;
+  for (const auto& uri : uris)
+  {
+    auto* service = reply.add_services();
+    service->set_uri(uri);
+    service->set_lastupdate(0);
+    service->set_allowcache(true);
+    version = fnv1a(uri, version);
+    version = fnv1a("U", version);
+  }
+
+  reply.set_catalogversion(version);
+  theBackend.token = fnv1a(reply.host().ip() + ":" + std::to_string(theBackend.port)) ^ version;
+}
+
+float backendLoad(const Backend& theBackend, const Options& theOptions, std::mt19937& theGenerator)
+{
+  double load = theOptions.load;
+  if (theOptions.loadProfile == "uniform")
+  {
+    std::uniform_real_distribution<double> uniform(-1, 1);
+    load += theOptions.loadAmplitude * uniform(theGenerator);
+  }
+  else if (theOptions.loadProfile == "sine")
+  {
+    const double t = std::chrono::duration<double>(Clock::now().time_since_epoch()).count();
+    load += theOptions.loadAmplitude *
+            std::sin(2 * M_PI * t / theOptions.loadPeriod + theBackend.phase);
+  }
+  return static_cast<float>(std::max(0.0, load));
+}
+
+sockaddr_in parseAddress(const std::string& theAddress)
+{
+  const auto colon = theAddress.rfind(':');
+  if (colon == std::string::npos)
+    throw std::runtime_error("Invalid address '" + theAddress + "', expecting ip:port");
+
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(static_cast<std::uint16_t>(std::stoi(theAddress.substr(colon + 1))));
+  if (inet_pton(AF_INET, theAddress.substr(0, colon).c_str(), &address.sin_addr) != 1)
+    throw std::runtime_error("Invalid IPv4 address '" + theAddress + "'");
+  return address;
+}
+
+void report(const Sequence& theSequence)
+{
+  if (theSequence.seqnum < 0)
+    return;
+
+  std::cout << "seq " << std::setw(5) << theSequence.seqnum << "  probes " << theSequence.requests
+            << "  span " << std::fixed << std::setprecision(1)
+            << milliseconds(theSequence.last - theSequence.first) << " ms  sent "
+            << theSequence.sent << "  lost " << theSequence.lost << "  abbreviated "
+            << theSequence.abbreviated << "  oversize " << theSequence.oversize << "  errors "
+            << theSequence.errors << "  cpu " << std::setprecision(1) << theSequence.cpu * 1000
+            << " ms\n"
+            << std::flush;
+}
+
+int run(const Options& theOptions)
+{
+  const auto listen = parseAddress(theOptions.listen);
+
+  const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0)
+    throw std::runtime_error(std::string("socket: ") + std::strerror(errno));
+
+  const int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  // Thousands of replies are sent in a burst
+  const int bufsize = 16 * 1024 * 1024;
+  setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+
+  if (bind(fd, reinterpret_cast<const sockaddr*>(&listen), sizeof(listen)) < 0)
+    throw std::runtime_error("bind " + theOptions.listen + ": " + std::strerror(errno));
+
+  std::mt19937 generator(std::random_device{}());
+  std::uniform_real_distribution<double> unit(0, 1);
+
+  std::vector<Backend> backends(theOptions.backends);
+  for (unsigned int i = 0; i < backends.size(); i++)
+  {
+    auto& backend = backends[i];
+    std::ostringstream name;
+    name << "swarm-" << std::setw(4) << std::setfill('0') << i;
+    backend.name = name.str();
+    backend.port = static_cast<int>(theOptions.basePort + i);
+    backend.phase = 2 * M_PI * unit(generator);
+
+    auto& reply = backend.reply;
+    reply.set_name(backend.name);
+    reply.set_messagetype(SmartMet::BroadcastMessage::SERVICE_DISCOVERY_REPLY);
+    reply.set_seqnum(0);
+    auto* host = reply.mutable_host();
+    host->set_ip("127.0.0.1");
+    host->set_port(backend.port);
+    host->set_comment("Sputnik swarm backend");
+    host->set_load(0);
+    host->set_throttle(theOptions.throttle);
+
+    buildCatalog(backend, theOptions);
+  }
+
+  std::cout << "Sputnik swarm of " << backends.size() << " backends with " << theOptions.uris
+            << " URIs each listening on " << theOptions.listen << '\n'
+            << std::flush;
+
+  std::priority_queue<Pending, std::vector<Pending>, std::greater<>> pending;
+  Sequence sequence;
+  Sequence total;
+  double cpuStart = cpuSeconds();
+  std::vector<char> buffer(65536);
+  std::string serialized;
+
+  while (!stopped)
+  {
+    // Wait for a request or the next reply to be due
+    int timeout = 100;
+    if (!pending.empty())
+      timeout = std::max(
+          0,
+          static_cast<int>(std::ceil(milliseconds(pending.top().time - Clock::now()))));
+
+    pollfd pfd{fd, POLLIN, 0};
+    const int ready = poll(&pfd, 1, std::min(timeout, 100));
+    if (ready < 0 && errno != EINTR)
+      throw std::runtime_error(std::string("poll: ") + std::strerror(errno));
+
+    // Receive all queued requests
+    while (ready > 0)
+    {
+      sockaddr_storage from{};
+      socklen_t fromlen = sizeof(from);
+      const auto n = recvfrom(
+          fd, buffer.data(), buffer.size(), MSG_DONTWAIT, reinterpret_cast<sockaddr*>(&from), &fromlen);
+      if (n < 0)
+        break;
+
+      SmartMet::BroadcastMessage request;
+      if (!request.ParseFromArray(buffer.data(), static_cast<int>(n)) ||
+          request.messagetype() != SmartMet::BroadcastMessage::SERVICE_DISCOVERY_REQUEST)
+        continue;
+
+      const auto now = Clock::now();
+
+      if (request.seqnum() != sequence.seqnum)
+      {
+        // A new discovery cycle, report the previous one
+        sequence.cpu = cpuSeconds() - cpuStart;
+        report(sequence);
+        total.requests += sequence.requests;
+        total.sent += sequence.sent;
+        total.lost += sequence.lost;
+        total.errors += sequence.errors;
+
+        sequence = Sequence();
+        sequence.seqnum = request.seqnum();
+        sequence.first = now;
+        cpuStart = cpuSeconds();
+
+        // Some backends change their catalogs between the cycles
+        if (theOptions.churn > 0)
+          for (auto& backend : backends)
+            if (unit(generator) < theOptions.churn)
+            {
+              backend.churned = !backend.churned;
+              buildCatalog(backend, theOptions);
+            }
+      }
+
+      ++sequence.requests;
+      sequence.last = now;
+
+      const auto& known = request.knowncatalogs();
+      const std::size_t maxSize =
+          (request.maxdatagramsize() > 0 ? request.maxdatagramsize() : buffer.size());
+
+      for (unsigned int i = 0; i < backends.size(); i++)
+      {
+        if (unit(generator) < theOptions.loss)
+        {
+          ++sequence.lost;
+          continue;
+        }
+
+        Pending reply{};
+        reply.time = now + std::chrono::microseconds(static_cast<std::int64_t>(
+                               1000 * (theOptions.delay + theOptions.jitter * unit(generator))));
+        reply.backend = i;
+        reply.seqnum = request.seqnum();
+        reply.full =
+            (std::find(known.begin(), known.end(), backends[i].token) == known.end());
+        reply.address = from;
+        reply.length = fromlen;
+
+        // The frontend skips truncated datagrams, real backends would fragment them
+        if (reply.full && backends[i].reply.ByteSizeLong() > maxSize)
+        {
+          ++sequence.oversize;
+          continue;
+        }
+        pending.push(reply);
+      }
+    }
+
+    // Send the replies which are due
+    const auto now = Clock::now();
+    while (!pending.empty() && pending.top().time <= now)
+    {
+      const auto reply = pending.top();
+      pending.pop();
+
+      auto& backend = backends[reply.backend];
+      backend.reply.set_seqnum(reply.seqnum);
+      backend.reply.mutable_host()->set_load(backendLoad(backend, theOptions, generator));
+
+      if (reply.full)
+        backend.reply.SerializeToString(&serialized);
+      else
+      {
+        // Abbreviated reply, the frontend takes the services from its cache
+        SmartMet::BroadcastMessage message;
+        message.set_name(backend.reply.name());
+        message.set_messagetype(backend.reply.messagetype());
+        message.set_seqnum(reply.seqnum);
+        *message.mutable_host() = backend.reply.host();
+        message.set_catalogversion(backend.reply.catalogversion());
+        message.SerializeToString(&serialized);
+        if (reply.seqnum == sequence.seqnum)
+          ++sequence.abbreviated;
+      }
+
+      const auto n = sendto(fd,
+                            serialized.data(),
+                            serialized.size(),
+                            0,
+                            reinterpret_cast<const sockaddr*>(&reply.address),
+                            reply.length);
+      if (reply.seqnum == sequence.seqnum)
+      {
+        if (n < 0)
+          ++sequence.errors;
+        else
+          ++sequence.sent;
+      }
+    }
+  }
+
+  sequence.cpu = cpuSeconds() - cpuStart;
+  report(sequence);
+  total.requests += sequence.requests;
+  total.sent += sequence.sent;
+  total.lost += sequence.lost;
+  total.errors += sequence.errors;
+
+  std::cout << "Total: " << total.requests << " requests, " << total.sent << " replies sent, "
+            << total.lost << " lost, " << total.errors << " send errors\n";
+
+  close(fd);
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+  try
+  {
+    Options options;
+
+    po::options_description desc("Simulate a swarm of Sputnik backends on one host");
+    desc.add_options()("help,h", "print this help")(
+        "listen,l", po::value(&options.listen), "UDP address for discovery requests (ip:port)")(
+        "backends,n", po::value(&options.backends), "number of fake backends")(
+        "uris,u", po::value(&options.uris), "number of URIs per backend")(
+        "shared,s",
+        po::value(&options.shared),
+        "fraction of the URIs served by all backends, the rest are unique")(
+        "port,p", po::value(&options.basePort), "HTTP port of the first backend")(
+        "delay,d", po::value(&options.delay), "minimum reply delay in milliseconds")(
+        "jitter,j", po::value(&options.jitter), "additional random reply delay in milliseconds")(
+        "loss", po::value(&options.loss), "probability of losing a reply")(
+        "churn", po::value(&options.churn), "probability of a catalog change per cycle")(
+        "load-profile",
+        po::value(&options.loadProfile),
+        "backend load profile: constant, uniform or sine")(
+        "load", po::value(&options.load), "mean backend load")(
+        "load-amplitude", po::value(&options.loadAmplitude), "load variation")(
+        "load-period", po::value(&options.loadPeriod), "period of the sine profile in seconds")(
+        "throttle", po::value(&options.throttle), "throttle limit reported by the backends");
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help") > 0)
+    {
+      std::cout << desc << '\n';
+      return 0;
+    }
+
+    if (options.loadProfile != "constant" && options.loadProfile != "uniform" &&
+        options.loadProfile != "sine")
+      throw std::runtime_error("Unknown load profile '" + options.loadProfile + "'");
+
+    std::signal(SIGINT, handleSignal);
+    std::signal(SIGTERM, handleSignal);
+
+    return run(options);
+  }
+  catch (const std::exception& e)
+  {
+    std::cerr << "Error: " << e.what() << '\n';
+    return 1;
+  }
+}